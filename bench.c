@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: MIT
+/**
+    Microbenchmarks for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    ccat_bench measures the primitives the CCAT drivers are built on, to
+    compare hardware generations and kernel versions:
+
+	modprobe ccat_bench function=0x16 (or fake=1 for a RAM baseline)
+	echo 1 > /sys/kernel/debug/ccat_bench/run
+	cat /sys/kernel/debug/ccat_bench/results
+
+    Writes are only issued to the SRAM function and to the fake BAR, flash
+    commands only to the Update function. Don't run the flash benchmark
+    while a firmware update is in progress.
+*/
+
+#include <linux/debugfs.h>
+#include <linux/dma-mapping.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/utsname.h>
+#include <linux/vmalloc.h>
+#ifndef CONFIG_PCI
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#endif
+#include "module.h"
+#include "update.h"
+
+MODULE_DESCRIPTION(DRV_DESCRIPTION);
+MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
+MODULE_LICENSE("GPL and additional rights");
+MODULE_VERSION(DRV_VERSION);
+
+static ushort function = CCATINFO_SRAM;
+module_param(function, ushort, 0444);
+MODULE_PARM_DESC(function,
+		 "Type of the CCAT function to benchmark (default: 0x16 SRAM)");
+
+static uint device;
+module_param(device, uint, 0444);
+MODULE_PARM_DESC(device, "Index of the CCAT to benchmark");
+
+static uint offset;
+module_param(offset, uint, 0444);
+MODULE_PARM_DESC(offset, "Register offset within the function to access");
+
+static bool fake;
+module_param(fake, bool, 0444);
+MODULE_PARM_DESC(fake, "Benchmark a RAM-backed fake BAR instead of a CCAT");
+
+static uint iterations = 10000;
+module_param(iterations, uint, 0644);
+MODULE_PARM_DESC(iterations, "Number of samples per test");
+
+#define CCAT_BENCH_FAKE_SIZE (size_t)(64 * 1024)
+#define CCAT_BENCH_COPY_MAX (size_t)(64 * 1024)
+#define CCAT_BENCH_COPY_BYTES (size_t)(1024 * 1024)
+#define CCAT_BENCH_FLASH_ITERATIONS 256
+#define CCAT_BENCH_ITERATIONS_MAX 1000000
+#define CCAT_BENCH_RESULTS_MAX 48
+
+/**
+ * struct ccat_bench_result - latency distribution of one test
+ * @test: name of the test
+ * @size: bytes transferred per sample, 0 for commands
+ * @count: number of samples
+ * @min_ns: fastest sample
+ * @avg_ns: average of all samples
+ * @p50_ns: median
+ * @p99_ns: 99th percentile
+ * @max_ns: slowest sample
+ * @kib_s: throughput in KiB/s, 0 for commands
+ */
+struct ccat_bench_result {
+	const char *test;
+	size_t size;
+	u32 count;
+	u64 min_ns;
+	u64 avg_ns;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 max_ns;
+	u64 kib_s;
+};
+
+/**
+ * struct ccat_bench - state of the benchmark
+ * @lock: serializes runs and readers of @results
+ * @debugfs: debugfs directory "ccat_bench"
+ * @owner: module of the CCAT driver, pinned while we access its BARs
+ * @dev: device of the CCAT, NULL for the fake BAR
+ * @ioaddr: address of the benchmarked function (plus @offset)
+ * @iosize: number of bytes accessible at @ioaddr
+ * @writable: writes to @ioaddr are harmless
+ * @flash: @ioaddr is a CCAT Update function
+ * @overhead_ns: cost of the timestamps around a sample
+ * @samples: one entry per iteration
+ * @copy: source and destination of memcpy_fromio() and memcpy_toio()
+ * @num_results: number of valid entries in @results
+ * @results: results of the last run
+ */
+struct ccat_bench {
+	struct mutex lock;
+	struct dentry *debugfs;
+	struct module *owner;
+	struct device *dev;
+	void __iomem *ioaddr;
+	size_t iosize;
+	bool writable;
+	bool flash;
+	u64 overhead_ns;
+	u32 *samples;
+	u8 *copy;
+	size_t num_results;
+	struct ccat_bench_result results[CCAT_BENCH_RESULTS_MAX];
+};
+
+static struct ccat_bench bench = {
+	.lock = __MUTEX_INITIALIZER(bench.lock),
+};
+
+/**
+ * CCAT_BENCH_SAMPLE() - time a single operation with interrupts disabled
+ */
+#define CCAT_BENCH_SAMPLE(b, i, op)					\
+do {									\
+	unsigned long __flags;						\
+	u64 __start;							\
+									\
+	local_irq_save(__flags);					\
+	__start = ktime_get_ns();					\
+	op;								\
+	(b)->samples[i] = ktime_get_ns() - __start;			\
+	local_irq_restore(__flags);					\
+} while (0)
+
+static int ccat_bench_cmp(const void *a, const void *b)
+{
+	const u32 x = *(const u32 *)a;
+	const u32 y = *(const u32 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * ccat_bench_account() - reduce the samples of a test to a result
+ * @test: name of the test
+ * @size: bytes transferred per sample
+ * @count: number of valid samples
+ *
+ * The timestamp overhead is subtracted from each sample.
+ */
+static void ccat_bench_account(struct ccat_bench *const b, const char *test,
+			       size_t size, u32 count)
+{
+	struct ccat_bench_result *const r = &b->results[b->num_results];
+	u64 sum = 0;
+	u32 i;
+
+	if (!count || b->num_results >= ARRAY_SIZE(b->results)) {
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		b->samples[i] = (b->samples[i] > b->overhead_ns) ?
+		    b->samples[i] - b->overhead_ns : 0;
+		sum += b->samples[i];
+	}
+	sort(b->samples, count, sizeof(*b->samples), ccat_bench_cmp, NULL);
+
+	r->test = test;
+	r->size = size;
+	r->count = count;
+	r->min_ns = b->samples[0];
+	r->avg_ns = div_u64(sum, count);
+	r->p50_ns = b->samples[count / 2];
+	r->p99_ns = b->samples[min(count - 1, count * 99 / 100)];
+	r->max_ns = b->samples[count - 1];
+	r->kib_s = (size && sum) ?
+	    div64_u64((u64) size * count * NSEC_PER_SEC, sum * 1024) : 0;
+	++b->num_results;
+}
+
+/**
+ * ccat_bench_overhead() - minimal cost of an empty sample
+ */
+static void ccat_bench_overhead(struct ccat_bench *const b, u32 count)
+{
+	u32 i, min = U32_MAX;
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, barrier());
+		min = min(min, b->samples[i]);
+	}
+	b->overhead_ns = min;
+}
+
+static void ccat_bench_mmio(struct ccat_bench *const b, u32 count)
+{
+	void __iomem *const addr = b->ioaddr;
+	u32 i;
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, ioread8(addr));
+	}
+	ccat_bench_account(b, "ioread8", 1, count);
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, ioread16(addr));
+	}
+	ccat_bench_account(b, "ioread16", 2, count);
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, ioread32(addr));
+	}
+	ccat_bench_account(b, "ioread32", 4, count);
+
+#ifdef CONFIG_64BIT
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, readq(addr));
+	}
+	ccat_bench_account(b, "readq", 8, count);
+#endif
+
+	if (!b->writable) {
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, iowrite8(i, addr));
+	}
+	ccat_bench_account(b, "iowrite8", 1, count);
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, iowrite16(i, addr));
+	}
+	ccat_bench_account(b, "iowrite16", 2, count);
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, iowrite32(i, addr));
+	}
+	ccat_bench_account(b, "iowrite32", 4, count);
+
+#ifdef CONFIG_64BIT
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, writeq(i, addr));
+	}
+	ccat_bench_account(b, "writeq", 8, count);
+#endif
+
+	/* writes are posted, a read back waits until the write completed */
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, iowrite32(i, addr); ioread32(addr));
+	}
+	ccat_bench_account(b, "iowrite32_flush", 4, count);
+}
+
+/**
+ * ccat_bench_copy() - memcpy_fromio() and memcpy_toio() bandwidth by size
+ *
+ * Sizes grow by a factor of four up to 64 KiB or the size of the function.
+ * Each size copies about 1 MiB, one sample per copy.
+ */
+static void ccat_bench_copy(struct ccat_bench *const b, u32 count)
+{
+	const size_t max = min(b->iosize, CCAT_BENCH_COPY_MAX);
+	size_t size;
+	u32 i;
+
+	for (size = 4; size <= max; size *= 4) {
+		const u32 reps = clamp_t(u32, CCAT_BENCH_COPY_BYTES / size, 1,
+					 count);
+
+		for (i = 0; i < reps; ++i) {
+			CCAT_BENCH_SAMPLE(b, i,
+					  memcpy_fromio(b->copy, b->ioaddr,
+							size));
+		}
+		ccat_bench_account(b, "memcpy_fromio", size, reps);
+
+		if (!b->writable) {
+			continue;
+		}
+
+		for (i = 0; i < reps; ++i) {
+			CCAT_BENCH_SAMPLE(b, i,
+					  memcpy_toio(b->ioaddr, b->copy,
+						      size));
+		}
+		ccat_bench_account(b, "memcpy_toio", size, reps);
+	}
+}
+
+/**
+ * ccat_bench_dma() - CPU side of a DMA descriptor round trip
+ *
+ * The DMA channels are owned by ccat_netdev, so no descriptors are queued
+ * to CCAT here. Instead we time what the driver does per descriptor: poll
+ * the status word CCAT writes into coherent memory and hand a descriptor
+ * back (coherent write, wmb(), doorbell, flush). Together with the
+ * loopback latency of "ethtool -t" this splits the round trip into CPU
+ * and device time.
+ */
+static void ccat_bench_dma(struct ccat_bench *const b, u32 count)
+{
+	const size_t size = PAGE_SIZE;
+	dma_addr_t phys = 0;
+	__le32 *desc;
+	u32 i;
+
+	if (b->dev) {
+		desc = dma_alloc_coherent(b->dev, size, &phys, GFP_KERNEL);
+	} else {
+		desc = kzalloc(size, GFP_KERNEL);
+	}
+	if (!desc) {
+		pr_warn("DMA benchmark skipped, out of memory\n");
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		CCAT_BENCH_SAMPLE(b, i, (void)READ_ONCE(desc[0]); rmb());
+	}
+	ccat_bench_account(b, "dma_desc_poll", 0, count);
+
+	if (b->writable) {
+		for (i = 0; i < count; ++i) {
+			CCAT_BENCH_SAMPLE(b, i, WRITE_ONCE(desc[0],
+							   cpu_to_le32(i));
+					  wmb();
+					  iowrite32(lower_32_bits(phys) + i,
+						    b->ioaddr);
+					  ioread32(b->ioaddr));
+		}
+		ccat_bench_account(b, "dma_desc_post", 4, count);
+	}
+
+	if (b->dev) {
+		dma_free_coherent(b->dev, size, desc, phys);
+	} else {
+		kfree(desc);
+	}
+}
+
+/**
+ * ccat_bench_flash() - latency of the CCAT Update flash commands
+ *
+ * The commands sleep while the flash is busy, so these samples are taken
+ * with interrupts enabled.
+ */
+static void ccat_bench_flash(struct ccat_bench *const b)
+{
+	void __iomem *const ioaddr = b->ioaddr;
+	u64 start;
+	u32 i;
+
+	for (i = 0; i < CCAT_BENCH_FLASH_ITERATIONS; ++i) {
+		start = ktime_get_ns();
+		ccat_get_status(ioaddr);
+		b->samples[i] = ktime_get_ns() - start;
+	}
+	ccat_bench_account(b, "flash_status", 0, i);
+
+	for (i = 0; i < CCAT_BENCH_FLASH_ITERATIONS; ++i) {
+		start = ktime_get_ns();
+		ccat_update_cmd(ioaddr, CCAT_GET_PROM_ID);
+		b->samples[i] = ktime_get_ns() - start;
+	}
+	ccat_bench_account(b, "flash_prom_id", 0, i);
+
+	for (i = 0; i < CCAT_BENCH_FLASH_ITERATIONS; ++i) {
+		start = ktime_get_ns();
+		ccat_read_flash_block(ioaddr, i * CCAT_DATA_BLOCK_SIZE,
+				      CCAT_DATA_BLOCK_SIZE, b->copy);
+		b->samples[i] = ktime_get_ns() - start;
+	}
+	ccat_bench_account(b, "flash_read_block", CCAT_DATA_BLOCK_SIZE, i);
+}
+
+static int ccat_bench_run(struct ccat_bench *const b)
+{
+	const u32 count = clamp_t(u32, iterations, CCAT_BENCH_FLASH_ITERATIONS,
+				  CCAT_BENCH_ITERATIONS_MAX);
+
+	b->samples = vmalloc(count * sizeof(*b->samples));
+	if (!b->samples) {
+		return -ENOMEM;
+	}
+
+	b->num_results = 0;
+	ccat_bench_overhead(b, count);
+	if (b->flash) {
+		/* plain MMIO to the Update function could disturb a command */
+		ccat_bench_flash(b);
+	} else {
+		ccat_bench_mmio(b, count);
+		cond_resched();
+		ccat_bench_copy(b, count);
+		cond_resched();
+		ccat_bench_dma(b, count);
+	}
+
+	vfree(b->samples);
+	b->samples = NULL;
+	return 0;
+}
+
+static ssize_t ccat_bench_run_write(struct file *file,
+				    const char __user * buf, size_t count,
+				    loff_t * ppos)
+{
+	int status;
+
+	if (mutex_lock_interruptible(&bench.lock)) {
+		return -ERESTARTSYS;
+	}
+	status = ccat_bench_run(&bench);
+	mutex_unlock(&bench.lock);
+	return status ? status : count;
+}
+
+static const struct file_operations ccat_bench_run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = ccat_bench_run_write,
+	.llseek = noop_llseek,
+};
+
+/**
+ * ccat_bench_results_show() - one line per test, whitespace separated
+ *
+ * Comment lines start with '#', the first one describes the setup, the
+ * second one names the columns.
+ */
+static int ccat_bench_results_show(struct seq_file *s, void *unused)
+{
+	const struct ccat_bench *const b = s->private;
+	size_t i;
+
+	mutex_lock(&bench.lock);
+	seq_printf(s,
+		   "# kernel=%s device=%s function=0x%x offset=0x%x overhead_ns=%llu\n",
+		   init_utsname()->release, b->dev ? dev_name(b->dev) : "fake",
+		   function, offset, b->overhead_ns);
+	seq_puts(s,
+		 "# test size count min_ns avg_ns p50_ns p99_ns max_ns kib_s\n");
+	for (i = 0; i < b->num_results; ++i) {
+		const struct ccat_bench_result *const r = &b->results[i];
+
+		seq_printf(s, "%s %zu %u %llu %llu %llu %llu %llu %llu\n",
+			   r->test, r->size, r->count, r->min_ns, r->avg_ns,
+			   r->p50_ns, r->p99_ns, r->max_ns, r->kib_s);
+	}
+	mutex_unlock(&bench.lock);
+	return 0;
+}
+
+static int ccat_bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_bench_results_show, inode->i_private);
+}
+
+static const struct file_operations ccat_bench_results_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_bench_results_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * ccat_bench_find_device() - get a reference to the @index-th CCAT
+ */
+static struct device *ccat_bench_find_device(unsigned int index)
+{
+#ifdef CONFIG_PCI
+	struct pci_dev *pdev = NULL;
+
+	while ((pdev = pci_get_device(PCI_VENDOR_ID_BECKHOFF,
+				      PCI_DEVICE_ID_BECKHOFF_CCAT, pdev))) {
+		if (!index--) {
+			return &pdev->dev;
+		}
+	}
+	return NULL;
+#else
+	struct device_node *np = NULL;
+	struct platform_device *pdev;
+
+	while ((np = of_find_compatible_node(np, NULL, "bhf,emi-ccat"))) {
+		if (!index--) {
+			pdev = of_find_device_by_node(np);
+			of_node_put(np);
+			return pdev ? &pdev->dev : NULL;
+		}
+	}
+	return NULL;
+#endif
+}
+
+/**
+ * ccat_bench_attach() - locate @function on a CCAT bound to ccat.ko
+ *
+ * The CCAT driver module is pinned until we are unloaded, so the BARs
+ * stay mapped.
+ */
+static int ccat_bench_attach(struct ccat_bench *const b)
+{
+	static const size_t block_size = sizeof(struct ccat_info_block);
+	struct ccat_info_block info;
+	struct ccat_device *ccatdev = NULL;
+	struct device *const dev = ccat_bench_find_device(device);
+	void __iomem *addr;
+	const void __iomem *end;
+
+	if (!dev) {
+		pr_err("CCAT %u not found\n", device);
+		return -ENODEV;
+	}
+
+	device_lock(dev);
+	if (dev->driver && try_module_get(dev->driver->owner)) {
+		b->owner = dev->driver->owner;
+		ccatdev = dev_get_drvdata(dev);
+	}
+	device_unlock(dev);
+	put_device(dev);
+	if (!ccatdev) {
+		pr_err("CCAT %u isn't bound to its driver\n", device);
+		return -ENODEV;
+	}
+
+	addr = ccatdev->bar_0;
+	end = addr + block_size * ioread8(addr + 4);
+	for (; addr < end; addr += block_size) {
+		memcpy_fromio(&info, addr, sizeof(info));
+		if (info.type == function && info.size > offset) {
+			b->dev = ccatdev->dev;
+			b->ioaddr = ccatdev->bar_0 + info.addr + offset;
+			b->iosize = info.size - offset;
+			b->writable = (CCATINFO_SRAM == function);
+			b->flash = (CCATINFO_EPCS_PROM == function);
+			return 0;
+		}
+	}
+
+	pr_err("CCAT %u has no function 0x%x with offset 0x%x\n", device,
+	       function, offset);
+	module_put(b->owner);
+	b->owner = NULL;
+	return -ENODEV;
+}
+
+static int __init ccat_bench_init(void)
+{
+	int status;
+
+	bench.copy = vzalloc(CCAT_BENCH_COPY_MAX);
+	if (!bench.copy) {
+		return -ENOMEM;
+	}
+
+	if (fake) {
+		/* a zeroed fake Update function even reports "not busy" */
+		bench.ioaddr = (void __force __iomem *)
+		    vzalloc(CCAT_BENCH_FAKE_SIZE);
+		bench.iosize = CCAT_BENCH_FAKE_SIZE;
+		bench.writable = true;
+		bench.flash = (CCATINFO_EPCS_PROM == function);
+		status = bench.ioaddr ? 0 : -ENOMEM;
+	} else {
+		status = ccat_bench_attach(&bench);
+	}
+	if (status) {
+		vfree(bench.copy);
+		return status;
+	}
+
+	bench.debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	debugfs_create_file("run", 0200, bench.debugfs, &bench,
+			    &ccat_bench_run_fops);
+	debugfs_create_file("results", 0444, bench.debugfs, &bench,
+			    &ccat_bench_results_fops);
+	return 0;
+}
+
+static void __exit ccat_bench_exit(void)
+{
+	debugfs_remove_recursive(bench.debugfs);
+	if (fake) {
+		vfree((void __force *)bench.ioaddr);
+	} else {
+		module_put(bench.owner);
+	}
+	vfree(bench.copy);
+}
+
+module_init(ccat_bench_init);
+module_exit(ccat_bench_exit);
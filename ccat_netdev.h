@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    Interface of /dev/ccat_eth* and of the in-kernel API of ccat_netdev.
+
+    TX templates are DMA TX slots excluded from the normal TX ring. A
+    cyclic master builds its frames once, patches only the process data
+    in place and retransmits a slot with a single descriptor write:
+
+	struct ccat_eth_template_info info;
+	int fd = open("/dev/ccat_eth0", O_RDWR);
+
+	ioctl(fd, CCAT_ETH_GET_TEMPLATE_INFO, &info);
+	base = mmap(NULL, info.mmap_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	frame = base + slot * info.slot_size + info.data_offset;
+	...build the frame once, then every cycle...
+	memcpy(frame + pd_offset, pd, pd_len);
+	ioctl(fd, CCAT_ETH_TEMPLATE_SEND, &(struct ccat_eth_template_send){
+	      .slot = slot, .length = len});
+
+    The capture ring records RX and TX frames with their CCAT timestamps
+    as pcapng Enhanced Packet Blocks. Write the preamble (Section Header
+    and Interface Description Block) once, followed by the blocks:
+
+	ioctl(fd, CCAT_ETH_CAPTURE_START, &cfg);
+	ctrl = mmap(NULL, CCAT_ETH_CAPTURE_HDR_SIZE + cfg.size, PROT_READ |
+		    PROT_WRITE, MAP_SHARED, fd, CCAT_ETH_MMAP_CAPTURE);
+	fwrite((char *)ctrl + ctrl->preamble_offset, ctrl->preamble_size, 1, f);
+	for (;;) {
+		head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			off = tail & (ctrl->data_size - 1);
+			block = (uint32_t *)((char *)ctrl + ctrl->data_offset + off);
+			if (!block[0]) {
+				tail += ctrl->data_size - off;
+				continue;
+			}
+			fwrite(block, block[1], 1, f);
+			tail += block[1];
+		}
+		__atomic_store_n(&ctrl->tail, tail, __ATOMIC_RELEASE);
+	}
+*/
+
+#ifndef _CCAT_NETDEV_H_
+#define _CCAT_NETDEV_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CCAT_ETH_IOC_MAGIC 0xcd
+
+/**
+ * struct ccat_eth_template_info - layout of the mmap()ed TX templates
+ * @count: number of template slots
+ * @slot_size: distance between two slots in bytes
+ * @data_offset: offset of the frame data within a slot
+ * @flags_offset: offset of the little endian 32 bit TX flags within a
+ *                slot, bit 0 is set by CCAT once the frame was sent
+ * @max_length: maximum frame length
+ * @mmap_size: length to use with mmap()
+ */
+struct ccat_eth_template_info {
+	__u32 count;
+	__u32 slot_size;
+	__u32 data_offset;
+	__u32 flags_offset;
+	__u32 max_length;
+	__u32 mmap_size;
+};
+
+/**
+ * struct ccat_eth_template_send - argument of CCAT_ETH_TEMPLATE_SEND
+ * @slot: template slot to transmit
+ * @length: number of frame bytes to transmit
+ */
+struct ccat_eth_template_send {
+	__u32 slot;
+	__u32 length;
+};
+
+#define CCAT_ETH_GET_TEMPLATE_INFO \
+	_IOR(CCAT_ETH_IOC_MAGIC, 0, struct ccat_eth_template_info)
+
+/**
+ * CCAT_ETH_TEMPLATE_SEND - transmit a template slot, fails with EBUSY if
+ * the previous transmission of that slot is still pending
+ */
+#define CCAT_ETH_TEMPLATE_SEND \
+	_IOW(CCAT_ETH_IOC_MAGIC, 1, struct ccat_eth_template_send)
+
+/**
+ * struct ccat_eth_capture_cfg - argument of CCAT_ETH_CAPTURE_START
+ * @size: size of the block ring, power of two between 64 KiB and 64 MiB
+ * @snaplen: frames are truncated to this length, 0 for complete frames
+ * @ethertypes: capture only frames of these EtherTypes, all zero: capture
+ *              everything
+ */
+struct ccat_eth_capture_cfg {
+	__u32 size;
+	__u32 snaplen;
+	__u16 ethertypes[4];
+};
+
+/**
+ * struct ccat_eth_capture_ctrl - first page of the capture mapping
+ * @head: ring position behind the last complete block, driver owned
+ * @tail: ring position behind the last consumed block, user owned
+ * @dropped: blocks dropped, because the ring was full
+ * @filtered: frames skipped by the EtherType filter
+ * @preamble_offset: offset of the pcapng SHB and IDB within the mapping
+ * @preamble_size: size of the pcapng SHB and IDB
+ * @data_offset: offset of the block ring within the mapping
+ * @data_size: size of the block ring
+ *
+ * Positions increase monotonically, the ring offset is position & (size-1).
+ * A block never wraps, a zero block type means "continue at offset 0".
+ */
+struct ccat_eth_capture_ctrl {
+	__u64 head;
+	__u64 tail;
+	__u64 dropped;
+	__u64 filtered;
+	__u32 preamble_offset;
+	__u32 preamble_size;
+	__u32 data_offset;
+	__u32 data_size;
+};
+
+/**
+ * CCAT_ETH_MMAP_CAPTURE - mmap() offset of the capture ring
+ * CCAT_ETH_CAPTURE_HDR_SIZE - control block and preamble in front of the
+ * block ring, map CCAT_ETH_CAPTURE_HDR_SIZE + ring size bytes
+ */
+#define CCAT_ETH_MMAP_CAPTURE 0x100000
+#define CCAT_ETH_CAPTURE_HDR_SIZE 0x10000
+
+#define CCAT_ETH_CAPTURE_START \
+	_IOW(CCAT_ETH_IOC_MAGIC, 2, struct ccat_eth_capture_cfg)
+#define CCAT_ETH_CAPTURE_STOP _IO(CCAT_ETH_IOC_MAGIC, 3)
+
+#ifdef __KERNEL__
+struct net_device;
+
+extern void *ccat_eth_template_get(struct net_device *dev, unsigned int slot,
+				   size_t *max_length);
+extern int ccat_eth_template_send(struct net_device *dev, unsigned int slot,
+				  size_t length);
+#endif /* #ifdef __KERNEL__ */
+
+#endif /* #ifndef _CCAT_NETDEV_H_ */
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Systemtime Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2016 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Steffen Dirkwinkel <s.dirkwinkel@beckhoff.com>
+
+    User space interface of /dev/ccat_systemtime*. The header is shared
+    with the driver; outside of the kernel it additionally provides a
+    header-only reader for the memory mapped systemtime register:
+
+	struct ccat_systemtime_map map;
+
+	if (!ccat_systemtime_map(&map, "/dev/ccat_systemtime0")) {
+		uint64_t now = ccat_systemtime_read(&map);
+		...
+		ccat_systemtime_unmap(&map);
+	}
+*/
+
+#ifndef _CCAT_SYSTEMTIME_H_
+#define _CCAT_SYSTEMTIME_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CCAT_SYSTEMTIME_IOC_MAGIC 0xcc
+
+/**
+ * CCAT_SYSTEMTIME_GET_MMAP_OFFSET - offset of the systemtime register
+ * within the page mapped by mmap(fd, PAGE_SIZE, PROT_READ, MAP_SHARED, 0)
+ *
+ * The page may contain registers of other CCAT functions, which would be
+ * readable through the mapping. In that case mmap() fails with EACCES for
+ * callers without CAP_SYS_RAWIO, unless ccat_systemtime was loaded with
+ * mmap_shared_page=1. read() of 8 bytes always works.
+ */
+#define CCAT_SYSTEMTIME_GET_MMAP_OFFSET \
+	_IOR(CCAT_SYSTEMTIME_IOC_MAGIC, 0, __u32)
+
+/**
+ * struct ccat_systemtime_sleep - argument of CCAT_SYSTEMTIME_SLEEP_UNTIL
+ * @target: absolute CCAT systemtime (ns) to wake up at
+ * @woken: CCAT systemtime right after the wake up
+ */
+struct ccat_systemtime_sleep {
+	__u64 target;
+	__u64 woken;
+};
+
+/**
+ * CCAT_SYSTEMTIME_SLEEP_UNTIL - sleep until the CCAT systemtime reaches
+ * @target. The driver continuously estimates the drift between the CCAT
+ * systemtime and CLOCK_MONOTONIC while the device is open and arms a
+ * CLOCK_MONOTONIC hrtimer accordingly. Interrupted sleeps are restarted
+ * transparently for SA_RESTART handlers, otherwise EINTR is returned.
+ */
+#define CCAT_SYSTEMTIME_SLEEP_UNTIL \
+	_IOWR(CCAT_SYSTEMTIME_IOC_MAGIC, 1, struct ccat_systemtime_sleep)
+
+#ifndef __KERNEL__
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * struct ccat_systemtime_map - user space mapping of the systemtime register
+ * @reg: the 64 bit systemtime register as low and high word, NULL if the
+ *	 page couldn't be mapped and the register is read() instead
+ * @page: start of the mapped page
+ * @size: size of the mapping
+ * @fd: file descriptor of the systemtime device
+ */
+struct ccat_systemtime_map {
+	const volatile uint32_t *reg;
+	void *page;
+	size_t size;
+	int fd;
+};
+
+static inline int ccat_systemtime_map(struct ccat_systemtime_map *map,
+				      const char *path)
+{
+	__u32 offset;
+
+	map->size = sysconf(_SC_PAGESIZE);
+	map->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (map->fd < 0) {
+		return -1;
+	}
+
+	if (ioctl(map->fd, CCAT_SYSTEMTIME_GET_MMAP_OFFSET, &offset)) {
+		goto close_fd;
+	}
+
+	map->page = mmap(NULL, map->size, PROT_READ, MAP_SHARED, map->fd, 0);
+	if (MAP_FAILED == map->page) {
+		/* shared page without privileges: use the syscall fallback */
+		map->page = NULL;
+		map->reg = NULL;
+		return 0;
+	}
+	map->reg = (const volatile uint32_t *)((char *)map->page + offset);
+	return 0;
+
+close_fd:
+	close(map->fd);
+	map->fd = -1;
+	return -1;
+}
+
+static inline void ccat_systemtime_unmap(struct ccat_systemtime_map *map)
+{
+	if (map->page) {
+		munmap(map->page, map->size);
+	}
+	close(map->fd);
+	map->fd = -1;
+}
+
+/**
+ * ccat_systemtime_read() - read the CCAT systemtime in nanoseconds
+ *
+ * 64 bit CPUs read the register with a single access. On 32 bit CPUs the
+ * high word is read before and after the low word; if it changed in
+ * between, the low word wrapped during the read and we try again.
+ * Without a mapping the driver reads the register for us.
+ *
+ * Return: CCAT systemtime, or 0 if read() failed (errno is set)
+ */
+static inline uint64_t ccat_systemtime_read(const struct ccat_systemtime_map
+					    *map)
+{
+	if (!map->reg) {
+		uint64_t now;
+
+		if (read(map->fd, &now, sizeof(now)) != sizeof(now)) {
+			return 0;
+		}
+		return now;
+	}
+#if UINTPTR_MAX > 0xffffffffu
+	return *(const volatile uint64_t *)map->reg;
+#else
+	uint32_t hi, lo;
+
+	do {
+		hi = map->reg[1];
+		lo = map->reg[0];
+	} while (hi != map->reg[1]);
+	return ((uint64_t) hi << 32) | lo;
+#endif
+}
+
+/**
+ * ccat_systemtime_sleep_until() - sleep until the CCAT systemtime reaches
+ * @target, f.e. the next DC cycle boundary
+ *
+ * Return: CCAT systemtime after the wake up, or 0 on error (errno is set)
+ */
+static inline uint64_t ccat_systemtime_sleep_until(const struct
+						   ccat_systemtime_map *map,
+						   uint64_t target)
+{
+	struct ccat_systemtime_sleep req = {.target = target };
+
+	if (ioctl(map->fd, CCAT_SYSTEMTIME_SLEEP_UNTIL, &req)) {
+		return 0;
+	}
+	return req.woken;
+}
+#endif /* #ifndef __KERNEL__ */
+
+#endif /* #ifndef _CCAT_SYSTEMTIME_H_ */
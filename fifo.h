@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    RX/TX frame rings shared between CCAT and ccat_netdev. Besides the
+    driver this header is compiled in user space by unittest/ring_bench.c,
+    which includes unittest/ring_shim.h first to provide the few kernel
+    primitives (ccat_iowrite32(), struct sk_buff, byte order, barriers)
+    used here. Keep everything that needs more of the kernel in netdev.c.
+*/
+
+#ifndef _CCAT_FIFO_H_
+#define _CCAT_FIFO_H_
+
+#ifdef __KERNEL__
+#include <linux/atomic.h>
+#include <linux/skbuff.h>
+#include "module.h"
+#endif
+
+struct ccat_dma_frame_hdr {
+	__le32 reserved1;
+	__le32 rx_flags;
+#define CCAT_FRAME_RECEIVED 0x1
+	__le16 length;
+	__le16 reserved3;
+	__le32 tx_flags;
+#define CCAT_FRAME_SENT 0x1
+	__le64 timestamp;
+};
+
+struct ccat_eim_frame_hdr {
+	__le16 length;
+	__le16 reserved3;
+	__le32 tx_flags;
+	__le64 timestamp;
+};
+
+struct ccat_eth_frame {
+	u8 placeholder[0x800];
+};
+
+struct ccat_dma_frame {
+	struct ccat_dma_frame_hdr hdr;
+	u8 data[sizeof(struct ccat_eth_frame) -
+		sizeof(struct ccat_dma_frame_hdr)];
+};
+
+struct ccat_eim_frame {
+	struct ccat_eim_frame_hdr hdr;
+	u8 data[sizeof(struct ccat_eth_frame) -
+		sizeof(struct ccat_eim_frame_hdr)];
+};
+
+#define MAX_PAYLOAD_SIZE \
+	(sizeof(struct ccat_eth_frame) - max(sizeof(struct ccat_dma_frame_hdr), sizeof(struct ccat_eim_frame_hdr)))
+
+/**
+ * struct ccat_dma/eim/mem
+ * @next: pointer to the next frame in fifo ring buffer
+ * @start: aligned CPU-viewed address(virtual) of the associated memory
+ */
+struct ccat_dma {
+	struct ccat_dma_frame *next;
+	void *start;
+};
+
+struct ccat_eim {
+	struct ccat_eim_frame __iomem *next;
+	void __iomem *start;
+};
+
+struct ccat_mem {
+	struct ccat_eth_frame *next;
+	void *start;
+};
+
+/**
+ * struct ccat_eth_fifo - CCAT RX or TX fifo
+ * @ops: function pointer table for dma/eim and rx/tx specific fifo functions
+ * @reg: PCI register address of this fifo
+ * @rx_bytes: number of bytes processed -> reported with ndo_get_stats64()
+ * @rx_dropped: number of dropped frames -> reported with ndo_get_stats64()
+ * @mmio_reads: 32 bit MMIO reads of the EIM fifo functions
+ * @mem/dma/eim: information about the associated memory
+ */
+struct ccat_eth_fifo {
+	const struct ccat_eth_fifo_operations *ops;
+	const struct ccat_eth_frame *end;
+	void __iomem *reg;
+	atomic64_t bytes;
+	atomic64_t dropped;
+	u64 mmio_reads;
+	union {
+		struct ccat_mem mem;
+		struct ccat_dma dma;
+		struct ccat_eim eim;
+	};
+};
+
+/**
+ * struct ccat_eth_fifo_operations
+ * @ready: callback used to test the next frames ready bit
+ * @add: callback used to add a frame to this fifo
+ * @timestamp: optional callback to read the CCAT timestamp of a processed
+ *             frame, returns 0 if no timestamp is available
+ * @copy_to_buf: callback used to copy the next frame of rx fifos
+ * @skb: callback used to queue skbs into tx fifos
+ */
+struct ccat_eth_fifo_operations {
+	size_t(*ready) (struct ccat_eth_fifo *);
+	void (*add) (struct ccat_eth_fifo *);
+	u64 (*timestamp) (const struct ccat_eth_frame *);
+	union {
+		void (*copy_to_buf) (struct ccat_eth_fifo *, void *, size_t);
+		void (*skb) (struct ccat_eth_fifo *, struct sk_buff *);
+	} queue;
+};
+
+static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo);
+static void fifo_set_end(struct ccat_eth_fifo *const fifo, size_t size)
+{
+	fifo->end = fifo->mem.start + size - sizeof(struct ccat_eth_frame);
+	ccat_eth_fifo_reset(fifo);
+}
+
+static void ccat_eth_fifo_inc(struct ccat_eth_fifo *fifo)
+{
+	if (++fifo->mem.next > fifo->end)
+		fifo->mem.next = fifo->mem.start;
+}
+
+static void ccat_eth_fifo_hw_reset(struct ccat_eth_fifo *const fifo)
+{
+	if (fifo->reg) {
+		ccat_iowrite32(0, fifo->reg + 0x8);
+		wmb();
+	}
+}
+
+static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo)
+{
+	ccat_eth_fifo_hw_reset(fifo);
+
+	if (fifo->ops->add) {
+		fifo->mem.next = fifo->mem.start;
+		do {
+			fifo->ops->add(fifo);
+			ccat_eth_fifo_inc(fifo);
+		} while (fifo->mem.next != fifo->mem.start);
+	}
+}
+
+static inline size_t fifo_dma_tx_ready(struct ccat_eth_fifo *const fifo)
+{
+	const struct ccat_dma_frame *frame = fifo->dma.next;
+	return le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT;
+}
+
+static inline size_t fifo_dma_rx_ready(struct ccat_eth_fifo *const fifo)
+{
+	static const size_t OVERHEAD =
+	    offsetof(struct ccat_dma_frame_hdr, rx_flags);
+	const struct ccat_dma_frame *const frame = fifo->dma.next;
+
+	if (le32_to_cpu(frame->hdr.rx_flags) & CCAT_FRAME_RECEIVED) {
+		const size_t len = le16_to_cpu(frame->hdr.length);
+		return (len < OVERHEAD) ? 0 : len - OVERHEAD;
+	}
+	return 0;
+}
+
+static void ccat_eth_rx_fifo_dma_add(struct ccat_eth_fifo *const fifo)
+{
+	struct ccat_dma_frame *const frame = fifo->dma.next;
+	const size_t offset = (void *)frame - fifo->dma.start;
+	const u32 addr_and_length = (1 << 31) | offset;
+
+	frame->hdr.rx_flags = cpu_to_le32(0);
+	ccat_iowrite32(addr_and_length, fifo->reg);
+}
+
+static void ccat_eth_tx_fifo_dma_add_free(struct ccat_eth_fifo *const fifo)
+{
+	/* mark frame as ready to use for tx */
+	fifo->dma.next->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+}
+
+static u64 fifo_dma_rx_timestamp(const struct ccat_eth_frame *const frame)
+{
+	const struct ccat_dma_frame *const dma =
+	    (const struct ccat_dma_frame *)frame;
+
+	return le64_to_cpu(dma->hdr.timestamp);
+}
+
+static u64 fifo_dma_tx_timestamp(const struct ccat_eth_frame *const frame)
+{
+	const struct ccat_dma_frame *const dma =
+	    (const struct ccat_dma_frame *)frame;
+
+	if (!(le32_to_cpu(READ_ONCE(dma->hdr.tx_flags)) & CCAT_FRAME_SENT)) {
+		return 0;
+	}
+	return le64_to_cpu(dma->hdr.timestamp);
+}
+
+static void fifo_dma_copy_to_buf(struct ccat_eth_fifo *const fifo,
+				 void *buf, const size_t len)
+{
+	memcpy(buf, fifo->dma.next->data, len);
+}
+
+static void fifo_dma_queue_frame(struct ccat_eth_fifo *const fifo,
+				 struct ccat_dma_frame *const frame, size_t len)
+{
+	u32 addr_and_length;
+
+	frame->hdr.tx_flags = cpu_to_le32(0);
+	frame->hdr.length = cpu_to_le16(len);
+
+	/* Queue frame into CCAT TX-FIFO, CCAT ignores the first 8 bytes of the tx descriptor */
+	addr_and_length = offsetof(struct ccat_dma_frame_hdr, length);
+	addr_and_length += ((void *)frame - fifo->dma.start);
+	addr_and_length += ((len + sizeof(struct ccat_dma_frame_hdr)) / 8) << 24;
+	ccat_iowrite32(addr_and_length, fifo->reg);
+}
+
+static void fifo_dma_queue_skb(struct ccat_eth_fifo *const fifo,
+			       struct sk_buff *skb)
+{
+	struct ccat_dma_frame *frame = fifo->dma.next;
+
+	memcpy(frame->data, skb->data, skb->len);
+	fifo_dma_queue_frame(fifo, frame, skb->len);
+}
+
+static const struct ccat_eth_fifo_operations dma_rx_fifo_ops = {
+	.add = ccat_eth_rx_fifo_dma_add,
+	.ready = fifo_dma_rx_ready,
+	.timestamp = fifo_dma_rx_timestamp,
+	.queue.copy_to_buf = fifo_dma_copy_to_buf,
+};
+
+static const struct ccat_eth_fifo_operations dma_tx_fifo_ops = {
+	.add = ccat_eth_tx_fifo_dma_add_free,
+	.ready = fifo_dma_tx_ready,
+	.timestamp = fifo_dma_tx_timestamp,
+	.queue.skb = fifo_dma_queue_skb,
+};
+
+#endif /* #ifndef _CCAT_FIFO_H_ */
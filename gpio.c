@@ -44,13 +44,13 @@ static int set_bit_in_register(struct mutex *lock, void __iomem * ioaddr,
 	volatile unsigned long old;
 
 	mutex_lock(lock);
-	old = ioread32(ioaddr);
+	old = ccat_ioread32(ioaddr);
 	val ? set_bit(nr, &old) : clear_bit(nr, &old);
 	if (val)
 		set_bit(nr, &old);
 	else
 		clear_bit(nr, &old);
-	iowrite32(old, ioaddr);
+	ccat_iowrite32(old, ioaddr);
 	mutex_unlock(lock);
 	return 0;
 }
@@ -61,7 +61,7 @@ static int ccat_gpio_get_direction(struct gpio_chip *chip, unsigned nr)
 	const size_t byte_offset = 4 * (nr / 32) + 0x8;
 	const u32 mask = 1 << (nr % 32);
 
-	return !(mask & ioread32(gdev->ioaddr + byte_offset));
+	return !(mask & ccat_ioread32(gdev->ioaddr + byte_offset));
 }
 
 static int ccat_gpio_direction_input(struct gpio_chip *chip, unsigned nr)
@@ -90,7 +90,7 @@ static int ccat_gpio_get(struct gpio_chip *chip, unsigned nr)
 	/** omit direction changes before value was read */
 	mutex_lock(&gdev->lock);
 	dir_off = 0x10 * ccat_gpio_get_direction(chip, nr);
-	value = !(mask & ioread32(gdev->ioaddr + byte_off + dir_off));
+	value = !(mask & ccat_ioread32(gdev->ioaddr + byte_off + dir_off));
 	mutex_unlock(&gdev->lock);
 	return value;
 }
@@ -5,10 +5,12 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
+#include <linux/debugfs.h>
 #include <linux/etherdevice.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/platform_device.h>
+#include <linux/seq_file.h>
 #include <linux/mfd/core.h>
 #include "module.h"
 
@@ -17,6 +19,207 @@ MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
 MODULE_LICENSE("GPL and additional rights");
 MODULE_VERSION(DRV_VERSION);
 
+#ifdef CCAT_MMIO_PROFILE
+#define CCAT_MMIO_SITES_MAX 256
+#define CCAT_MMIO_SAMPLE_RATE 16
+#define CCAT_MMIO_HIST_BUCKETS 16
+
+/**
+ * struct ccat_mmio_site - MMIO accounting of one call site
+ * @module: name of the module the call site belongs to
+ * @func: function containing the call site
+ * @line: source line of the call site
+ * @op: accessor used at the call site
+ * @count: number of accesses
+ * @bytes: number of bytes transferred
+ * @sampled: number of timed accesses, every CCAT_MMIO_SAMPLE_RATE th
+ * @sum_ns: accumulated latency of the timed accesses
+ * @max_ns: maximum latency of the timed accesses
+ * @hist: log2 histogram of the latency in ns, bucket n: [2^(n-1), 2^n)
+ *
+ * The names are copied, so the sites of an unloaded module stay valid and
+ * are reused when it is loaded again. The timing fields are updated
+ * without locking, concurrent accesses of one site may lose samples.
+ */
+struct ccat_mmio_site {
+	char module[MODULE_NAME_LEN];
+	char func[48];
+	unsigned int line;
+	char op[24];
+	atomic64_t count;
+	atomic64_t bytes;
+	u64 sampled;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 hist[CCAT_MMIO_HIST_BUCKETS];
+};
+
+static DEFINE_SPINLOCK(ccat_mmio_lock);
+static struct ccat_mmio_site ccat_mmio_sites[CCAT_MMIO_SITES_MAX];
+static unsigned int ccat_mmio_num_sites;
+static struct dentry *ccat_mmio_debugfs;
+
+/**
+ * ccat_mmio_site_get() - look up or add the accounting of a call site
+ *
+ * Once the table is full all further call sites share its last entry.
+ */
+struct ccat_mmio_site *ccat_mmio_site_get(const char *module,
+					  const char *func, unsigned int line,
+					  const char *op)
+{
+	struct ccat_mmio_site *site;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&ccat_mmio_lock, flags);
+	for (i = 0; i < ccat_mmio_num_sites; ++i) {
+		site = &ccat_mmio_sites[i];
+		if (site->line == line && !strcmp(site->module, module)
+		    && !strcmp(site->func, func) && !strcmp(site->op, op)) {
+			goto unlock;
+		}
+	}
+
+	if (ccat_mmio_num_sites < CCAT_MMIO_SITES_MAX - 1) {
+		site = &ccat_mmio_sites[ccat_mmio_num_sites++];
+		strscpy(site->module, module, sizeof(site->module));
+		strscpy(site->func, func, sizeof(site->func));
+		strscpy(site->op, op, sizeof(site->op));
+		site->line = line;
+	} else {
+		site = &ccat_mmio_sites[CCAT_MMIO_SITES_MAX - 1];
+		strscpy(site->module, "(other)", sizeof(site->module));
+	}
+unlock:
+	spin_unlock_irqrestore(&ccat_mmio_lock, flags);
+	return site;
+}
+
+EXPORT_SYMBOL(ccat_mmio_site_get);
+
+/**
+ * ccat_mmio_begin() - count an access
+ *
+ * Return: start time, if this access is timed, 0 otherwise
+ */
+u64 ccat_mmio_begin(struct ccat_mmio_site *site)
+{
+	const u64 count = atomic64_inc_return(&site->count);
+
+	return (count & (CCAT_MMIO_SAMPLE_RATE - 1)) ? 0 : ktime_get_ns();
+}
+
+EXPORT_SYMBOL(ccat_mmio_begin);
+
+void ccat_mmio_end(struct ccat_mmio_site *site, u64 start, size_t bytes)
+{
+	u64 ns;
+
+	atomic64_add(bytes, &site->bytes);
+	if (!start) {
+		return;
+	}
+	ns = ktime_get_ns() - start;
+	site->sampled++;
+	site->sum_ns += ns;
+	site->max_ns = max(site->max_ns, ns);
+	site->hist[min(fls64(ns), CCAT_MMIO_HIST_BUCKETS - 1)]++;
+}
+
+EXPORT_SYMBOL(ccat_mmio_end);
+
+static int ccat_mmio_show(struct seq_file *s, void *unused)
+{
+	unsigned long flags;
+	unsigned int i, b;
+
+	seq_printf(s, "%-16s %-32s %-16s %12s %12s %8s %8s  %s\n",
+		   "module", "function:line", "op", "count", "bytes", "avg_ns",
+		   "max_ns", "log2 latency histogram");
+	spin_lock_irqsave(&ccat_mmio_lock, flags);
+	for (i = 0; i < CCAT_MMIO_SITES_MAX; ++i) {
+		const struct ccat_mmio_site *const site = &ccat_mmio_sites[i];
+		char where[64];
+
+		if (!atomic64_read(&site->count)) {
+			continue;
+		}
+		snprintf(where, sizeof(where), "%s:%u", site->func, site->line);
+		seq_printf(s, "%-16s %-32s %-16s %12lld %12lld %8llu %8llu ",
+			   site->module, where, site->op,
+			   (long long)atomic64_read(&site->count),
+			   (long long)atomic64_read(&site->bytes),
+			   site->sampled ? div64_u64(site->sum_ns,
+						     site->sampled) : 0,
+			   site->max_ns);
+		for (b = 0; b < CCAT_MMIO_HIST_BUCKETS; ++b) {
+			seq_printf(s, " %llu", site->hist[b]);
+		}
+		seq_putc(s, '\n');
+	}
+	spin_unlock_irqrestore(&ccat_mmio_lock, flags);
+	return 0;
+}
+
+static int ccat_mmio_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_mmio_show, inode->i_private);
+}
+
+/**
+ * ccat_mmio_write() - any write resets the counters of all call sites
+ */
+static ssize_t ccat_mmio_write(struct file *file, const char __user * buf,
+			       size_t count, loff_t * ppos)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&ccat_mmio_lock, flags);
+	for (i = 0; i < CCAT_MMIO_SITES_MAX; ++i) {
+		struct ccat_mmio_site *const site = &ccat_mmio_sites[i];
+
+		atomic64_set(&site->count, 0);
+		atomic64_set(&site->bytes, 0);
+		site->sampled = 0;
+		site->sum_ns = 0;
+		site->max_ns = 0;
+		memset(site->hist, 0, sizeof(site->hist));
+	}
+	spin_unlock_irqrestore(&ccat_mmio_lock, flags);
+	return count;
+}
+
+static const struct file_operations ccat_mmio_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_mmio_open,
+	.read = seq_read,
+	.write = ccat_mmio_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ccat_mmio_debugfs_init(void)
+{
+	ccat_mmio_debugfs = debugfs_create_file("ccat_mmio", 0644, NULL, NULL,
+						&ccat_mmio_fops);
+}
+
+static void ccat_mmio_debugfs_exit(void)
+{
+	debugfs_remove(ccat_mmio_debugfs);
+}
+#else
+static inline void ccat_mmio_debugfs_init(void)
+{
+}
+
+static inline void ccat_mmio_debugfs_exit(void)
+{
+}
+#endif /* #ifdef CCAT_MMIO_PROFILE */
+
 static struct ccat_cell ccat_cells[] = {
 	{
 	 .type = CCATINFO_ETHERCAT_NODMA,
@@ -151,25 +354,56 @@ int ccat_cdev_open(struct inode *const i, struct file *const f)
 
 EXPORT_SYMBOL(ccat_cdev_open);
 
-int ccat_cdev_probe(struct ccat_function *func, struct ccat_class *cdev_class,
-		    size_t iosize)
+/**
+ * ccat_cdev_create() - register a character device for a CCAT function
+ * @func: the CCAT function accessed through the device
+ * @cdev_class: device class with the file operations of the function
+ * @iosize: number of bytes accessible through the device
+ *
+ * Return: the new device, or NULL on failure
+ */
+struct ccat_cdev *ccat_cdev_create(struct ccat_function *func,
+				   struct ccat_class *cdev_class, size_t iosize)
 {
 	struct ccat_cdev *const ccdev = alloc_ccat_cdev(cdev_class);
 	if (!ccdev) {
-		return -ENOMEM;
+		return NULL;
 	}
 
 	ccdev->ioaddr = func->ccat->bar_0 + func->info.addr;
 	ccdev->iosize = iosize;
+	ccdev->private_data = NULL;
+	ccdev->class = cdev_class;
 	atomic_set(&ccdev->in_use, 1);
 
 	if (ccat_cdev_init
 	    (&ccdev->cdev, ccdev->dev, cdev_class->class, &cdev_class->fops)) {
-		pr_warn("ccat_cdev_probe() failed\n");
+		pr_warn("ccat_cdev_create() failed\n");
 		free_ccat_cdev(ccdev);
-		return -1;
+		return NULL;
+	}
+	return ccdev;
+}
+
+EXPORT_SYMBOL(ccat_cdev_create);
+
+void ccat_cdev_destroy(struct ccat_cdev *ccdev)
+{
+	cdev_del(&ccdev->cdev);
+	device_destroy(ccdev->class->class, ccdev->dev);
+	free_ccat_cdev(ccdev);
+}
+
+EXPORT_SYMBOL(ccat_cdev_destroy);
+
+int ccat_cdev_probe(struct ccat_function *func, struct ccat_class *cdev_class,
+		    size_t iosize)
+{
+	struct ccat_cdev *const ccdev =
+	    ccat_cdev_create(func, cdev_class, iosize);
+	if (!ccdev) {
+		return -ENOMEM;
 	}
-	ccdev->class = cdev_class;
 	func->private_data = ccdev;
 	return 0;
 }
@@ -191,11 +425,8 @@ EXPORT_SYMBOL(ccat_cdev_release);
 int ccat_cdev_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
-	struct ccat_cdev *const ccdev = func->private_data;
 
-	cdev_del(&ccdev->cdev);
-	device_destroy(ccdev->class->class, ccdev->dev);
-	free_ccat_cdev(ccdev);
+	ccat_cdev_destroy(func->private_data);
 	return 0;
 }
 
@@ -228,14 +459,20 @@ static int ccat_functions_init(struct ccat_device *const ccatdev)
 	static const size_t block_size = sizeof(struct ccat_info_block);
 	struct ccat_function *next = kzalloc(sizeof(*next), GFP_KERNEL);
 	void __iomem *addr = ccatdev->bar_0; /** first block is the CCAT information block entry */
-	const u8 num_func = ioread8(addr + 4); /** number of CCAT function blocks is at offset 0x4 */
+	const u8 num_func = ccat_ioread8(addr + 4); /** number of CCAT function blocks is at offset 0x4 */
 	const void __iomem *end = addr + (block_size * num_func);
 	int ret = 0;
 
 	for (; addr < end && next; addr += block_size) {
-		memcpy_fromio(&next->info, addr, sizeof(next->info));
+		ccat_memcpy_fromio(&next->info, addr, sizeof(next->info));
 		if (CCATINFO_NOTUSED != next->info.type) {
 			next->ccat = ccatdev;
+			/* other functions timestamp with the systemtime, too */
+			if (CCATINFO_SYSTEMTIME == next->info.type
+			    && !ccatdev->systemtime) {
+				ccatdev->systemtime =
+				    ccatdev->bar_0 + next->info.addr;
+			}
 			ret = ccat_function_connect(next, ccatdev);
 			if (ret < 0) {
 				return ret;
@@ -300,6 +537,7 @@ static int ccat_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		status = -EIO;
 		goto release_regions;
 	}
+	ccatdev->bar_0_phys = pci_resource_start(pdev, 0);
 
 	ccatdev->bar_2 = pci_iomap(pdev, 2, 0);
 	if (!ccatdev->bar_2) {
@@ -333,9 +571,6 @@ static void ccat_pci_remove(struct pci_dev *pdev)
 	}
 }
 
-#define PCI_DEVICE_ID_BECKHOFF_CCAT 0x5000
-#define PCI_VENDOR_ID_BECKHOFF 0x15EC
-
 static const struct pci_device_id pci_ids[] = {
 	{PCI_DEVICE(PCI_VENDOR_ID_BECKHOFF, PCI_DEVICE_ID_BECKHOFF_CCAT)},
 	{0,},
@@ -350,7 +585,17 @@ static struct pci_driver ccat_pci_driver = {
 	.remove = ccat_pci_remove,
 };
 
-module_pci_driver(ccat_pci_driver);
+static int __init ccat_init(void)
+{
+	ccat_mmio_debugfs_init();
+	return pci_register_driver(&ccat_pci_driver);
+}
+
+static void __exit ccat_exit(void)
+{
+	pci_unregister_driver(&ccat_pci_driver);
+	ccat_mmio_debugfs_exit();
+}
 
 #else /* #ifdef CONFIG_PCI */
 static const size_t CCAT_EIM_ADDR = 0xf0000000;
@@ -379,6 +624,7 @@ static int ccat_eim_probe(struct platform_device *pdev)
 		return -EIO;
 	}
 
+	ccatdev->bar_0_phys = CCAT_EIM_ADDR;
 	ccatdev->bar_2 = NULL;
 
 	if (ccat_functions_init(ccatdev)) {
@@ -415,5 +661,18 @@ static struct platform_driver ccat_eim_driver = {
 	.remove = ccat_eim_remove,
 };
 
-module_platform_driver(ccat_eim_driver);
+static int __init ccat_init(void)
+{
+	ccat_mmio_debugfs_init();
+	return platform_driver_register(&ccat_eim_driver);
+}
+
+static void __exit ccat_exit(void)
+{
+	platform_driver_unregister(&ccat_eim_driver);
+	ccat_mmio_debugfs_exit();
+}
 #endif /* #ifdef CONFIG_PCI */
+
+module_init(ccat_init);
+module_exit(ccat_exit);
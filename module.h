@@ -24,6 +24,7 @@
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/hrtimer.h>
+#include <linux/io.h>
 #include <linux/kernel.h>
 #include <linux/pci.h>
 #include <linux/mfd/core.h>
@@ -32,9 +33,76 @@
 #define DRV_VERSION      "0.16" DRV_EXTRAVERSION
 #define DRV_DESCRIPTION  "Beckhoff CCAT Ethernet/EtherCAT Network Driver"
 
+#define PCI_DEVICE_ID_BECKHOFF_CCAT 0x5000
+#define PCI_VENDOR_ID_BECKHOFF 0x15EC
+
 #undef pr_fmt
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+/**
+ * MMIO accessors of all CCAT functions. Built with CCAT_MMIO_PROFILE=y
+ * each call site counts its accesses and times every 16th of them, the
+ * results are shown in /sys/kernel/debug/ccat_mmio. Otherwise these are
+ * the plain kernel accessors.
+ */
+#ifdef CCAT_MMIO_PROFILE
+struct ccat_mmio_site;
+
+extern struct ccat_mmio_site *ccat_mmio_site_get(const char *module,
+						 const char *func,
+						 unsigned int line,
+						 const char *op);
+extern u64 ccat_mmio_begin(struct ccat_mmio_site *site);
+extern void ccat_mmio_end(struct ccat_mmio_site *site, u64 start,
+			  size_t bytes);
+
+#define CCAT_MMIO(op, bytes, access)					\
+({									\
+	static struct ccat_mmio_site *__ccat_site;			\
+	struct ccat_mmio_site *__site = READ_ONCE(__ccat_site);		\
+	u64 __start;							\
+									\
+	if (unlikely(!__site)) {					\
+		__site = ccat_mmio_site_get(KBUILD_MODNAME, __func__,	\
+					    __LINE__, op);		\
+		WRITE_ONCE(__ccat_site, __site);			\
+	}								\
+	__start = ccat_mmio_begin(__site);				\
+	access;								\
+	ccat_mmio_end(__site, __start, bytes);				\
+})
+
+#define CCAT_MMIO_READ(type, op, addr)					\
+({									\
+	type __val;							\
+	CCAT_MMIO(#op, sizeof(type), __val = op(addr));			\
+	__val;								\
+})
+
+#define ccat_ioread8(addr) CCAT_MMIO_READ(u8, ioread8, addr)
+#define ccat_ioread16(addr) CCAT_MMIO_READ(u16, ioread16, addr)
+#define ccat_ioread32(addr) CCAT_MMIO_READ(u32, ioread32, addr)
+#define ccat_readq(addr) CCAT_MMIO_READ(u64, readq, addr)
+#define ccat_iowrite8(val, addr) CCAT_MMIO("iowrite8", 1, iowrite8(val, addr))
+#define ccat_iowrite16(val, addr) CCAT_MMIO("iowrite16", 2, iowrite16(val, addr))
+#define ccat_iowrite32(val, addr) CCAT_MMIO("iowrite32", 4, iowrite32(val, addr))
+#define ccat_memcpy_fromio(dst, src, len) \
+	CCAT_MMIO("memcpy_fromio", len, memcpy_fromio(dst, src, len))
+#define ccat_memcpy_toio(dst, src, len) \
+	CCAT_MMIO("memcpy_toio", len, memcpy_toio(dst, src, len))
+#else
+#define CCAT_MMIO(op, bytes, access) access
+#define ccat_ioread8(addr) ioread8(addr)
+#define ccat_ioread16(addr) ioread16(addr)
+#define ccat_ioread32(addr) ioread32(addr)
+#define ccat_readq(addr) readq(addr)
+#define ccat_iowrite8(val, addr) iowrite8(val, addr)
+#define ccat_iowrite16(val, addr) iowrite16(val, addr)
+#define ccat_iowrite32(val, addr) iowrite32(val, addr)
+#define ccat_memcpy_fromio(dst, src, len) memcpy_fromio(dst, src, len)
+#define ccat_memcpy_toio(dst, src, len) memcpy_toio(dst, src, len)
+#endif /* #ifdef CCAT_MMIO_PROFILE */
+
 /**
  * CCAT function type identifiers (u16)
  */
@@ -58,6 +126,16 @@ struct ccat_cell {
 	struct mfd_cell cell;
 };
 
+/**
+ * struct ccat_cdev - character device of a CCAT function
+ * @in_use: 1 if the device is available, used to allow only one opener
+ * @ioaddr: CPU-viewed address of the CCAT function
+ * @iosize: number of bytes accessible through the device
+ * @dev: device number
+ * @cdev: the character device registered with the kernel
+ * @class: device class this character device belongs to
+ * @private_data: owned by the function driver
+ */
 struct ccat_cdev {
 	atomic_t in_use;
 	void __iomem *ioaddr;
@@ -65,6 +143,7 @@ struct ccat_cdev {
 	dev_t dev;
 	struct cdev cdev;
 	struct ccat_class *class;
+	void *private_data;
 };
 
 /**
@@ -89,6 +168,8 @@ extern loff_t ccat_cdev_llseek(struct file *f, loff_t offset, int whence);
  * @dev: pointer to the device object allocated by the kernel
  * @bar_0: holding information about PCI BAR 0
  * @bar_2: holding information about PCI BAR 2 (optional)
+ * @bar_0_phys: bus address of BAR 0, required to map registers to user space
+ * @systemtime: address of the systemtime register, NULL if not available
  *
  * One instance of a ccat_device should represent a physical CCAT. Since
  * a CCAT is implemented as FPGA the available functions can vary.
@@ -98,6 +179,8 @@ struct ccat_device {
 	void *dev;
 	void __iomem *bar_0;
 	void __iomem *bar_2;
+	phys_addr_t bar_0_phys;
+	void __iomem *systemtime;
 };
 
 struct ccat_info_block {
@@ -124,6 +207,28 @@ struct ccat_info_block {
 	u32 size;
 };
 
+/**
+ * ccat_systemtime_read64() - tear-free read of the 64 bit systemtime
+ * @ioaddr: address of the systemtime register
+ *
+ * 64 bit CPUs use a single access. 32 bit CPUs read the high word before
+ * and after the low word and retry if the low word wrapped in between.
+ */
+static inline u64 ccat_systemtime_read64(void __iomem * const ioaddr)
+{
+#ifdef CONFIG_64BIT
+	return ccat_readq(ioaddr);
+#else
+	u32 hi, lo;
+
+	do {
+		hi = ccat_ioread32(ioaddr + 4);
+		lo = ccat_ioread32(ioaddr);
+	} while (hi != ccat_ioread32(ioaddr + 4));
+	return ((u64) hi << 32) | lo;
+#endif
+}
+
 struct ccat_function {
 	struct ccat_device *ccat;
 	struct ccat_info_block info;
@@ -140,6 +245,10 @@ struct ccat_class {
 	struct file_operations fops;
 };
 
+extern struct ccat_cdev *ccat_cdev_create(struct ccat_function *func,
+					  struct ccat_class *cdev_class,
+					  size_t iosize);
+extern void ccat_cdev_destroy(struct ccat_cdev *ccdev);
 extern int ccat_cdev_remove(struct platform_device *pdev);
 extern int ccat_cdev_probe(struct ccat_function *func,
 			   struct ccat_class *cdev_class, size_t iosize);
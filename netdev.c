@@ -5,11 +5,26 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/etherdevice.h>
+#include <linux/ethtool.h>
+#include <linux/fs.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/netdevice.h>
+#include <linux/perf_event.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <net/sock.h>
+#include <asm/unaligned.h>
 
 #ifdef CONFIG_PCI
 #include <asm/dma.h>
@@ -18,6 +33,8 @@
 #define request_dma(X, Y) ((int)(-EINVAL))
 #endif
 
+#include "ccat_netdev.h"
+#include "fifo.h"
 #include "module.h"
 
 MODULE_DESCRIPTION(DRV_DESCRIPTION);
@@ -25,6 +42,22 @@ MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
 MODULE_LICENSE("GPL and additional rights");
 MODULE_VERSION(DRV_VERSION);
 
+#define FIFO_LENGTH 64
+
+static unsigned int tx_templates = 2;
+module_param(tx_templates, uint, 0444);
+MODULE_PARM_DESC(tx_templates,
+		 "Number of DMA TX slots reserved as templates (rounded up to a page)");
+
+static int poll_cpu = -1;
+module_param(poll_cpu, int, 0444);
+MODULE_PARM_DESC(poll_cpu,
+		 "Poll all CCAT Ethernet ports from one timer on this CPU (-1: one timer per port)");
+
+static unsigned int poll_budget = FIFO_LENGTH / 2;
+module_param(poll_budget, uint, 0644);
+MODULE_PARM_DESC(poll_budget, "Maximum number of RX frames per port and poll");
+
 /**
  * EtherCAT frame to enable forwarding on EtherCAT Terminals
  */
@@ -42,48 +75,43 @@ static const u8 frameForwardEthernetFrames[] = {
 	0x00, 0x00
 };
 
-#define FIFO_LENGTH 64
 #define POLL_TIME ktime_set(0, 50 * NSEC_PER_USEC)
+#define POLL_DENSE_NS (5 * NSEC_PER_USEC)
+#define POLL_SPARSE_NS (250 * NSEC_PER_USEC)
+#define CYCLE_MIN_NS (20 * NSEC_PER_USEC)
+#define CYCLE_MAX_NS (100 * NSEC_PER_MSEC)
+#define CYCLE_LOCK_COUNT 8
+#define CCAT_ETH_DEVICES_MAX 4
+#define TXTIME_QUEUE_LEN 16
+#define STEER_RING_LEN 64
+#define STEER_SLOT_SIZE 1536
+#define GATE_QUEUE_LEN 32
+#define WIRE_NS_PER_BYTE 80
+#define WIRE_OVERHEAD (ETH_FCS_LEN + 8 + 12)
+#define TXTIME_RETRY_NS NSEC_PER_USEC
+#define RED_SLOTS 16
+#define RED_TIMEOUT_NS (500 * NSEC_PER_USEC)
+#define ECAT_HDR_LEN 2
+#define ECAT_DGRAM_HDR_LEN 10
+#define ECAT_WKC_LEN 2
+#define ECAT_IDX_OFFSET (ETH_HLEN + ECAT_HDR_LEN + 1)
+#define ECAT_MIN_LEN (ETH_HLEN + ECAT_HDR_LEN + ECAT_DGRAM_HDR_LEN + ECAT_WKC_LEN)
+#define CAPTURE_SIZE_MIN (64 * 1024)
+#define CAPTURE_SIZE_MAX (64 * 1024 * 1024)
+#define CAPTURE_PREAMBLE_OFFSET 64
+#define CAPTURE_TSOFFSET 946684800LL	/* 2000-01-01 in seconds since 1970 */
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+#define POLL_HIST_BUCKETS 32
+#define SELFTEST_FRAMES 1000
+#define SELFTEST_WINDOW 16
+#define SELFTEST_TIMEOUT_MS 100
+#define SELFTEST_IDX 0xcc
+#define SELFTEST_DATA_OFFSET (ETH_HLEN + ECAT_HDR_LEN + ECAT_DGRAM_HDR_LEN)
+#define SELFTEST_DATA_LEN (ETH_FRAME_LEN - SELFTEST_DATA_OFFSET - ECAT_WKC_LEN)
 #define CCAT_ALIGNMENT ((size_t)(128 * 1024))
 #define CCAT_ALIGN_CHANNEL(x, c) ((typeof(x))(ALIGN((size_t)((x) + ((c) * CCAT_ALIGNMENT)), CCAT_ALIGNMENT)))
 
-struct ccat_dma_frame_hdr {
-	__le32 reserved1;
-	__le32 rx_flags;
-#define CCAT_FRAME_RECEIVED 0x1
-	__le16 length;
-	__le16 reserved3;
-	__le32 tx_flags;
-#define CCAT_FRAME_SENT 0x1
-	__le64 timestamp;
-};
-
-struct ccat_eim_frame_hdr {
-	__le16 length;
-	__le16 reserved3;
-	__le32 tx_flags;
-	__le64 timestamp;
-};
-
-struct ccat_eth_frame {
-	u8 placeholder[0x800];
-};
-
-struct ccat_dma_frame {
-	struct ccat_dma_frame_hdr hdr;
-	u8 data[sizeof(struct ccat_eth_frame) -
-		sizeof(struct ccat_dma_frame_hdr)];
-};
-
-struct ccat_eim_frame {
-	struct ccat_eim_frame_hdr hdr;
-	u8 data[sizeof(struct ccat_eth_frame) -
-		sizeof(struct ccat_eim_frame_hdr)];
-};
-
-#define MAX_PAYLOAD_SIZE \
-	(sizeof(struct ccat_eth_frame) - max(sizeof(struct ccat_dma_frame_hdr), sizeof(struct ccat_eim_frame_hdr)))
-
 /**
  * struct ccat_eth_register - CCAT register addresses in the PCI BAR
  * @mii: address of the CCAT management interface register
@@ -117,74 +145,321 @@ struct ccat_dma_mem {
 };
 
 /**
- * struct ccat_dma/eim/mem
- * @next: pointer to the next frame in fifo ring buffer
- * @start: aligned CPU-viewed address(virtual) of the associated memory
+ * same as: typedef struct _CCatInfoBlockOffs from CCatDefinitions.h
+ */
+struct ccat_mac_infoblock {
+	u32 reserved;
+	u32 mii;
+	u32 tx_fifo;
+	u32 mac;
+	u32 rx_mem;
+	u32 tx_mem;
+	u32 misc;
+};
+
+/**
+ * struct ccat_eth_cycle - EtherCAT cycle as seen by the poll timer
+ * @cycle_ns: configured cycle period, 0 to learn it from TX
+ * @rtt_ns: configured frame round trip time, 0 to learn it from RX
+ * @dense_ns: poll interval around the expected return of the frames
+ * @sparse_ns: poll interval for the rest of the cycle
+ * @learned_cycle_ns: cycle period learned from 0x88a4 TX timing
+ * @learned_rtt_ns: round trip time learned from DMA or host timestamps
+ * @locked: number of consecutive TX cycles matching @learned_cycle_ns
+ * @last_tx: host time of the first 0x88a4 frame of the current cycle
+ * @tx_frame: TX slot of that frame, used to read its DMA timestamp
+ * @returned: the first 0x88a4 frame of the current cycle was received
  */
-struct ccat_dma {
-	struct ccat_dma_frame *next;
-	void *start;
+struct ccat_eth_cycle {
+	u32 cycle_ns;
+	u32 rtt_ns;
+	u32 dense_ns;
+	u32 sparse_ns;
+	u32 learned_cycle_ns;
+	u32 learned_rtt_ns;
+	unsigned int locked;
+	ktime_t last_tx;
+	const struct ccat_eth_frame *tx_frame;
+	bool returned;
 };
 
-struct ccat_eim {
-	struct ccat_eim_frame __iomem *next;
-	void __iomem *start;
+/**
+ * struct ccat_eth_templates - TX slots reserved at the end of the TX ring
+ * @slots: CPU-viewed address of the first template slot
+ * @phys: device-viewed address of the first template slot
+ * @count: number of template slots
+ */
+struct ccat_eth_templates {
+	struct ccat_dma_frame *slots;
+	dma_addr_t phys;
+	unsigned int count;
 };
 
-struct ccat_mem {
-	struct ccat_eth_frame *next;
-	void *start;
+/**
+ * struct ccat_eth_poll_stats - time spent polling a port
+ * @polls: number of polls
+ * @time_ns: accumulated duration of all polls
+ * @max_ns: longest poll
+ * @budget_exhausted: number of polls which hit poll_budget
+ * @rx_polls: number of polls which received at least one frame
+ * @rx_frames: number of frames received by all polls
+ * @rx_frames_max: most frames received by a single poll
+ */
+struct ccat_eth_poll_stats {
+	u64 polls;
+	u64 time_ns;
+	u64 max_ns;
+	u64 budget_exhausted;
+	u64 rx_polls;
+	u64 rx_frames;
+	u64 rx_frames_max;
 };
 
 /**
- * struct ccat_eth_fifo - CCAT RX or TX fifo
- * @ops: function pointer table for dma/eim and rx/tx specific fifo functions
- * @reg: PCI register address of this fifo
- * @rx_bytes: number of bytes processed -> reported with ndo_get_stats64()
- * @rx_dropped: number of dropped frames -> reported with ndo_get_stats64()
- * @mem/dma/eim: information about the associated memory
+ * struct ccat_eth_poll_hist - log2 histograms of the poll loop
+ * @lateness_ns: delay between the due time and the start of a poll
+ * @duration_ns: time spent in a poll
+ * @frames: frames received per poll
+ *
+ * Bucket 0 counts zero values, bucket n values in [2^(n-1), 2^n).
  */
-struct ccat_eth_fifo {
-	const struct ccat_eth_fifo_operations *ops;
-	const struct ccat_eth_frame *end;
-	void __iomem *reg;
-	atomic64_t bytes;
-	atomic64_t dropped;
-	union {
-		struct ccat_mem mem;
-		struct ccat_dma dma;
-		struct ccat_eim eim;
-	};
+struct ccat_eth_poll_hist {
+	u64 lateness_ns[POLL_HIST_BUCKETS];
+	u64 duration_ns[POLL_HIST_BUCKETS];
+	u64 frames[POLL_HIST_BUCKETS];
 };
 
 /**
- * struct ccat_eth_fifo_operations
- * @ready: callback used to test the next frames ready bit
- * @add: callback used to add a frame to this fifo
- * @copy_to_skb: callback used to copy from rx fifos to skbs
- * @skb: callback used to queue skbs into tx fifos
+ * struct ccat_eth_xstats - driver counters only reported by ethtool -S
+ * @rx_alloc_failed: received frames dropped, because no skb was available
+ * @tx_ring_full: number of times the TX ring filled up and stopped the queue
+ * @tx_nonlinear: frames dropped, because they were not linear
+ * @mmio_reads: MMIO reads of the poll loop outside of the fifo functions
  */
-struct ccat_eth_fifo_operations {
-	size_t(*ready) (struct ccat_eth_fifo *);
-	void (*add) (struct ccat_eth_fifo *);
-	union {
-		void (*copy_to_skb) (struct ccat_eth_fifo *, struct sk_buff *,
-				     size_t);
-		void (*skb) (struct ccat_eth_fifo *, struct sk_buff *);
-	} queue;
+struct ccat_eth_xstats {
+	u64 rx_alloc_failed;
+	u64 tx_ring_full;
+	u64 tx_nonlinear;
+	u64 mmio_reads;
 };
 
 /**
- * same as: typedef struct _CCatInfoBlockOffs from CCatDefinitions.h
+ * struct ccat_eth_red_slot - cyclic frame awaiting its copies from both ports
+ * @held: the copy which returned first
+ * @sent: host time the frame was sent
+ * @len: length of the frame including the Ethernet header
+ * @pending: the frame was sent and not yet delivered to the master
+ * @single: no copy was sent on the secondary port, so the first copy
+ *          returning is delivered at once
+ * @orig: the frame as it was sent
  */
-struct ccat_mac_infoblock {
-	u32 reserved;
-	u32 mii;
-	u32 tx_fifo;
-	u32 mac;
-	u32 rx_mem;
-	u32 tx_mem;
-	u32 misc;
+struct ccat_eth_red_slot {
+	struct sk_buff *held;
+	ktime_t sent;
+	u16 len;
+	bool pending;
+	bool single;
+	u8 orig[ETH_FRAME_LEN];
+};
+
+/**
+ * struct ccat_eth_redundancy - two ports used for EtherCAT cable redundancy
+ * @primary: port the master sends on and receives the merged frames from
+ * @secondary: port receiving a copy of each frame sent on @primary
+ * @slots: frames in flight, indexed by the index of their first datagram
+ * @merged: number of frames merged from both copies
+ * @single: number of frames delivered after only one copy returned
+ * @tx_busy: number of frames not duplicated, because @secondary was busy
+ */
+struct ccat_eth_redundancy {
+	struct ccat_eth_priv *primary;
+	struct ccat_eth_priv *secondary;
+	struct ccat_eth_red_slot slots[RED_SLOTS];
+	u64 merged;
+	u64 single;
+	u64 tx_busy;
+};
+
+/**
+ * struct ccat_eth_txtime - launch time staging queue
+ * @lock: protects @queue
+ * @queue: frames waiting for their launch time, sorted by skb->tstamp
+ * @timer: expires at the launch time of the head of @queue
+ * @enabled: skb->tstamp is a CCAT systemtime launch time
+ * @lead_ns: frames are released this early to compensate the TX latency
+ * @released: number of frames released by launch time
+ * @late: number of frames released after their launch time
+ * @late_max_ns: maximum lateness
+ * @late_sum_ns: accumulated lateness
+ * @overflow: number of frames dropped, because @queue was full
+ */
+struct ccat_eth_txtime {
+	spinlock_t lock;
+	struct sk_buff_head queue;
+	struct hrtimer timer;
+	bool enabled;
+	u32 lead_ns;
+	u64 released;
+	u64 late;
+	u64 late_max_ns;
+	u64 late_sum_ns;
+	u64 overflow;
+};
+
+/**
+ * struct ccat_eth_gate - time-aware gate for best-effort TX traffic
+ * @guard_ns: gate closes this long before the cyclic frame is sent
+ * @hold_ns: gate opens this long after the cyclic frame was sent
+ * @anchor: CCAT systemtime the last cyclic frame was queued at
+ * @held: number of frames held back by the gate
+ * @dropped: number of frames dropped, because the hold queue was full
+ */
+struct ccat_eth_gate {
+	u32 guard_ns;
+	u32 hold_ns;
+	u64 anchor;
+	u64 held;
+	u64 dropped;
+};
+
+/**
+ * struct ccat_eth_steer - hands non-EtherCAT frames over to another CPU
+ * @cpu: CPU processing the steered frames, -1 to process all frames inline
+ * @ring: copies of the steered frames, STEER_RING_LEN slots
+ * @len: frame length of each slot
+ * @head: next slot written by the poll loop
+ * @tail: next slot read by @work
+ * @work: allocates the skbs and passes them to the stack on @cpu
+ * @steered: number of frames processed on @cpu
+ * @dropped: number of frames dropped, because @ring was full
+ */
+struct ccat_eth_steer {
+	int cpu;
+	u8 *ring;
+	u16 len[STEER_RING_LEN];
+	unsigned int head;
+	unsigned int tail;
+	struct work_struct work;
+	u64 steered;
+	u64 dropped;
+};
+
+/**
+ * struct ccat_eth_capture - ring of captured frames in pcapng block format
+ * @lock: serializes the RX and TX producers against start/stop
+ * @mutex: serializes start, stop and mmap() of the ring
+ * @ctrl: control block at the start of the vmalloc_user() area, NULL while
+ *        no capture is running
+ * @data: first byte of the block ring
+ * @size: size of the block ring, a power of two
+ * @snaplen: frames are truncated to this length
+ * @ethertypes: EtherType filter in network byte order, all zero: no filter
+ * @tx_clean: next DMA TX slot to capture once CCAT marked it as sent
+ */
+struct ccat_eth_capture {
+	spinlock_t lock;
+	struct mutex mutex;
+	struct ccat_eth_capture_ctrl *ctrl;
+	u8 *data;
+	u32 size;
+	u32 snaplen;
+	__be16 ethertypes[4];
+	const struct ccat_eth_frame *tx_clean;
+};
+
+/**
+ * struct ccat_eth_selftest_frame - self test frame in flight
+ * @seq: sequence number of the frame
+ * @pending: sent, but neither returned nor given up yet
+ * @slot: TX slot of the frame, to read its DMA timestamp
+ * @tx_ts: CCAT systemtime the frame was queued at, used without DMA
+ * @sent: host time the frame was queued at
+ */
+struct ccat_eth_selftest_frame {
+	u32 seq;
+	int pending;
+	const struct ccat_eth_frame *slot;
+	u64 tx_ts;
+	ktime_t sent;
+};
+
+/**
+ * struct ccat_eth_selftest - loopback test run by "ethtool -t <dev> offline"
+ * @wait: woken up each time a test frame returned
+ * @frames: frames in flight, indexed by seq % SELFTEST_WINDOW
+ * @received: number of frames returned with an intact payload
+ * @corrupt: number of frames returned with a modified payload
+ * @rtt_min_ns: minimum round trip time
+ * @rtt_max_ns: maximum round trip time
+ * @rtt_sum_ns: accumulated round trip time of all intact frames
+ * @last_rx: host time the last test frame returned
+ * @rx_buf: copy of the received frame
+ */
+struct ccat_eth_selftest {
+	wait_queue_head_t wait;
+	struct ccat_eth_selftest_frame frames[SELFTEST_WINDOW];
+	u64 received;
+	u64 corrupt;
+	u64 rtt_min_ns;
+	u64 rtt_max_ns;
+	u64 rtt_sum_ns;
+	ktime_t last_rx;
+	u8 rx_buf[ETH_FRAME_LEN];
+};
+
+/**
+ * struct ccat_pcapng_preamble - pcapng Section Header and Interface
+ * Description Block, written once in front of the captured blocks
+ *
+ * The CCAT systemtime counts from 2000-01-01, if_tsoffset moves the
+ * timestamps to the Unix epoch pcapng readers expect.
+ */
+struct ccat_pcapng_preamble {
+	u32 shb_type;
+	u32 shb_len;
+	u32 byte_order_magic;
+	u16 major;
+	u16 minor;
+	s64 section_len;
+	u32 shb_len_trailer;
+	u32 idb_type;
+	u32 idb_len;
+	u16 linktype;
+	u16 reserved;
+	u32 snaplen;
+	u16 tsresol_code;
+	u16 tsresol_len;
+	u8 tsresol;
+	u8 tsresol_pad[3];
+	u16 tsoffset_code;
+	u16 tsoffset_len;
+	s64 tsoffset;
+	u32 idb_end_of_opt;
+	u32 idb_len_trailer;
+} __packed;
+
+/**
+ * struct ccat_pcapng_epb - pcapng Enhanced Packet Block without the data
+ * @hdr: in front of the frame data
+ * @opt: behind the frame data, which is padded to 32 bit
+ */
+struct ccat_pcapng_epb {
+	struct {
+		u32 type;
+		u32 len;
+		u32 interface_id;
+		u32 ts_high;
+		u32 ts_low;
+		u32 caplen;
+		u32 origlen;
+	} __packed hdr;
+	struct {
+		u16 flags_code;
+		u16 flags_len;
+		u32 flags;
+		u32 end_of_opt;
+		u32 len_trailer;
+	} __packed opt;
 };
 
 /**
@@ -195,6 +470,23 @@ struct ccat_mac_infoblock {
  * @rx_fifo: fifo used for RX descriptors
  * @tx_fifo: fifo used for TX descriptors
  * @poll_timer: interval timer used to poll CCAT for events like link changed, rx done, tx done
+ * @cycle: EtherCAT cycle used to align @poll_timer with returning frames
+ * @templates: pinned TX frames, DMA only
+ * @poll_list: entry in the list of ports serviced by the shared poller
+ * @poll_next: time this port is due in the shared poller
+ * @poll_shared: this port is serviced by the shared poller not @poll_timer
+ * @poll_stats: time spent polling this port
+ * @xstats: additional driver counters for ethtool -S
+ * @poll_hist: distribution of poll lateness, duration and frames per poll
+ * @debugfs: debugfs directory of this port
+ * @red: redundancy pair this port belongs to, protected by red_lock
+ * @txtime: frames held back until their launch time
+ * @gate: closes TX for best-effort traffic around the cyclic frames
+ * @steer: RX processing of non-EtherCAT frames on another CPU
+ * @capture: RX and TX frames with their CCAT timestamps for user space
+ * @ccdev: character device for the templates and the capture ring
+ * @selftest: running loopback test, which consumes its returning frames
+ * @pmu_port: index of this port in the "port" field of ccat_eth PMU events
  */
 struct ccat_eth_priv {
 	struct ccat_function *func;
@@ -204,6 +496,42 @@ struct ccat_eth_priv {
 	struct ccat_eth_fifo tx_fifo;
 	struct hrtimer poll_timer;
 	struct ccat_dma_mem dma_mem;
+	struct ccat_eth_cycle cycle;
+	struct ccat_eth_templates templates;
+	struct list_head poll_list;
+	ktime_t poll_next;
+	bool poll_shared;
+	struct ccat_eth_poll_stats poll_stats;
+	struct ccat_eth_xstats xstats;
+	struct ccat_eth_poll_hist poll_hist;
+	struct dentry *debugfs;
+	struct ccat_eth_redundancy *red;
+	struct ccat_eth_txtime txtime;
+	struct ccat_eth_gate gate;
+	struct ccat_eth_steer steer;
+	struct ccat_eth_capture capture;
+	struct ccat_cdev *ccdev;
+	struct ccat_eth_selftest *selftest;
+	int pmu_port;
+};
+
+static DEFINE_SPINLOCK(red_lock);
+
+/**
+ * struct ccat_eth_poller - one timer servicing all CCAT Ethernet ports
+ * @lock: protects @ports against open/stop of a port
+ * @ports: open ports, rotated after each run to serve them round-robin
+ * @timer: hrtimer pinned to poll_cpu
+ */
+struct ccat_eth_poller {
+	spinlock_t lock;
+	struct list_head ports;
+	struct hrtimer timer;
+};
+
+static struct ccat_eth_poller poller = {
+	.lock = __SPIN_LOCK_UNLOCKED(poller.lock),
+	.ports = LIST_HEAD_INIT(poller.ports),
 };
 
 struct ccat_mac_register {
@@ -232,13 +560,6 @@ struct ccat_mac_register {
 	u8 mii_connected;
 };
 
-static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo);
-static void fifo_set_end(struct ccat_eth_fifo *const fifo, size_t size)
-{
-	fifo->end = fifo->mem.start + size - sizeof(struct ccat_eth_frame);
-	ccat_eth_fifo_reset(fifo);
-}
-
 static void ccat_dma_free(struct ccat_eth_priv *const priv)
 {
 	if (priv->dma_mem.base) {
@@ -257,30 +578,31 @@ static void ccat_dma_free(struct ccat_eth_priv *const priv)
  * @channel number of the DMA channel
  * @ioaddr of the pci bar2 configspace used to calculate the address of the pci dma configuration
  * @dev which should be configured for DMA
+ * @size number of bytes of the channel memory used by the fifo
  */
 static int ccat_dma_init(struct ccat_dma_mem *const dma, size_t channel,
 			 void __iomem * const bar2,
-			 struct ccat_eth_fifo *const fifo)
+			 struct ccat_eth_fifo *const fifo, size_t size)
 {
 	void __iomem *const ioaddr = bar2 + 0x1000 + (sizeof(u64) * channel);
 	const dma_addr_t phys = CCAT_ALIGN_CHANNEL(dma->phys, channel);
 	const u32 phys_hi = (sizeof(phys) > sizeof(u32)) ? phys >> 32 : 0;
 	fifo->dma.start = CCAT_ALIGN_CHANNEL(dma->base, channel);
 
-	fifo_set_end(fifo, CCAT_ALIGNMENT);
+	fifo_set_end(fifo, size);
 	if (request_dma(channel, KBUILD_MODNAME)) {
 		pr_info("request dma channel %llu failed\n", (u64) channel);
 		return -EINVAL;
 	}
 
 	/** bit 0 enables 64 bit mode on ccat */
-	iowrite32((u32) phys | ((phys_hi) > 0), ioaddr);
-	iowrite32(phys_hi, ioaddr + 4);
+	ccat_iowrite32((u32) phys | ((phys_hi) > 0), ioaddr);
+	ccat_iowrite32(phys_hi, ioaddr + 4);
 
 	pr_info
 	    ("DMA%llu mem initialized\n base:         0x%p\n start:        0x%p\n phys:         0x%09llx\n pci addr:     0x%01x%08x\n size:         %llu |%llx bytes.\n",
 	     (u64) channel, dma->base, fifo->dma.start, (u64) dma->phys,
-	     ioread32(ioaddr + 4), ioread32(ioaddr),
+	     ccat_ioread32(ioaddr + 4), ccat_ioread32(ioaddr),
 	     (u64) dma->size, (u64) dma->size);
 	return 0;
 }
@@ -293,27 +615,23 @@ static inline size_t fifo_eim_tx_ready(struct ccat_eth_fifo *const fifo)
 	static const u8 TX_FIFO_LEVEL_MASK = 0x3F;
 	void __iomem *addr = priv->reg.mac + TX_FIFO_LEVEL_OFFSET;
 
-	return !(ioread8(addr) & TX_FIFO_LEVEL_MASK);
+	fifo->mmio_reads++;
+	return !(ccat_ioread8(addr) & TX_FIFO_LEVEL_MASK);
 }
 
 static inline size_t fifo_eim_rx_ready(struct ccat_eth_fifo *const fifo)
 {
 	static const size_t OVERHEAD = sizeof(struct ccat_eim_frame_hdr);
-	const size_t len = ioread16(&fifo->eim.next->hdr.length);
+	const size_t len = ccat_ioread16(&fifo->eim.next->hdr.length);
 
+	fifo->mmio_reads++;
 	return (len < OVERHEAD) ? 0 : len - OVERHEAD;
 }
 
-static void ccat_eth_fifo_inc(struct ccat_eth_fifo *fifo)
-{
-	if (++fifo->mem.next > fifo->end)
-		fifo->mem.next = fifo->mem.start;
-}
-
 static void fifo_eim_rx_add(struct ccat_eth_fifo *const fifo)
 {
 	struct ccat_eim_frame __iomem *frame = fifo->eim.next;
-	iowrite16(0, frame);
+	ccat_iowrite16(0, frame);
 	wmb();
 }
 
@@ -321,12 +639,25 @@ static void fifo_eim_tx_add(struct ccat_eth_fifo *const fifo)
 {
 }
 
-#define memcpy_from_ccat(DEST, SRC, LEN) memcpy(DEST,(__force void*)(SRC), LEN)
-#define memcpy_to_ccat(DEST, SRC, LEN) memcpy((__force void*)(DEST),SRC, LEN)
-static void fifo_eim_copy_to_linear_skb(struct ccat_eth_fifo *const fifo,
-					struct sk_buff *skb, const size_t len)
+#define memcpy_from_ccat(DEST, SRC, LEN) \
+	CCAT_MMIO("memcpy_from_ccat", LEN, memcpy(DEST,(__force void*)(SRC), LEN))
+#define memcpy_to_ccat(DEST, SRC, LEN) \
+	CCAT_MMIO("memcpy_to_ccat", LEN, memcpy((__force void*)(DEST),SRC, LEN))
+static u64 fifo_eim_timestamp(const struct ccat_eth_frame *const frame)
+{
+	const struct ccat_eim_frame __iomem *const eim =
+	    (const struct ccat_eim_frame __iomem *)frame;
+	__le64 timestamp;
+
+	memcpy_from_ccat(&timestamp, &eim->hdr.timestamp, sizeof(timestamp));
+	return le64_to_cpu(timestamp);
+}
+
+static void fifo_eim_copy_to_buf(struct ccat_eth_fifo *const fifo,
+				 void *buf, const size_t len)
 {
-	memcpy_from_ccat(skb->data, fifo->eim.next->data, len);
+	fifo->mmio_reads += DIV_ROUND_UP(len, sizeof(u32));
+	memcpy_from_ccat(buf, fifo->eim.next->data, len);
 }
 
 static void fifo_eim_queue_skb(struct ccat_eth_fifo *const fifo,
@@ -339,106 +670,14 @@ static void fifo_eim_queue_skb(struct ccat_eth_fifo *const fifo,
 	const __le16 length = cpu_to_le16(skb->len);
 	memcpy_to_ccat(&frame->hdr.length, &length, sizeof(length));
 	memcpy_to_ccat(frame->data, skb->data, skb->len);
-	iowrite32(addr_and_length, fifo->reg);
-}
-
-static void ccat_eth_fifo_hw_reset(struct ccat_eth_fifo *const fifo)
-{
-	if (fifo->reg) {
-		iowrite32(0, fifo->reg + 0x8);
-		wmb();
-	}
-}
-
-static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo)
-{
-	ccat_eth_fifo_hw_reset(fifo);
-
-	if (fifo->ops->add) {
-		fifo->mem.next = fifo->mem.start;
-		do {
-			fifo->ops->add(fifo);
-			ccat_eth_fifo_inc(fifo);
-		} while (fifo->mem.next != fifo->mem.start);
-	}
-}
-
-static inline size_t fifo_dma_tx_ready(struct ccat_eth_fifo *const fifo)
-{
-	const struct ccat_dma_frame *frame = fifo->dma.next;
-	return le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT;
-}
-
-static inline size_t fifo_dma_rx_ready(struct ccat_eth_fifo *const fifo)
-{
-	static const size_t OVERHEAD =
-	    offsetof(struct ccat_dma_frame_hdr, rx_flags);
-	const struct ccat_dma_frame *const frame = fifo->dma.next;
-
-	if (le32_to_cpu(frame->hdr.rx_flags) & CCAT_FRAME_RECEIVED) {
-		const size_t len = le16_to_cpu(frame->hdr.length);
-		return (len < OVERHEAD) ? 0 : len - OVERHEAD;
-	}
-	return 0;
-}
-
-static void ccat_eth_rx_fifo_dma_add(struct ccat_eth_fifo *const fifo)
-{
-	struct ccat_dma_frame *const frame = fifo->dma.next;
-	const size_t offset = (void *)frame - fifo->dma.start;
-	const u32 addr_and_length = (1 << 31) | offset;
-
-	frame->hdr.rx_flags = cpu_to_le32(0);
-	iowrite32(addr_and_length, fifo->reg);
-}
-
-static void ccat_eth_tx_fifo_dma_add_free(struct ccat_eth_fifo *const fifo)
-{
-	/* mark frame as ready to use for tx */
-	fifo->dma.next->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
-}
-
-static void fifo_dma_copy_to_linear_skb(struct ccat_eth_fifo *const fifo,
-					struct sk_buff *skb, const size_t len)
-{
-	skb_copy_to_linear_data(skb, fifo->dma.next->data, len);
-}
-
-static void fifo_dma_queue_skb(struct ccat_eth_fifo *const fifo,
-			       struct sk_buff *skb)
-{
-	struct ccat_dma_frame *frame = fifo->dma.next;
-	u32 addr_and_length;
-
-	frame->hdr.tx_flags = cpu_to_le32(0);
-	frame->hdr.length = cpu_to_le16(skb->len);
-
-	memcpy(frame->data, skb->data, skb->len);
-
-	/* Queue frame into CCAT TX-FIFO, CCAT ignores the first 8 bytes of the tx descriptor */
-	addr_and_length = offsetof(struct ccat_dma_frame_hdr, length);
-	addr_and_length += ((void *)frame - fifo->dma.start);
-	addr_and_length +=
-	    ((skb->len + sizeof(struct ccat_dma_frame_hdr)) / 8) << 24;
-	iowrite32(addr_and_length, fifo->reg);
+	ccat_iowrite32(addr_and_length, fifo->reg);
 }
 
-static const struct ccat_eth_fifo_operations dma_rx_fifo_ops = {
-	.add = ccat_eth_rx_fifo_dma_add,
-	.ready = fifo_dma_rx_ready,
-	.queue.copy_to_skb = fifo_dma_copy_to_linear_skb,
-};
-
-static const struct ccat_eth_fifo_operations dma_tx_fifo_ops = {
-	.add = ccat_eth_tx_fifo_dma_add_free,
-	.ready = fifo_dma_tx_ready,
-	.queue.skb = fifo_dma_queue_skb,
-};
-
 static const struct ccat_eth_fifo_operations eim_rx_fifo_ops = {
 	.add = fifo_eim_rx_add,
-	.queue.copy_to_skb = fifo_eim_copy_to_linear_skb,
+	.queue.copy_to_buf = fifo_eim_copy_to_buf,
 	.ready = fifo_eim_rx_ready,
+	.timestamp = fifo_eim_timestamp,
 };
 
 static const struct ccat_eth_fifo_operations eim_tx_fifo_ops = {
@@ -459,11 +698,40 @@ static void ccat_eth_priv_free(struct ccat_eth_priv *priv)
 
 static int ccat_hw_disable_mac_filter(struct ccat_eth_priv *priv)
 {
-	iowrite8(0, priv->reg.mii + 0x8 + 6);
+	ccat_iowrite8(0, priv->reg.mii + 0x8 + 6);
 	wmb();
 	return 0;
 }
 
+/**
+ * ccat_eth_templates_size() - bytes reserved for TX templates
+ *
+ * The templates are mmap()ed to user space, so they are rounded up to
+ * full pages. At most half of the TX ring is reserved.
+ */
+static size_t ccat_eth_templates_size(void)
+{
+	const size_t size =
+	    PAGE_ALIGN(tx_templates * sizeof(struct ccat_dma_frame));
+
+	return min(size, CCAT_ALIGNMENT / 2);
+}
+
+/**
+ * ccat_eth_templates_reset() - mark all TX templates as sent
+ *
+ * Called at init and after the TX fifo was reset, which drops template
+ * transmissions still pending; their slots would stay busy forever.
+ */
+static void ccat_eth_templates_reset(struct ccat_eth_templates *templates)
+{
+	unsigned int i;
+
+	for (i = 0; i < templates->count; ++i) {
+		templates->slots[i].hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+	}
+}
+
 /**
  * Initalizes both (Rx/Tx) DMA fifo's and related management structures
  */
@@ -474,6 +742,7 @@ static int ccat_eth_priv_init_dma(struct ccat_eth_priv *priv)
 	void __iomem *const bar_2 = priv->func->ccat->bar_2;
 	const u8 rx_chan = priv->func->info.rx_dma_chan;
 	const u8 tx_chan = priv->func->info.tx_dma_chan;
+	const size_t templates_size = ccat_eth_templates_size();
 	int status = 0;
 
 	dma->dev = &pdev->dev;
@@ -486,7 +755,8 @@ static int ccat_eth_priv_init_dma(struct ccat_eth_priv *priv)
 	}
 
 	priv->rx_fifo.ops = &dma_rx_fifo_ops;
-	status = ccat_dma_init(dma, rx_chan, bar_2, &priv->rx_fifo);
+	status =
+	    ccat_dma_init(dma, rx_chan, bar_2, &priv->rx_fifo, CCAT_ALIGNMENT);
 	if (status) {
 		pr_info("init RX DMA memory failed.\n");
 		ccat_dma_free(priv);
@@ -494,13 +764,25 @@ static int ccat_eth_priv_init_dma(struct ccat_eth_priv *priv)
 	}
 
 	priv->tx_fifo.ops = &dma_tx_fifo_ops;
-	status = ccat_dma_init(dma, tx_chan, bar_2, &priv->tx_fifo);
+	status = ccat_dma_init(dma, tx_chan, bar_2, &priv->tx_fifo,
+			       CCAT_ALIGNMENT - templates_size);
 	if (status) {
 		pr_info("init TX DMA memory failed.\n");
 		ccat_dma_free(priv);
 		return status;
 	}
 
+	if (templates_size) {
+		struct ccat_eth_templates *const templates = &priv->templates;
+
+		templates->slots = priv->tx_fifo.dma.start + CCAT_ALIGNMENT -
+		    templates_size;
+		templates->phys = CCAT_ALIGN_CHANNEL(dma->phys, tx_chan) +
+		    CCAT_ALIGNMENT - templates_size;
+		templates->count = templates_size / sizeof(struct ccat_dma_frame);
+		ccat_eth_templates_reset(templates);
+	}
+
 	return ccat_hw_disable_mac_filter(priv);
 }
 
@@ -540,7 +822,7 @@ static void ccat_eth_priv_init_reg(struct ccat_eth_priv *const priv)
 	BUILD_BUG_ON(offsetof(struct ccat_dma, start) !=
 		     offsetof(struct ccat_eim, start));
 
-	memcpy_fromio(&offsets, func_base, sizeof(offsets));
+	ccat_memcpy_fromio(&offsets, func_base, sizeof(offsets));
 	reg->mii = func_base + offsets.mii;
 	priv->tx_fifo.reg = func_base + offsets.tx_fifo;
 	priv->rx_fifo.reg = func_base + offsets.tx_fifo + 0x10;
@@ -550,254 +832,2751 @@ static void ccat_eth_priv_init_reg(struct ccat_eth_priv *const priv)
 	reg->misc = func_base + offsets.misc;
 }
 
-static netdev_tx_t ccat_eth_start_xmit(struct sk_buff *skb,
-				       struct net_device *dev)
+static bool ccat_eth_is_ecat(const void *const data, size_t len)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
-	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	const struct ethhdr *const eth = data;
 
-	if (skb_is_nonlinear(skb)) {
-		pr_warn("Non linear skb not supported -> drop frame.\n");
-		atomic64_inc(&fifo->dropped);
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
-	}
+	return len >= ETH_HLEN && eth->h_proto == htons(ETH_P_ETHERCAT);
+}
 
-	if (skb->len > MAX_PAYLOAD_SIZE) {
-		pr_warn("skb.len %llu exceeds dma buffer %llu -> drop frame.\n",
-			(u64) skb->len, (u64) MAX_PAYLOAD_SIZE);
-		atomic64_inc(&fifo->dropped);
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
+/**
+ * ccat_eth_cycle_tx() - learn the EtherCAT cycle from outgoing frames
+ * @frame: TX slot the frame is queued into
+ *
+ * Only the first 0x88a4 frame of a cycle counts, frames following it
+ * within CYCLE_MIN_NS belong to the same cycle. The period is locked
+ * after CYCLE_LOCK_COUNT consecutive cycles within 1/8 of the estimate.
+ */
+static void ccat_eth_cycle_tx(struct ccat_eth_priv *const priv,
+			      const struct ccat_eth_frame *const frame)
+{
+	struct ccat_eth_cycle *const cycle = &priv->cycle;
+	const ktime_t now = ktime_get();
+	const s64 delta = ktime_to_ns(ktime_sub(now, cycle->last_tx));
+	const s64 period = cycle->learned_cycle_ns;
+
+	if (delta < CYCLE_MIN_NS) {
+		return;
 	}
 
-	if (!fifo->ops->ready(fifo)) {
-		netdev_err(dev, "BUG! Tx Ring full when queue awake!\n");
-		netif_stop_queue(priv->netdev);
-		return NETDEV_TX_BUSY;
+	if (delta > CYCLE_MAX_NS) {
+		cycle->locked = 0;
+	} else if (period && abs(delta - period) < period / 8) {
+		WRITE_ONCE(cycle->learned_cycle_ns,
+			   period + (delta - period) / 8);
+		if (cycle->locked < CYCLE_LOCK_COUNT) {
+			WRITE_ONCE(cycle->locked, cycle->locked + 1);
+		}
+	} else {
+		WRITE_ONCE(cycle->learned_cycle_ns, delta);
+		WRITE_ONCE(cycle->locked, 0);
 	}
+	WRITE_ONCE(cycle->tx_frame, frame);
+	WRITE_ONCE(cycle->returned, false);
+	WRITE_ONCE(cycle->last_tx, now);
+
+	if (priv->func->ccat->systemtime
+	    && (READ_ONCE(priv->gate.guard_ns) || READ_ONCE(priv->gate.hold_ns))) {
+		WRITE_ONCE(priv->gate.anchor,
+			   ccat_systemtime_read64(priv->func->ccat->systemtime));
+	}
+}
 
-	/* prepare frame in DMA memory */
-	fifo->ops->queue.skb(fifo, skb);
+/**
+ * ccat_eth_cycle_rx() - learn the round trip time of the cycle frame
+ * @frame: RX slot of a received 0x88a4 frame
+ *
+ * With DMA timestamps of both directions the round trip time is measured
+ * by CCAT, otherwise the host time of the poll is used as upper bound.
+ */
+static void ccat_eth_cycle_rx(struct ccat_eth_priv *const priv,
+			      const struct ccat_eth_frame *const frame)
+{
+	struct ccat_eth_cycle *const cycle = &priv->cycle;
+	const struct ccat_eth_frame *const tx_frame = READ_ONCE(cycle->tx_frame);
+	const u32 period = READ_ONCE(cycle->learned_cycle_ns);
+	s64 rtt = 0;
 
-	/* update stats */
-	atomic64_add(skb->len, &fifo->bytes);
+	if (cycle->returned) {
+		return;
+	}
+	WRITE_ONCE(cycle->returned, true);
 
-	dev_kfree_skb_any(skb);
+	if (tx_frame && priv->tx_fifo.ops->timestamp
+	    && priv->rx_fifo.ops->timestamp) {
+		const u64 tx_ts = priv->tx_fifo.ops->timestamp(tx_frame);
+		const u64 rx_ts = priv->rx_fifo.ops->timestamp(frame);
 
-	ccat_eth_fifo_inc(fifo);
-	/* stop queue if tx ring is full */
-	if (!fifo->ops->ready(fifo)) {
-		netif_stop_queue(priv->netdev);
+		if (tx_ts && rx_ts > tx_ts) {
+			rtt = rx_ts - tx_ts;
+		}
 	}
-	return NETDEV_TX_OK;
+	if (!rtt) {
+		rtt = ktime_to_ns(ktime_sub(ktime_get(), cycle->last_tx));
+	}
+
+	if (rtt <= 0 || (period && rtt >= period)) {
+		return;
+	}
+	if (cycle->learned_rtt_ns) {
+		rtt = cycle->learned_rtt_ns + (rtt - cycle->learned_rtt_ns) / 8;
+	}
+	WRITE_ONCE(cycle->learned_rtt_ns, rtt);
 }
 
 /**
- * Function to transmit a raw buffer to the network (f.e. frameForwardEthernetFrames)
- * @dev a valid net_device
- * @data pointer to your raw buffer
- * @len number of bytes in the raw buffer to transmit
+ * ccat_eth_next_poll() - calculate the expiry of the next poll
+ *
+ * Without a known cycle the driver polls every POLL_TIME. Otherwise it
+ * polls every dense_ns from a guard interval before the expected return
+ * of the cycle frame until it was received, and every sparse_ns (but
+ * never beyond the start of the next dense window) for the rest.
  */
-static void ccat_eth_xmit_raw(struct net_device *dev, const char *const data,
-			      size_t len)
+static ktime_t ccat_eth_next_poll(const struct ccat_eth_priv *const priv,
+				  const ktime_t now)
 {
-	struct sk_buff *skb = dev_alloc_skb(len);
+	const struct ccat_eth_cycle *const cycle = &priv->cycle;
+	const s64 dense = max_t(s64, READ_ONCE(cycle->dense_ns), NSEC_PER_USEC);
+	const s64 sparse = max_t(s64, READ_ONCE(cycle->sparse_ns), dense);
+	s64 period = READ_ONCE(cycle->cycle_ns);
+	s64 rtt = READ_ONCE(cycle->rtt_ns);
+	s64 since_tx, guard;
+	s32 phase;
+
+	if (!period && READ_ONCE(cycle->locked) >= CYCLE_LOCK_COUNT) {
+		period = READ_ONCE(cycle->learned_cycle_ns);
+	}
+	if (!rtt) {
+		rtt = READ_ONCE(cycle->learned_rtt_ns);
+	}
 
-	skb->dev = dev;
-	skb_copy_to_linear_data(skb, data, len);
-	skb_put(skb, len);
-	ccat_eth_start_xmit(skb, dev);
+	since_tx = ktime_to_ns(ktime_sub(now, READ_ONCE(cycle->last_tx)));
+	if (!period || period > CYCLE_MAX_NS || since_tx > 4 * period) {
+		return ktime_add(now, POLL_TIME);
+	}
+
+	/* position within the cycle relative to the expected return */
+	guard = max(2 * dense, period / 32);
+	div_s64_rem(since_tx - rtt + guard, period, &phase);
+	if (phase < 0) {
+		phase += period;
+	}
+
+	if (phase < 2 * guard && !READ_ONCE(cycle->returned)) {
+		return ktime_add_ns(now, dense);
+	}
+	return ktime_add_ns(now, min(sparse, period - phase));
 }
 
-static void ccat_eth_receive(struct ccat_eth_priv *const priv, const size_t len)
+static bool ccat_eth_is_ccat(const struct net_device *const dev);
+
+static void ccat_eth_redundancy_deliver(struct ccat_eth_redundancy *const red,
+					struct ccat_eth_red_slot *const slot)
 {
-	struct sk_buff *const skb = dev_alloc_skb(len + NET_IP_ALIGN);
-	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
-	struct net_device *const dev = priv->netdev;
+	if (slot->held) {
+		slot->held->dev = red->primary->netdev;
+		netif_rx(slot->held);
+		slot->held = NULL;
+		red->single++;
+	}
+	slot->pending = false;
+	slot->single = false;
+}
 
-	if (!skb) {
-		pr_info("%s() out of memory :-(\n", __FUNCTION__);
-		atomic64_inc(&fifo->dropped);
-		return;
+/**
+ * ccat_eth_redundancy_tx_single() - no copy was sent on the secondary port
+ * @priv: the primary port
+ * @idx: index of the first datagram of the frame
+ * @busy: the secondary port was busy, not just without link
+ *
+ * A copy which already returned is delivered right away, otherwise the
+ * slot is marked to deliver the first one returning without waiting
+ * RED_TIMEOUT_NS for a twin which never comes.
+ */
+static void ccat_eth_redundancy_tx_single(struct ccat_eth_priv *const priv,
+					  const u8 idx, const bool busy)
+{
+	struct ccat_eth_redundancy *red;
+	unsigned long flags;
+
+	spin_lock_irqsave(&red_lock, flags);
+	red = priv->red;
+	if (red && red->primary == priv) {
+		struct ccat_eth_red_slot *const slot =
+		    &red->slots[idx % RED_SLOTS];
+
+		if (slot->pending && slot->orig[ECAT_IDX_OFFSET] == idx) {
+			if (slot->held) {
+				ccat_eth_redundancy_deliver(red, slot);
+			} else {
+				slot->single = true;
+			}
+		}
+		if (busy) {
+			red->tx_busy++;
+		}
 	}
-	skb->dev = dev;
-	skb_reserve(skb, NET_IP_ALIGN);
-	fifo->ops->queue.copy_to_skb(fifo, skb, len);
-	skb_put(skb, len);
-	skb->protocol = eth_type_trans(skb, dev);
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	atomic64_add(len, &fifo->bytes);
-	netif_rx(skb);
+	spin_unlock_irqrestore(&red_lock, flags);
 }
 
-static void ccat_eth_link_down(struct net_device *const dev)
+/**
+ * ccat_eth_redundancy_merge() - merge the datagrams of two returned copies
+ * @a: first copy, receives the result
+ * @b: second copy
+ * @orig: the frame as it was sent
+ * @len: length of all three frames
+ *
+ * Each slave processed the datagrams in only one of the copies, so the
+ * changes of both copies are combined by XOR against the original data
+ * and the working counters are summed up.
+ */
+static void ccat_eth_redundancy_merge(u8 * a, const u8 * b, const u8 * orig,
+				      size_t len)
 {
-	netif_stop_queue(dev);
-	netif_carrier_off(dev);
-	netdev_info(dev, "NIC Link is Down\n");
+	size_t pos = ETH_HLEN + ECAT_HDR_LEN;
+
+	while (pos + ECAT_DGRAM_HDR_LEN + ECAT_WKC_LEN <= len) {
+		const u16 len_field = get_unaligned_le16(a + pos + 6);
+		const size_t data = pos + ECAT_DGRAM_HDR_LEN;
+		const size_t wkc = data + (len_field & 0x7ff);
+		size_t i;
+
+		if (wkc + ECAT_WKC_LEN > len) {
+			break;
+		}
+		for (i = data; i < wkc; ++i) {
+			a[i] ^= b[i] ^ orig[i];
+		}
+		put_unaligned_le16(get_unaligned_le16(a + wkc) +
+				   get_unaligned_le16(b + wkc), a + wkc);
+
+		/* bit 15: more datagrams follow */
+		if (!(len_field & 0x8000)) {
+			break;
+		}
+		pos = wkc + ECAT_WKC_LEN;
+	}
 }
 
-static void ccat_eth_link_up(struct net_device *const dev)
+/**
+ * ccat_eth_redundancy_tx() - send a cyclic frame on the secondary port, too
+ *
+ * The secondary TX queue is only try-locked: this may be called with
+ * the primary TX queue locked or from the poll timer (link up).
+ */
+static void ccat_eth_redundancy_tx(struct ccat_eth_priv *const priv,
+				   struct sk_buff *const skb)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_eth_redundancy *red;
+	struct ccat_eth_priv *secondary = NULL;
+	struct netdev_queue *txq;
+	struct ccat_eth_fifo *fifo;
+	unsigned long flags;
+	bool queued;
+	u8 idx;
+
+	if (!READ_ONCE(priv->red) || skb->len < ECAT_MIN_LEN
+	    || skb->len > ETH_FRAME_LEN) {
+		return;
+	}
+	idx = skb->data[ECAT_IDX_OFFSET];
+
+	spin_lock_irqsave(&red_lock, flags);
+	red = priv->red;
+	if (red && red->primary == priv) {
+		struct ccat_eth_red_slot *const slot = &red->slots[idx % RED_SLOTS];
+
+		ccat_eth_redundancy_deliver(red, slot);
+		memcpy(slot->orig, skb->data, skb->len);
+		slot->len = skb->len;
+		slot->sent = ktime_get();
+		slot->pending = true;
+		secondary = red->secondary;
+	}
+	spin_unlock_irqrestore(&red_lock, flags);
 
-	netdev_info(dev, "NIC Link is Up\n");
+	if (!secondary) {
+		return;
+	}
+	if (!netif_carrier_ok(secondary->netdev)) {
+		ccat_eth_redundancy_tx_single(priv, idx, false);
+		return;
+	}
+
+	txq = netdev_get_tx_queue(secondary->netdev, 0);
+	fifo = &secondary->tx_fifo;
+	if (!__netif_tx_trylock(txq)) {
+		atomic64_inc(&fifo->dropped);
+		ccat_eth_redundancy_tx_single(priv, idx, true);
+		return;
+	}
+	queued = fifo->ops->ready(fifo);
+	if (queued) {
+		fifo->ops->queue.skb(fifo, skb);
+		atomic64_add(skb->len, &fifo->bytes);
+		ccat_eth_fifo_inc(fifo);
+		if (!fifo->ops->ready(fifo)) {
+			secondary->xstats.tx_ring_full++;
+			netif_tx_stop_queue(txq);
+		}
+	} else {
+		atomic64_inc(&fifo->dropped);
+	}
+	__netif_tx_unlock(txq);
+
+	if (!queued) {
+		ccat_eth_redundancy_tx_single(priv, idx, true);
+	}
+}
+
+/**
+ * ccat_eth_redundancy_rx() - merge the copies of a returning cyclic frame
+ *
+ * The first copy is held back until the second one arrives, then the
+ * merged frame is passed to the stack on the primary port. Frames not
+ * sent through the pair are passed on unmodified.
+ *
+ * Return: true if the skb was consumed
+ */
+static bool ccat_eth_redundancy_rx(struct ccat_eth_priv *const priv,
+				   struct sk_buff *const skb)
+{
+	const u8 *const frame = skb_mac_header(skb);
+	const size_t len = skb->len + ETH_HLEN;
+	struct ccat_eth_redundancy *red;
+	struct ccat_eth_red_slot *slot;
+	struct sk_buff *merged = NULL;
+	unsigned long flags;
+
+	if (!READ_ONCE(priv->red)) {
+		return false;
+	}
+
+	spin_lock_irqsave(&red_lock, flags);
+	red = priv->red;
+	if (!red || len < ECAT_MIN_LEN) {
+		spin_unlock_irqrestore(&red_lock, flags);
+		return false;
+	}
+
+	slot = &red->slots[frame[ECAT_IDX_OFFSET] % RED_SLOTS];
+	if (!slot->pending || slot->len != len
+	    || slot->orig[ECAT_IDX_OFFSET] != frame[ECAT_IDX_OFFSET]) {
+		/* not ours, stays on the port it arrived on */
+		spin_unlock_irqrestore(&red_lock, flags);
+		return false;
+	}
+
+	/* the reply to a frame sent by the primary, delivered there only */
+	skb->dev = red->primary->netdev;
+	if (slot->single) {
+		/* no twin on the way, pass this copy on unmodified */
+		slot->pending = false;
+		slot->single = false;
+		red->single++;
+		spin_unlock_irqrestore(&red_lock, flags);
+		return false;
+	}
+
+	if (!slot->held) {
+		slot->held = skb;
+		spin_unlock_irqrestore(&red_lock, flags);
+		return true;
+	}
+
+	merged = slot->held;
+	ccat_eth_redundancy_merge(skb_mac_header(merged), frame, slot->orig,
+				  len);
+	slot->held = NULL;
+	slot->pending = false;
+	red->merged++;
+	spin_unlock_irqrestore(&red_lock, flags);
+
+	dev_kfree_skb_any(skb);
+	netif_rx(merged);
+	return true;
+}
+
+/**
+ * ccat_eth_redundancy_flush() - deliver copies whose twin got lost
+ */
+static void ccat_eth_redundancy_flush(struct ccat_eth_priv *const priv,
+				      const ktime_t now)
+{
+	struct ccat_eth_redundancy *red;
+	unsigned long flags;
+	size_t i;
+
+	if (!READ_ONCE(priv->red)) {
+		return;
+	}
+
+	spin_lock_irqsave(&red_lock, flags);
+	red = priv->red;
+	for (i = 0; red && red->primary == priv && i < RED_SLOTS; ++i) {
+		struct ccat_eth_red_slot *const slot = &red->slots[i];
+
+		if (slot->held
+		    && ktime_to_ns(ktime_sub(now, slot->sent)) > RED_TIMEOUT_NS) {
+			ccat_eth_redundancy_deliver(red, slot);
+		}
+	}
+	spin_unlock_irqrestore(&red_lock, flags);
+}
+
+/**
+ * ccat_eth_redundancy_unpair() - split the redundancy pair of a port
+ *
+ * Caller has to hold the rtnl lock.
+ */
+static void ccat_eth_redundancy_unpair(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_redundancy *red;
+	unsigned long flags;
+	size_t i;
+
+	spin_lock_irqsave(&red_lock, flags);
+	red = priv->red;
+	if (red) {
+		WRITE_ONCE(red->primary->red, NULL);
+		WRITE_ONCE(red->secondary->red, NULL);
+	}
+	spin_unlock_irqrestore(&red_lock, flags);
+
+	if (!red) {
+		return;
+	}
+
+	/* wait for TX and poll running on other CPUs */
+	synchronize_net();
+	for (i = 0; i < RED_SLOTS; ++i) {
+		if (red->slots[i].held) {
+			dev_kfree_skb_any(red->slots[i].held);
+		}
+	}
+	netdev_info(red->primary->netdev, "redundancy with %s disabled\n",
+		    red->secondary->netdev->name);
+	kfree(red);
+}
+
+/**
+ * ccat_eth_redundancy_pair() - pair two ports for cable redundancy
+ *
+ * Caller has to hold the rtnl lock.
+ */
+static int ccat_eth_redundancy_pair(struct ccat_eth_priv *const primary,
+				    struct ccat_eth_priv *const secondary)
+{
+	struct ccat_eth_redundancy *red;
+	unsigned long flags;
+
+	if (primary == secondary || primary->red || secondary->red) {
+		return -EBUSY;
+	}
+
+	red = kzalloc(sizeof(*red), GFP_KERNEL);
+	if (!red) {
+		return -ENOMEM;
+	}
+	red->primary = primary;
+	red->secondary = secondary;
+
+	spin_lock_irqsave(&red_lock, flags);
+	WRITE_ONCE(primary->red, red);
+	WRITE_ONCE(secondary->red, red);
+	spin_unlock_irqrestore(&red_lock, flags);
+
+	netdev_info(primary->netdev, "redundancy with %s enabled\n",
+		    secondary->netdev->name);
+	return 0;
+}
+
+static u64 ccat_eth_systemtime_now(const struct ccat_eth_priv *const priv)
+{
+	void __iomem *const systemtime = priv->func->ccat->systemtime;
+
+	return systemtime ? ccat_systemtime_read64(systemtime) : 0;
+}
+
+static bool ccat_eth_capture_match(const struct ccat_eth_capture *const cap,
+				   const u8 * hdr, size_t len)
+{
+	__be16 proto;
+	size_t i;
+
+	if (!cap->ethertypes[0]) {
+		return true;
+	}
+	if (len < ETH_HLEN) {
+		return false;
+	}
+	proto = ((const struct ethhdr *)hdr)->h_proto;
+	for (i = 0; i < ARRAY_SIZE(cap->ethertypes) && cap->ethertypes[i]; ++i) {
+		if (cap->ethertypes[i] == proto) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * ccat_eth_capture() - append a frame to the capture ring
+ * @data: the frame, NULL to copy the current frame of the RX fifo
+ * @len: length of the frame
+ * @timestamp: CCAT timestamp of the frame, 0 if unknown
+ * @flags: PCAPNG_EPB_INBOUND or PCAPNG_EPB_OUTBOUND
+ *
+ * A block is never split at the end of the ring. If it doesn't fit, a zero
+ * block type is written and the block starts at offset 0 of the ring.
+ */
+static void ccat_eth_capture(struct ccat_eth_priv *const priv,
+			     const void *data, size_t len, u64 timestamp,
+			     u32 flags)
+{
+	struct ccat_eth_capture *const cap = &priv->capture;
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	struct ccat_eth_capture_ctrl *ctrl;
+	struct ccat_pcapng_epb *epb;
+	typeof(epb->opt) *opt;
+	size_t caplen, block_len, off, skip = 0;
+	unsigned long irq_flags;
+	u8 *frame;
+	u64 head;
+
+	spin_lock_irqsave(&cap->lock, irq_flags);
+	ctrl = cap->ctrl;
+	if (!ctrl) {
+		goto unlock;
+	}
+
+	if (cap->ethertypes[0]) {
+		u8 hdr[ETH_HLEN];
+
+		if (!data && len >= ETH_HLEN) {
+			fifo->ops->queue.copy_to_buf(fifo, hdr, ETH_HLEN);
+		}
+		if (!ccat_eth_capture_match(cap, data ? data : hdr, len)) {
+			ctrl->filtered++;
+			goto unlock;
+		}
+	}
+
+	caplen = min_t(size_t, len, cap->snaplen);
+	block_len = sizeof(*epb) + ALIGN(caplen, 4);
+	head = ctrl->head;
+	off = head & (cap->size - 1);
+	if (cap->size - off < block_len) {
+		skip = cap->size - off;
+	}
+	if (head + skip + block_len - smp_load_acquire(&ctrl->tail) > cap->size) {
+		ctrl->dropped++;
+		goto unlock;
+	}
+	if (skip) {
+		*(u32 *) (cap->data + off) = 0;
+		head += skip;
+		off = 0;
+	}
+
+	epb = (struct ccat_pcapng_epb *)(cap->data + off);
+	frame = cap->data + off + sizeof(epb->hdr);
+	if (data) {
+		memcpy(frame, data, caplen);
+	} else {
+		fifo->ops->queue.copy_to_buf(fifo, frame, caplen);
+	}
+	memset(frame + caplen, 0, ALIGN(caplen, 4) - caplen);
+
+	epb->hdr.type = 6;
+	epb->hdr.len = block_len;
+	epb->hdr.interface_id = 0;
+	epb->hdr.ts_high = upper_32_bits(timestamp);
+	epb->hdr.ts_low = lower_32_bits(timestamp);
+	epb->hdr.caplen = caplen;
+	epb->hdr.origlen = len;
+
+	/* options behind the padded frame data */
+	opt = (void *)(frame + ALIGN(caplen, 4));
+	opt->flags_code = 2;	/* epb_flags */
+	opt->flags_len = sizeof(opt->flags);
+	opt->flags = flags;
+	opt->end_of_opt = 0;
+	opt->len_trailer = block_len;
+
+	smp_store_release(&ctrl->head, head + block_len);
+unlock:
+	spin_unlock_irqrestore(&cap->lock, irq_flags);
+}
+
+/**
+ * ccat_eth_capture_tx() - capture the DMA TX slots CCAT has sent
+ *
+ * DMA TX frames are captured once CCAT stored their timestamp, slots
+ * reused before the next poll are missed.
+ */
+static void ccat_eth_capture_tx(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_capture *const cap = &priv->capture;
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	const struct ccat_eth_frame *const next = READ_ONCE(fifo->mem.next);
+
+	while (cap->tx_clean != next) {
+		const struct ccat_dma_frame *const frame =
+		    (const struct ccat_dma_frame *)cap->tx_clean;
+		const u64 timestamp = fifo->ops->timestamp(cap->tx_clean);
+
+		if (!timestamp) {
+			break;
+		}
+		ccat_eth_capture(priv, frame->data,
+				 le16_to_cpu(frame->hdr.length), timestamp,
+				 PCAPNG_EPB_OUTBOUND);
+		if (++cap->tx_clean > fifo->end) {
+			cap->tx_clean = fifo->mem.start;
+		}
+	}
+}
+
+/**
+ * ccat_eth_queue_skb() - copy a frame into the TX fifo and free it
+ *
+ * The caller has to ensure the TX fifo is ready.
+ */
+static void ccat_eth_queue_skb(struct ccat_eth_priv *const priv,
+			       struct sk_buff *skb)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+
+	if (ccat_eth_is_ecat(skb->data, skb->len)) {
+		ccat_eth_cycle_tx(priv, fifo->mem.next);
+		ccat_eth_redundancy_tx(priv, skb);
+	}
+
+	/* EIM has no TX timestamps, capture the frame as it is queued */
+	if (!fifo->ops->timestamp && READ_ONCE(priv->capture.ctrl)) {
+		ccat_eth_capture(priv, skb->data, skb->len,
+				 ccat_eth_systemtime_now(priv),
+				 PCAPNG_EPB_OUTBOUND);
+	}
+
+	/* prepare frame in DMA memory */
+	fifo->ops->queue.skb(fifo, skb);
+
+	/* update stats */
+	atomic64_add(skb->len, &fifo->bytes);
+
+	dev_kfree_skb_any(skb);
+
+	ccat_eth_fifo_inc(fifo);
+	/* stop queue if tx ring is full */
+	if (!fifo->ops->ready(fifo)) {
+		priv->xstats.tx_ring_full++;
+		netif_stop_queue(priv->netdev);
+	}
+}
+
+/**
+ * ccat_eth_txtime_arm() - (re)arm the launch time timer for the queue head
+ *
+ * The CCAT systemtime is sampled each time the timer is armed. Launch
+ * times are only a few cycles ahead, so the drift of CLOCK_MONOTONIC
+ * against the CCAT systemtime is negligible. Caller holds txtime.lock.
+ */
+static void ccat_eth_txtime_arm(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+	const struct sk_buff *const head = skb_peek(&txtime->queue);
+	void __iomem *const systemtime = priv->func->ccat->systemtime;
+	s64 delay;
+
+	if (!head) {
+		return;
+	}
+	delay = ktime_to_ns(head->tstamp) - READ_ONCE(txtime->lead_ns) -
+	    ccat_systemtime_read64(systemtime);
+	hrtimer_start(&txtime->timer, ktime_add_ns(ktime_get(), max(delay, 0LL)),
+		      HRTIMER_MODE_ABS);
+}
+
+/**
+ * ccat_eth_txtime_insert() - insert a frame sorted by launch time
+ * @limit: maximum queue length
+ *
+ * Return: 0 on success, -ENOSPC if the queue already holds @limit frames
+ */
+static int ccat_eth_txtime_insert(struct ccat_eth_priv *const priv,
+				  struct sk_buff *const skb, const size_t limit)
+{
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+	struct sk_buff *next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&txtime->lock, flags);
+	if (skb_queue_len(&txtime->queue) >= limit) {
+		spin_unlock_irqrestore(&txtime->lock, flags);
+		return -ENOSPC;
+	}
+
+	skb_queue_walk(&txtime->queue, next) {
+		if (ktime_before(skb->tstamp, next->tstamp)) {
+			break;
+		}
+	}
+	/* without a later frame next is the list head -> append at the tail */
+	__skb_queue_before(&txtime->queue, next, skb);
+	if (skb_peek(&txtime->queue) == skb) {
+		ccat_eth_txtime_arm(priv);
+	}
+	spin_unlock_irqrestore(&txtime->lock, flags);
+	return 0;
+}
+
+/**
+ * ccat_eth_has_txtime() - check for a launch time requested with SO_TXTIME
+ *
+ * Only sockets with SO_TXTIME and clockid CLOCK_TAI provide a CCAT
+ * systemtime launch time. Other timestamps, like the departure times
+ * of TCP in CLOCK_MONOTONIC, are ignored.
+ */
+static bool ccat_eth_has_txtime(const struct sk_buff *const skb)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0))
+	const struct sock *const sk = skb->sk;
+
+	return skb->tstamp && sk && sk_fullsock(sk)
+	    && sock_flag(sk, SOCK_TXTIME) && CLOCK_TAI == sk->sk_clockid;
+#else
+	return false;
+#endif
+}
+
+/**
+ * ccat_eth_txtime_enqueue() - hold back a frame until its launch time
+ *
+ * With txtime enabled, skb->tstamp (SO_TXTIME) is the CCAT systemtime the
+ * frame should leave CCAT. Frames without launch time bypass the queue.
+ *
+ * Return: true if the skb was consumed
+ */
+static bool ccat_eth_txtime_enqueue(struct ccat_eth_priv *const priv,
+				    struct sk_buff *const skb)
+{
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+
+	if (!READ_ONCE(txtime->enabled) || !ccat_eth_has_txtime(skb)) {
+		return false;
+	}
+
+	/* gated frames can't use up the space reserved for launch times */
+	if (ccat_eth_txtime_insert(priv, skb,
+				   TXTIME_QUEUE_LEN + GATE_QUEUE_LEN)) {
+		txtime->overflow++;
+		atomic64_inc(&priv->tx_fifo.dropped);
+		dev_kfree_skb_any(skb);
+	}
+	return true;
+}
+
+/**
+ * ccat_eth_gate_open_at() - CCAT systemtime a frame may be sent at
+ * @now: current CCAT systemtime
+ * @len: frame length, the frame has to be on the wire before the gate closes
+ *
+ * The gate is closed from gate_guard_ns before until gate_hold_ns after
+ * the send time of the cyclic frame. The schedule is anchored to the
+ * CCAT systemtime the last cyclic frame was queued at.
+ *
+ * Return: @now if the gate is open, the time it opens again otherwise
+ */
+static u64 ccat_eth_gate_open_at(const struct ccat_eth_priv *const priv,
+				 const u64 now, const size_t len)
+{
+	const struct ccat_eth_gate *const gate = &priv->gate;
+	const s64 closed = (s64) READ_ONCE(gate->guard_ns) +
+	    READ_ONCE(gate->hold_ns);
+	const s64 wire = (max_t(size_t, len, ETH_ZLEN) + WIRE_OVERHEAD) *
+	    WIRE_NS_PER_BYTE;
+	const u64 anchor = READ_ONCE(gate->anchor);
+	s64 period = READ_ONCE(priv->cycle.cycle_ns);
+	s32 phase;
+
+	if (!period && READ_ONCE(priv->cycle.locked) >= CYCLE_LOCK_COUNT) {
+		period = READ_ONCE(priv->cycle.learned_cycle_ns);
+	}
+	if (!period || period > CYCLE_MAX_NS || !anchor || closed >= period) {
+		return now;
+	}
+
+	/* phase 0 is the start of the guard window */
+	div_s64_rem(now - (anchor - READ_ONCE(gate->guard_ns)), period, &phase);
+	if (phase < 0) {
+		phase += period;
+	}
+
+	if (phase < closed) {
+		return now + closed - phase;
+	}
+	if (wire > period - phase) {
+		return now + period - phase + closed;
+	}
+	return now;
+}
+
+/**
+ * ccat_eth_gate_hold() - hold back best-effort frames while the gate is closed
+ *
+ * Held frames get the gate opening as launch time and are released by
+ * the launch time queue. EtherCAT frames always pass. If the hold queue
+ * is full the frame is dropped, returning NETDEV_TX_BUSY would only make
+ * the stack retry it on every poll while the queue is still full.
+ *
+ * Return: true if the skb was consumed, false if it may be sent right away
+ */
+static bool ccat_eth_gate_hold(struct ccat_eth_priv *const priv,
+			       struct sk_buff *const skb)
+{
+	struct ccat_eth_gate *const gate = &priv->gate;
+	u64 now, open;
+
+	if (!READ_ONCE(gate->guard_ns) && !READ_ONCE(gate->hold_ns)) {
+		return false;
+	}
+	if (ccat_eth_is_ecat(skb->data, skb->len)
+	    || !priv->func->ccat->systemtime) {
+		return false;
+	}
+
+	now = ccat_systemtime_read64(priv->func->ccat->systemtime);
+	open = ccat_eth_gate_open_at(priv, now, skb->len);
+	if (open == now) {
+		return false;
+	}
+
+	skb->tstamp = ns_to_ktime(open);
+	if (ccat_eth_txtime_insert(priv, skb, GATE_QUEUE_LEN)) {
+		gate->dropped++;
+		atomic64_inc(&priv->tx_fifo.dropped);
+		dev_kfree_skb_any(skb);
+		return true;
+	}
+	gate->held++;
+	return true;
+}
+
+/**
+ * ccat_eth_txtime_release() - move due frames into the TX fifo
+ *
+ * Called from the launch time timer and the poll loop (TX fifo was full).
+ *
+ * Return: false if the TX queue was busy and release has to be retried
+ */
+static bool ccat_eth_txtime_release(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+	struct netdev_queue *const txq = netdev_get_tx_queue(priv->netdev, 0);
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	void __iomem *const systemtime = priv->func->ccat->systemtime;
+	unsigned long flags;
+
+	if (!__netif_tx_trylock(txq)) {
+		return false;
+	}
+
+	spin_lock_irqsave(&txtime->lock, flags);
+	while (fifo->ops->ready(fifo)) {
+		struct sk_buff *const skb = skb_peek(&txtime->queue);
+		const u64 now = ccat_systemtime_read64(systemtime);
+		s64 late;
+
+		if (!skb) {
+			break;
+		}
+		late = now + READ_ONCE(txtime->lead_ns) - ktime_to_ns(skb->tstamp);
+		if (late < 0) {
+			break;
+		}
+
+		__skb_unlink(skb, &txtime->queue);
+		txtime->released++;
+		if (late > READ_ONCE(txtime->lead_ns)) {
+			txtime->late++;
+			txtime->late_sum_ns += late;
+			txtime->late_max_ns = max_t(u64, txtime->late_max_ns, late);
+		}
+		ccat_eth_queue_skb(priv, skb);
+	}
+	/* with a full TX fifo the poll loop continues the release */
+	if (fifo->ops->ready(fifo)) {
+		ccat_eth_txtime_arm(priv);
+	}
+	spin_unlock_irqrestore(&txtime->lock, flags);
+	__netif_tx_unlock(txq);
+	return true;
+}
+
+static enum hrtimer_restart ccat_eth_txtime_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(timer, struct ccat_eth_priv, txtime.timer);
+
+	if (ccat_eth_txtime_release(priv)) {
+		return HRTIMER_NORESTART;
+	}
+	hrtimer_forward_now(timer, ns_to_ktime(TXTIME_RETRY_NS));
+	return HRTIMER_RESTART;
+}
+
+static void ccat_eth_txtime_flush(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+	unsigned long flags;
+
+	hrtimer_cancel(&txtime->timer);
+	spin_lock_irqsave(&txtime->lock, flags);
+	__skb_queue_purge(&txtime->queue);
+	spin_unlock_irqrestore(&txtime->lock, flags);
+}
+
+static netdev_tx_t ccat_eth_start_xmit(struct sk_buff *skb,
+				       struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+
+	if (skb_is_nonlinear(skb)) {
+		pr_warn("Non linear skb not supported -> drop frame.\n");
+		priv->xstats.tx_nonlinear++;
+		atomic64_inc(&fifo->dropped);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+
+	if (skb->len > MAX_PAYLOAD_SIZE) {
+		pr_warn("skb.len %llu exceeds dma buffer %llu -> drop frame.\n",
+			(u64) skb->len, (u64) MAX_PAYLOAD_SIZE);
+		atomic64_inc(&fifo->dropped);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+
+	if (ccat_eth_txtime_enqueue(priv, skb)) {
+		return NETDEV_TX_OK;
+	}
+
+	if (ccat_eth_gate_hold(priv, skb)) {
+		return NETDEV_TX_OK;
+	}
+
+	if (!fifo->ops->ready(fifo)) {
+		netdev_err(dev, "BUG! Tx Ring full when queue awake!\n");
+		netif_stop_queue(priv->netdev);
+		return NETDEV_TX_BUSY;
+	}
+
+	ccat_eth_queue_skb(priv, skb);
+	return NETDEV_TX_OK;
+}
+
+/**
+ * Function to transmit a raw buffer to the network (f.e. frameForwardEthernetFrames)
+ * @dev a valid net_device
+ * @data pointer to your raw buffer
+ * @len number of bytes in the raw buffer to transmit
+ */
+static void ccat_eth_xmit_raw(struct net_device *dev, const char *const data,
+			      size_t len)
+{
+	struct sk_buff *skb = dev_alloc_skb(len);
+
+	skb->dev = dev;
+	skb_copy_to_linear_data(skb, data, len);
+	skb_put(skb, len);
+	ccat_eth_start_xmit(skb, dev);
+}
+
+/**
+ * ccat_eth_template_xmit() - transmit a TX template with one descriptor write
+ * @slot: index of the template slot
+ * @len: number of bytes to transmit from the template
+ *
+ * The slot is checked and queued under the TX lock, which serializes with
+ * ccat_eth_start_xmit() and other template senders. Must not be called from
+ * hard interrupt context.
+ *
+ * Return: 0 on success, -EBUSY if the last transmission of this slot is
+ * still pending
+ */
+static int ccat_eth_template_xmit(struct ccat_eth_priv *const priv,
+				  unsigned int slot, size_t len)
+{
+	struct ccat_eth_templates *const templates = &priv->templates;
+	struct ccat_dma_frame *frame;
+
+	if (slot >= templates->count || !len || len > MAX_PAYLOAD_SIZE) {
+		return -EINVAL;
+	}
+
+	frame = &templates->slots[slot];
+	netif_tx_lock_bh(priv->netdev);
+	if (!netif_carrier_ok(priv->netdev)) {
+		netif_tx_unlock_bh(priv->netdev);
+		return -ENETDOWN;
+	}
+	if (!(le32_to_cpu(READ_ONCE(frame->hdr.tx_flags)) & CCAT_FRAME_SENT)) {
+		netif_tx_unlock_bh(priv->netdev);
+		return -EBUSY;
+	}
+
+	if (ccat_eth_is_ecat(frame->data, len)) {
+		ccat_eth_cycle_tx(priv, (struct ccat_eth_frame *)frame);
+	}
+	fifo_dma_queue_frame(&priv->tx_fifo, frame, len);
+	atomic64_add(len, &priv->tx_fifo.bytes);
+	netif_tx_unlock_bh(priv->netdev);
+
+	/* templates are outside the TX ring, ccat_eth_capture_tx() misses them */
+	if (READ_ONCE(priv->capture.ctrl)) {
+		ccat_eth_capture(priv, frame->data, len,
+				 ccat_eth_systemtime_now(priv),
+				 PCAPNG_EPB_OUTBOUND);
+	}
+	return 0;
+}
+
+/**
+ * ccat_eth_template_get() - get the frame buffer of a TX template
+ * @dev: a CCAT net_device
+ * @slot: index of the template slot
+ * @max_length: if not NULL, receives the size of the frame buffer
+ *
+ * Return: the frame buffer or NULL, if @slot doesn't exist on @dev
+ */
+void *ccat_eth_template_get(struct net_device *dev, unsigned int slot,
+			    size_t *max_length)
+{
+	struct ccat_eth_priv *priv;
+
+	if (!ccat_eth_is_ccat(dev)) {
+		return NULL;
+	}
+	priv = netdev_priv(dev);
+	if (slot >= priv->templates.count) {
+		return NULL;
+	}
+	if (max_length) {
+		*max_length = MAX_PAYLOAD_SIZE;
+	}
+	return priv->templates.slots[slot].data;
+}
+
+EXPORT_SYMBOL(ccat_eth_template_get);
+
+/**
+ * ccat_eth_template_send() - transmit a TX template
+ * @dev: a CCAT net_device
+ * @slot: index of the template slot
+ * @length: number of bytes to transmit from the template
+ *
+ * Takes the TX lock of @dev, so it may be called from process and softirq
+ * context (f.e. an hrtimer in HRTIMER_MODE_SOFT), but not from hard IRQs.
+ */
+int ccat_eth_template_send(struct net_device *dev, unsigned int slot,
+			   size_t length)
+{
+	if (!ccat_eth_is_ccat(dev)) {
+		return -ENODEV;
+	}
+	return ccat_eth_template_xmit(netdev_priv(dev), slot, length);
+}
+
+EXPORT_SYMBOL(ccat_eth_template_send);
+
+static void ccat_eth_receive(struct ccat_eth_priv *const priv, const size_t len)
+{
+	struct sk_buff *const skb = dev_alloc_skb(len + NET_IP_ALIGN);
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	struct net_device *const dev = priv->netdev;
+
+	if (!skb) {
+		pr_info("%s() out of memory :-(\n", __FUNCTION__);
+		priv->xstats.rx_alloc_failed++;
+		atomic64_inc(&fifo->dropped);
+		return;
+	}
+	skb->dev = dev;
+	skb_reserve(skb, NET_IP_ALIGN);
+	fifo->ops->queue.copy_to_buf(fifo, skb->data, len);
+	skb_put(skb, len);
+	skb->protocol = eth_type_trans(skb, dev);
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	atomic64_add(len, &fifo->bytes);
+	if (skb->protocol == htons(ETH_P_ETHERCAT)) {
+		ccat_eth_cycle_rx(priv, fifo->mem.next);
+		if (ccat_eth_redundancy_rx(priv, skb)) {
+			return;
+		}
+	}
+	netif_rx(skb);
+}
+
+static void ccat_eth_link_down(struct net_device *const dev)
+{
+	netif_stop_queue(dev);
+	netif_carrier_off(dev);
+	netdev_info(dev, "NIC Link is Down\n");
+}
+
+static void ccat_eth_link_up(struct net_device *const dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	netdev_info(dev, "NIC Link is Up\n");
 	/* TODO netdev_info(dev, "NIC Link is Up %u Mbps %s Duplex\n",
 	   speed == SPEED_100 ? 100 : 10,
 	   cmd.duplex == DUPLEX_FULL ? "Full" : "Half"); */
 
-	ccat_eth_fifo_reset(&priv->rx_fifo);
-	ccat_eth_fifo_reset(&priv->tx_fifo);
+	ccat_eth_fifo_reset(&priv->rx_fifo);
+	ccat_eth_fifo_reset(&priv->tx_fifo);
+	ccat_eth_templates_reset(&priv->templates);
+	priv->capture.tx_clean = priv->tx_fifo.mem.next;
+
+	/* TODO reset CCAT MAC register */
+
+	ccat_eth_xmit_raw(dev, frameForwardEthernetFrames,
+			  sizeof(frameForwardEthernetFrames));
+	netif_carrier_on(dev);
+	netif_start_queue(dev);
+}
+
+/**
+ * Read link state from CCAT hardware
+ * @return 1 if link is up, 0 if not
+ */
+inline static size_t ccat_eth_priv_read_link_state(struct ccat_eth_priv
+						   *const priv)
+{
+	priv->xstats.mmio_reads++;
+	return ! !(ccat_ioread32(priv->reg.mii + 0x8 + 4) & (1 << 24));
+}
+
+/**
+ * Poll for link state changes
+ */
+static void poll_link(struct ccat_eth_priv *const priv)
+{
+	const size_t link = ccat_eth_priv_read_link_state(priv);
+
+	if (link != netif_carrier_ok(priv->netdev)) {
+		if (link)
+			ccat_eth_link_up(priv->netdev);
+		else
+			ccat_eth_link_down(priv->netdev);
+	}
+}
+
+/**
+ * Poll for available rx dma descriptors in ethernet operating mode
+ */
+/**
+ * ccat_eth_steer_rx() - copy a non-EtherCAT frame for the steering CPU
+ *
+ * Only the Ethernet header is read to classify the frame, EtherCAT
+ * frames are left to ccat_eth_receive() on the polling CPU.
+ *
+ * Return: true if the frame was steered (or dropped)
+ */
+static bool ccat_eth_steer_rx(struct ccat_eth_priv *const priv,
+			      const size_t len)
+{
+	struct ccat_eth_steer *const steer = &priv->steer;
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	const unsigned int head = steer->head;
+	u8 hdr[ETH_HLEN];
+	u8 *slot;
+
+	if (len < ETH_HLEN || len > STEER_SLOT_SIZE) {
+		return false;
+	}
+
+	/* with a full ring the slot is still being copied by the worker */
+	fifo->ops->queue.copy_to_buf(fifo, hdr, ETH_HLEN);
+	if (ccat_eth_is_ecat(hdr, len)) {
+		return false;
+	}
+
+	if (head - smp_load_acquire(&steer->tail) >= STEER_RING_LEN) {
+		steer->dropped++;
+		atomic64_inc(&fifo->dropped);
+		return true;
+	}
+	slot = steer->ring + (head % STEER_RING_LEN) * STEER_SLOT_SIZE;
+	fifo->ops->queue.copy_to_buf(fifo, slot, len);
+	steer->len[head % STEER_RING_LEN] = len;
+	atomic64_add(len, &fifo->bytes);
+	smp_store_release(&steer->head, head + 1);
+	return true;
+}
+
+static void ccat_eth_steer_work(struct work_struct *work)
+{
+	struct ccat_eth_steer *const steer =
+	    container_of(work, struct ccat_eth_steer, work);
+	struct ccat_eth_priv *const priv =
+	    container_of(steer, struct ccat_eth_priv, steer);
+	struct net_device *const dev = priv->netdev;
+	const unsigned int head = smp_load_acquire(&steer->head);
+	unsigned int tail = steer->tail;
+	LIST_HEAD(list);
+
+	for (; tail != head; ++tail) {
+		const size_t len = steer->len[tail % STEER_RING_LEN];
+		struct sk_buff *const skb = netdev_alloc_skb_ip_align(dev, len);
+
+		if (!skb) {
+			priv->xstats.rx_alloc_failed++;
+			atomic64_inc(&priv->rx_fifo.dropped);
+			continue;
+		}
+		skb_put_data(skb,
+			     steer->ring + (tail % STEER_RING_LEN) *
+			     STEER_SLOT_SIZE, len);
+		skb->protocol = eth_type_trans(skb, dev);
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+		list_add_tail(&skb->list, &list);
+		steer->steered++;
+	}
+	smp_store_release(&steer->tail, tail);
+
+	local_bh_disable();
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,19,0))
+	while (!list_empty(&list)) {
+		struct sk_buff *const skb =
+		    list_first_entry(&list, struct sk_buff, list);
+
+		list_del(&skb->list);
+		netif_receive_skb(skb);
+	}
+#else
+	netif_receive_skb_list(&list);
+#endif
+	local_bh_enable();
+}
+
+/**
+ * ccat_eth_steer_set() - enable RX steering to @cpu, -1 to disable it
+ *
+ * Caller has to hold the rtnl lock.
+ */
+static int ccat_eth_steer_set(struct ccat_eth_priv *const priv, int cpu)
+{
+	struct ccat_eth_steer *const steer = &priv->steer;
+
+	if (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_online(cpu))) {
+		return -EINVAL;
+	}
+
+	if (steer->cpu >= 0) {
+		WRITE_ONCE(steer->cpu, -1);
+		/* wait for the poll loop, then drain the ring */
+		synchronize_net();
+		flush_work(&steer->work);
+		ccat_eth_steer_work(&steer->work);
+		vfree(steer->ring);
+		steer->ring = NULL;
+	}
+
+	if (cpu >= 0) {
+		steer->ring = vmalloc(STEER_RING_LEN * STEER_SLOT_SIZE);
+		if (!steer->ring) {
+			return -ENOMEM;
+		}
+		steer->head = 0;
+		steer->tail = 0;
+		WRITE_ONCE(steer->cpu, cpu);
+	}
+	return 0;
+}
+
+/**
+ * ccat_eth_selftest_fill() - build self test frame @seq
+ *
+ * A single EtherCAT NOP datagram, which EtherCAT slaves forward without
+ * modification. The datagram address carries @seq, the payload a pattern
+ * derived from @seq.
+ */
+static void ccat_eth_selftest_fill(u8 * frame, const u8 * src, u32 seq)
+{
+	struct ethhdr *const eth = (struct ethhdr *)frame;
+	u8 *const dgram = frame + ETH_HLEN + ECAT_HDR_LEN;
+	u8 *const payload = frame + SELFTEST_DATA_OFFSET;
+	size_t i;
+
+	eth_broadcast_addr(eth->h_dest);
+	ether_addr_copy(eth->h_source, src);
+	eth->h_proto = htons(ETH_P_ETHERCAT);
+	put_unaligned_le16((ETH_FRAME_LEN - ETH_HLEN - ECAT_HDR_LEN) | 0x1000,
+			   frame + ETH_HLEN);
+
+	dgram[0] = 0;		/* NOP */
+	dgram[1] = SELFTEST_IDX;
+	put_unaligned_le32(seq, dgram + 2);
+	put_unaligned_le16(SELFTEST_DATA_LEN, dgram + 6);
+	put_unaligned_le16(0, dgram + 8);
+	for (i = 0; i < SELFTEST_DATA_LEN; ++i) {
+		payload[i] = (u8) (seq + i);
+	}
+	put_unaligned_le16(0, payload + SELFTEST_DATA_LEN);
+}
+
+/**
+ * ccat_eth_selftest_rx() - consume a returning self test frame
+ *
+ * The round trip time is taken from the CCAT timestamps, if available.
+ *
+ * Return: true if the frame belonged to the self test
+ */
+static bool ccat_eth_selftest_rx(struct ccat_eth_priv *const priv,
+				 struct ccat_eth_selftest *const st,
+				 const size_t len)
+{
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	const struct ccat_eth_fifo *const tx_fifo = &priv->tx_fifo;
+	const u8 *const dgram = st->rx_buf + ETH_HLEN + ECAT_HDR_LEN;
+	const u8 *const payload = st->rx_buf + SELFTEST_DATA_OFFSET;
+	struct ccat_eth_selftest_frame *f;
+	u64 tx_ts, rx_ts, rtt;
+	size_t i;
+	u32 seq;
+
+	if (len < ETH_FRAME_LEN) {
+		return false;
+	}
+	fifo->ops->queue.copy_to_buf(fifo, st->rx_buf, ETH_FRAME_LEN);
+	if (!ccat_eth_is_ecat(st->rx_buf, len) || dgram[0]
+	    || dgram[1] != SELFTEST_IDX) {
+		return false;
+	}
+
+	/* late or duplicated frames are consumed, but not counted */
+	seq = get_unaligned_le32(dgram + 2);
+	f = &st->frames[seq % SELFTEST_WINDOW];
+	if (!smp_load_acquire(&f->pending) || f->seq != seq
+	    || !xchg(&f->pending, 0)) {
+		return true;
+	}
+
+	for (i = 0; i < SELFTEST_DATA_LEN; ++i) {
+		if (payload[i] != (u8) (seq + i)) {
+			st->corrupt++;
+			goto done;
+		}
+	}
+
+	tx_ts = tx_fifo->ops->timestamp ? tx_fifo->ops->timestamp(f->slot)
+	    : f->tx_ts;
+	rx_ts = fifo->ops->timestamp(fifo->mem.next);
+	if (tx_ts && rx_ts > tx_ts) {
+		rtt = rx_ts - tx_ts;
+	} else {
+		rtt = ktime_to_ns(ktime_sub(ktime_get(), f->sent));
+	}
+	st->rtt_min_ns = min(st->rtt_min_ns, rtt);
+	st->rtt_max_ns = max(st->rtt_max_ns, rtt);
+	st->rtt_sum_ns += rtt;
+	st->received++;
+done:
+	st->last_rx = ktime_get();
+	wake_up(&st->wait);
+	return true;
+}
+
+static size_t poll_rx(struct ccat_eth_priv *const priv, const size_t budget)
+{
+	struct ccat_eth_selftest *const selftest = READ_ONCE(priv->selftest);
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	struct ccat_eth_steer *const steer = &priv->steer;
+	const int steer_cpu = READ_ONCE(steer->cpu);
+	const unsigned int steer_head = steer->head;
+	size_t len = fifo->ops->ready(fifo);
+	size_t received = 0;
+
+	while (len && received < budget) {
+		if (READ_ONCE(priv->capture.ctrl)) {
+			ccat_eth_capture(priv, NULL, len,
+					 fifo->ops->timestamp(fifo->mem.next),
+					 PCAPNG_EPB_INBOUND);
+		}
+		if (!selftest || !ccat_eth_selftest_rx(priv, selftest, len)) {
+			if (steer_cpu < 0 || !ccat_eth_steer_rx(priv, len)) {
+				ccat_eth_receive(priv, len);
+			}
+		}
+		fifo->ops->add(fifo);
+		ccat_eth_fifo_inc(fifo);
+		++received;
+		len = fifo->ops->ready(fifo);
+	}
+
+	if (steer->head != steer_head) {
+		queue_work_on(steer_cpu, system_highpri_wq, &steer->work);
+	}
+	return received;
+}
+
+/**
+ * Poll for available tx dma descriptors in ethernet operating mode
+ */
+static void poll_tx(struct ccat_eth_priv *const priv)
+{
+	if (priv->tx_fifo.ops->timestamp && READ_ONCE(priv->capture.ctrl)) {
+		ccat_eth_capture_tx(priv);
+	}
+	/* the stack stays stopped during a self test */
+	if (!READ_ONCE(priv->selftest)
+	    && priv->tx_fifo.ops->ready(&priv->tx_fifo)) {
+		netif_wake_queue(priv->netdev);
+	}
+}
+
+static inline void ccat_eth_hist_add(u64 * hist, u64 value)
+{
+	hist[min(fls64(value), POLL_HIST_BUCKETS - 1)]++;
+}
+
+/**
+ * Since CCAT doesn't support interrupts until now, we have to poll
+ * some status bits to recognize things like link change etc.
+ * @due: time this poll was scheduled for
+ *
+ * Return: time the port should be polled next
+ */
+static ktime_t ccat_eth_poll(struct ccat_eth_priv *const priv, ktime_t due)
+{
+	struct ccat_eth_poll_stats *const stats = &priv->poll_stats;
+	struct ccat_eth_poll_hist *const hist = &priv->poll_hist;
+	const size_t budget = max(READ_ONCE(poll_budget), 1U);
+	const ktime_t start = ktime_get();
+	size_t received;
+	ktime_t end;
+	u64 duration;
+
+	ccat_eth_hist_add(hist->lateness_ns,
+			  max_t(s64, ktime_to_ns(ktime_sub(start, due)), 0));
+
+	poll_link(priv);
+	received = poll_rx(priv, budget);
+	poll_tx(priv);
+	ccat_eth_redundancy_flush(priv, start);
+	if (!skb_queue_empty(&priv->txtime.queue)) {
+		ccat_eth_txtime_release(priv);
+	}
+
+	end = ktime_get();
+	duration = ktime_to_ns(ktime_sub(end, start));
+	stats->polls++;
+	stats->time_ns += duration;
+	stats->max_ns = max(stats->max_ns, duration);
+	ccat_eth_hist_add(hist->duration_ns, duration);
+	ccat_eth_hist_add(hist->frames, received);
+	if (received) {
+		stats->rx_polls++;
+		stats->rx_frames += received;
+		stats->rx_frames_max = max_t(u64, stats->rx_frames_max,
+					     received);
+	}
+
+	/* frames are left in the RX ring -> continue right after the others */
+	if (received == budget) {
+		stats->budget_exhausted++;
+		return ktime_add_ns(end, NSEC_PER_USEC);
+	}
+	return ccat_eth_next_poll(priv, end);
+}
+
+static enum hrtimer_restart poll_timer_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(timer, struct ccat_eth_priv, poll_timer);
+
+	hrtimer_set_expires(timer, ccat_eth_poll(priv,
+						 hrtimer_get_expires(timer)));
+	return HRTIMER_RESTART;
+}
+
+/**
+ * ccat_eth_poller_callback() - service all due ports in one timer run
+ *
+ * Each port is polled with its own budget and schedule, the timer expires
+ * when the earliest port is due next. The list is rotated each run, so a
+ * busy port can't starve the ports following it.
+ */
+static enum hrtimer_restart ccat_eth_poller_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *priv;
+	ktime_t next = KTIME_MAX;
+
+	spin_lock(&poller.lock);
+	list_for_each_entry(priv, &poller.ports, poll_list) {
+		if (ktime_compare(ktime_get(), priv->poll_next) >= 0) {
+			priv->poll_next = ccat_eth_poll(priv, priv->poll_next);
+		}
+		if (ktime_compare(priv->poll_next, next) < 0) {
+			next = priv->poll_next;
+		}
+	}
+	if (!list_empty(&poller.ports)) {
+		list_rotate_left(&poller.ports);
+	}
+	spin_unlock(&poller.lock);
+
+	if (next == KTIME_MAX) {
+		return HRTIMER_NORESTART;
+	}
+	hrtimer_set_expires(timer, next);
+	return HRTIMER_RESTART;
+}
+
+static void ccat_eth_poller_kick(void *unused)
+{
+	hrtimer_start(&poller.timer, ktime_get(), HRTIMER_MODE_ABS_PINNED);
+}
+
+static bool ccat_eth_poller_add(struct ccat_eth_priv *const priv)
+{
+	unsigned long flags;
+
+	if (poll_cpu < 0) {
+		return false;
+	}
+	if (poll_cpu >= nr_cpu_ids || !cpu_online(poll_cpu)) {
+		netdev_warn(priv->netdev,
+			    "poll_cpu %d is offline, using a timer per port\n",
+			    poll_cpu);
+		return false;
+	}
+
+	priv->poll_next = ktime_get();
+	spin_lock_irqsave(&poller.lock, flags);
+	list_add_tail(&priv->poll_list, &poller.ports);
+	spin_unlock_irqrestore(&poller.lock, flags);
+
+	/* pinned hrtimers are queued on the CPU calling hrtimer_start() */
+	smp_call_function_single(poll_cpu, ccat_eth_poller_kick, NULL, 1);
+	return true;
+}
+
+static void ccat_eth_poller_del(struct ccat_eth_priv *const priv)
+{
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&poller.lock, flags);
+	list_del(&priv->poll_list);
+	empty = list_empty(&poller.ports);
+	spin_unlock_irqrestore(&poller.lock, flags);
+
+	if (empty) {
+		hrtimer_cancel(&poller.timer);
+	}
+}
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
+static struct rtnl_link_stats64 *ccat_eth_get_stats64(struct net_device *dev, struct rtnl_link_stats64
+						      *storage)
+#else
+static void ccat_eth_get_stats64(struct net_device *dev,
+				 struct rtnl_link_stats64 *storage)
+#endif
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_mac_register mac;
+
+	ccat_memcpy_fromio(&mac, priv->reg.mac, sizeof(mac));
+	storage->rx_packets = mac.rx_frames;	/* total packets received       */
+	storage->tx_packets = mac.tx_frames;	/* total packets transmitted    */
+	storage->rx_bytes = atomic64_read(&priv->rx_fifo.bytes);	/* total bytes received         */
+	storage->tx_bytes = atomic64_read(&priv->tx_fifo.bytes);	/* total bytes transmitted      */
+	storage->rx_errors = mac.frame_len_err + mac.rx_mem_full + mac.crc_err + mac.rx_err;	/* bad packets received         */
+	storage->tx_errors = mac.tx_mem_full;	/* packet transmit problems     */
+	storage->rx_dropped = atomic64_read(&priv->rx_fifo.dropped);	/* no space in linux buffers    */
+	storage->tx_dropped = atomic64_read(&priv->tx_fifo.dropped);	/* no space available in linux  */
+	//TODO __u64    multicast;              /* multicast packets received   */
+	//TODO __u64    collisions;
+
+	/* detailed rx_errors: */
+	storage->rx_length_errors = mac.frame_len_err;
+	storage->rx_over_errors = mac.rx_mem_full;	/* receiver ring buff overflow  */
+	storage->rx_crc_errors = mac.crc_err;	/* recved pkt with crc error    */
+	storage->rx_frame_errors = mac.rx_err;	/* recv'd frame alignment error */
+	storage->rx_fifo_errors = mac.rx_mem_full;	/* recv'r fifo overrun          */
+	//TODO __u64    rx_missed_errors;       /* receiver missed packet       */
+
+	/* detailed tx_errors */
+	//TODO __u64    tx_aborted_errors;
+	//TODO __u64    tx_carrier_errors;
+	//TODO __u64    tx_fifo_errors;
+	//TODO __u64    tx_heartbeat_errors;
+	//TODO __u64    tx_window_errors;
+
+	/* for cslip etc */
+	//TODO __u64    rx_compressed;
+	//TODO __u64    tx_compressed;
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
+	return storage;
+#endif
+}
+
+static int ccat_eth_open(struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	priv->poll_shared = ccat_eth_poller_add(priv);
+	if (priv->poll_shared) {
+		return 0;
+	}
+
+	hrtimer_init(&priv->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->poll_timer.function = poll_timer_callback;
+	hrtimer_start(&priv->poll_timer, POLL_TIME, HRTIMER_MODE_REL);
+	return 0;
+}
+
+static int ccat_eth_stop(struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	netif_stop_queue(dev);
+	ccat_eth_txtime_flush(priv);
+	if (priv->poll_shared) {
+		ccat_eth_poller_del(priv);
+	} else {
+		hrtimer_cancel(&priv->poll_timer);
+	}
+	return 0;
+}
+
+#define CCAT_ETH_U32_ATTR(_name, _member)				\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	const struct ccat_eth_priv *const priv =			\
+	    netdev_priv(to_net_dev(dev));				\
+									\
+	return sprintf(buf, "%u\n", priv->_member);		\
+}									\
+									\
+static ssize_t _name##_store(struct device *dev,			\
+			     struct device_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));\
+	u32 value;							\
+	int err = kstrtou32(buf, 0, &value);				\
+									\
+	if (err) {							\
+		return err;						\
+	}								\
+	WRITE_ONCE(priv->_member, value);				\
+	return count;							\
+}									\
+static DEVICE_ATTR_RW(_name)
+
+CCAT_ETH_U32_ATTR(ecat_cycle_ns, cycle.cycle_ns);
+CCAT_ETH_U32_ATTR(ecat_rtt_ns, cycle.rtt_ns);
+CCAT_ETH_U32_ATTR(poll_dense_ns, cycle.dense_ns);
+CCAT_ETH_U32_ATTR(poll_sparse_ns, cycle.sparse_ns);
+CCAT_ETH_U32_ATTR(txtime_lead_ns, txtime.lead_ns);
+CCAT_ETH_U32_ATTR(gate_guard_ns, gate.guard_ns);
+CCAT_ETH_U32_ATTR(gate_hold_ns, gate.hold_ns);
+
+static ssize_t learned_cycle_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	const struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	const struct ccat_eth_cycle *const cycle = &priv->cycle;
+
+	return sprintf(buf, "%u %u %s\n", READ_ONCE(cycle->learned_cycle_ns),
+		       READ_ONCE(cycle->learned_rtt_ns),
+		       (READ_ONCE(cycle->locked) >= CYCLE_LOCK_COUNT) ?
+		       "locked" : "learning");
+}
+
+static DEVICE_ATTR_RO(learned_cycle);
+
+static ssize_t poll_stats_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	const struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	const struct ccat_eth_poll_stats stats = priv->poll_stats;
+
+	return sprintf(buf,
+		       "polls %llu time_ns %llu max_ns %llu budget_exhausted %llu %s\n",
+		       stats.polls, stats.time_ns, stats.max_ns,
+		       stats.budget_exhausted,
+		       priv->poll_shared ? "shared" : "private");
+}
+
+static DEVICE_ATTR_RO(poll_stats);
+
+static ssize_t redundancy_peer_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	const struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	ssize_t len = 0;
+
+	rtnl_lock();
+	if (priv->red) {
+		const struct ccat_eth_redundancy *const red = priv->red;
+
+		len = sprintf(buf, "%s %s merged %llu single %llu tx_busy %llu\n",
+			      (red->primary == priv) ?
+			      red->secondary->netdev->name :
+			      red->primary->netdev->name,
+			      (red->primary == priv) ? "primary" : "secondary",
+			      red->merged, red->single, red->tx_busy);
+	}
+	rtnl_unlock();
+	return len;
+}
+
+/**
+ * redundancy_peer_store() - pair with the given interface, empty to unpair
+ *
+ * The port the name is written to becomes the primary port.
+ */
+static ssize_t redundancy_peer_store(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	struct net_device *const netdev = to_net_dev(dev);
+	struct ccat_eth_priv *const priv = netdev_priv(netdev);
+	char name[IFNAMSIZ];
+	struct net_device *peer;
+	int err = 0;
+
+	if (sscanf(buf, "%15s", name) != 1) {
+		name[0] = '\0';
+	}
+
+	rtnl_lock();
+	if (!name[0]) {
+		ccat_eth_redundancy_unpair(priv);
+		goto unlock;
+	}
+
+	peer = __dev_get_by_name(dev_net(netdev), name);
+	if (!peer || !ccat_eth_is_ccat(peer)) {
+		err = -ENODEV;
+		goto unlock;
+	}
+	err = ccat_eth_redundancy_pair(priv, netdev_priv(peer));
+unlock:
+	rtnl_unlock();
+	return err ? err : count;
+}
+
+static DEVICE_ATTR_RW(redundancy_peer);
+
+static ssize_t txtime_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	struct ccat_eth_txtime *const txtime = &priv->txtime;
+	unsigned long flags;
+	ssize_t len;
+
+	spin_lock_irqsave(&txtime->lock, flags);
+	len = sprintf(buf,
+		      "%d released %llu late %llu late_max_ns %llu late_sum_ns %llu overflow %llu\n",
+		      txtime->enabled, txtime->released, txtime->late,
+		      txtime->late_max_ns, txtime->late_sum_ns,
+		      txtime->overflow);
+	spin_unlock_irqrestore(&txtime->lock, flags);
+	return len;
+}
+
+/**
+ * txtime_store() - 1: treat skb->tstamp as CCAT systemtime launch time
+ *
+ * Applies to sockets using SO_TXTIME with clockid CLOCK_TAI only.
+ */
+static ssize_t txtime_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	bool enable;
+	int err = kstrtobool(buf, &enable);
+
+	if (err) {
+		return err;
+	}
+	if (enable && !priv->func->ccat->systemtime) {
+		return -EOPNOTSUPP;
+	}
+	WRITE_ONCE(priv->txtime.enabled, enable);
+	return count;
+}
+
+static DEVICE_ATTR_RW(txtime);
+
+static ssize_t rx_steer_cpu_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	const struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	const struct ccat_eth_steer *const steer = &priv->steer;
+
+	return sprintf(buf, "%d steered %llu dropped %llu\n",
+		       READ_ONCE(steer->cpu), steer->steered, steer->dropped);
+}
+
+/**
+ * rx_steer_cpu_store() - CPU to process non-EtherCAT frames on, -1: inline
+ */
+static ssize_t rx_steer_cpu_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(to_net_dev(dev));
+	int cpu;
+	int err = kstrtoint(buf, 0, &cpu);
+
+	if (err) {
+		return err;
+	}
+	rtnl_lock();
+	err = ccat_eth_steer_set(priv, cpu < 0 ? -1 : cpu);
+	rtnl_unlock();
+	return err ? err : count;
+}
+
+static DEVICE_ATTR_RW(rx_steer_cpu);
+
+static struct attribute *ccat_eth_attrs[] = {
+	&dev_attr_ecat_cycle_ns.attr,
+	&dev_attr_ecat_rtt_ns.attr,
+	&dev_attr_poll_dense_ns.attr,
+	&dev_attr_poll_sparse_ns.attr,
+	&dev_attr_learned_cycle.attr,
+	&dev_attr_poll_stats.attr,
+	&dev_attr_redundancy_peer.attr,
+	&dev_attr_txtime.attr,
+	&dev_attr_txtime_lead_ns.attr,
+	&dev_attr_gate_guard_ns.attr,
+	&dev_attr_gate_hold_ns.attr,
+	&dev_attr_rx_steer_cpu.attr,
+	NULL
+};
+
+/**
+ * ccat_eth_attr_group - driver specific attributes in /sys/class/net/<if>/ccat
+ */
+static const struct attribute_group ccat_eth_attr_group = {
+	.name = "ccat",
+	.attrs = ccat_eth_attrs,
+};
+
+static const struct net_device_ops ccat_eth_netdev_ops = {
+	.ndo_get_stats64 = ccat_eth_get_stats64,
+	.ndo_open = ccat_eth_open,
+	.ndo_start_xmit = ccat_eth_start_xmit,
+	.ndo_stop = ccat_eth_stop,
+};
+
+static bool ccat_eth_is_ccat(const struct net_device *const dev)
+{
+	return dev->netdev_ops == &ccat_eth_netdev_ops;
+}
+
+enum {
+	CCAT_ETH_TEST_LINK,
+	CCAT_ETH_TEST_LOST,
+	CCAT_ETH_TEST_CORRUPT,
+	CCAT_ETH_TEST_FRAMES_PER_SEC,
+	CCAT_ETH_TEST_KBYTES_PER_SEC,
+	CCAT_ETH_TEST_RTT_MIN,
+	CCAT_ETH_TEST_RTT_AVG,
+	CCAT_ETH_TEST_RTT_MAX,
+};
+
+static const char ccat_eth_test_strings[][ETH_GSTRING_LEN] = {
+	"Link test         (on/offline)",
+	"Lost frames       (offline)",
+	"Corrupt frames    (offline)",
+	"Frames/s          (offline)",
+	"kB/s              (offline)",
+	"RTT min ns        (offline)",
+	"RTT avg ns        (offline)",
+	"RTT max ns        (offline)",
+};
+
+static bool ccat_eth_selftest_xmit(struct ccat_eth_priv *const priv,
+				   struct ccat_eth_selftest *const st,
+				   struct sk_buff *const skb, u32 seq)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	struct ccat_eth_selftest_frame *const f =
+	    &st->frames[seq % SELFTEST_WINDOW];
+	bool queued = false;
+
+	ccat_eth_selftest_fill(skb->data, priv->netdev->dev_addr, seq);
+	netif_tx_lock_bh(priv->netdev);
+	if (fifo->ops->ready(fifo)) {
+		f->seq = seq;
+		f->slot = fifo->mem.next;
+		f->tx_ts = ccat_eth_systemtime_now(priv);
+		f->sent = ktime_get();
+		smp_store_release(&f->pending, 1);
+		fifo->ops->queue.skb(fifo, skb);
+		atomic64_add(skb->len, &fifo->bytes);
+		ccat_eth_fifo_inc(fifo);
+		queued = true;
+	}
+	netif_tx_unlock_bh(priv->netdev);
+	return queued;
+}
+
+/**
+ * ccat_eth_selftest_run() - send SELFTEST_FRAMES through the TX ring
+ *
+ * The frames are sent with up to SELFTEST_WINDOW frames in flight and
+ * have to come back, f.e. through EtherCAT terminals in forwarding mode or
+ * a loopback plug. The stack is stopped meanwhile.
+ */
+static void ccat_eth_selftest_run(struct ccat_eth_priv *const priv,
+				  u64 * data)
+{
+	struct net_device *const dev = priv->netdev;
+	const long timeout = msecs_to_jiffies(SELFTEST_TIMEOUT_MS);
+	struct ccat_eth_selftest *st;
+	struct sk_buff *skb;
+	unsigned long deadline;
+	u64 lost = 0, duration;
+	ktime_t start;
+	u32 seq, i;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	skb = alloc_skb(ETH_FRAME_LEN, GFP_KERNEL);
+	if (!st || !skb) {
+		kfree(st);
+		kfree_skb(skb);
+		data[CCAT_ETH_TEST_LOST] = SELFTEST_FRAMES;
+		return;
+	}
+	skb_put(skb, ETH_FRAME_LEN);
+	init_waitqueue_head(&st->wait);
+	st->rtt_min_ns = U64_MAX;
+
+	netif_tx_disable(dev);
+	WRITE_ONCE(priv->selftest, st);
+	start = ktime_get();
+	for (seq = 0; seq < SELFTEST_FRAMES; ++seq) {
+		struct ccat_eth_selftest_frame *const f =
+		    &st->frames[seq % SELFTEST_WINDOW];
+
+		/* reuse the slot of the oldest frame in flight */
+		wait_event_timeout(st->wait, !READ_ONCE(f->pending), timeout);
+		if (xchg(&f->pending, 0)) {
+			++lost;
+		}
+
+		deadline = jiffies + timeout;
+		while (!ccat_eth_selftest_xmit(priv, st, skb, seq)) {
+			if (time_after(jiffies, deadline)) {
+				netdev_warn(dev, "self test: TX ring stuck\n");
+				goto flush;
+			}
+			usleep_range(50, 100);
+		}
+	}
+flush:
+	for (i = 0; i < SELFTEST_WINDOW; ++i) {
+		struct ccat_eth_selftest_frame *const f = &st->frames[i];
+
+		wait_event_timeout(st->wait, !READ_ONCE(f->pending), timeout);
+		if (xchg(&f->pending, 0)) {
+			++lost;
+		}
+	}
+	WRITE_ONCE(priv->selftest, NULL);
+	synchronize_net();
+	netif_wake_queue(dev);
+	kfree_skb(skb);
+
+	data[CCAT_ETH_TEST_LOST] = lost + SELFTEST_FRAMES - seq;
+	data[CCAT_ETH_TEST_CORRUPT] = st->corrupt;
+	duration = ktime_to_ns(ktime_sub(st->last_rx, start));
+	if (st->received && duration > 0) {
+		data[CCAT_ETH_TEST_FRAMES_PER_SEC] =
+		    div64_u64(st->received * NSEC_PER_SEC, duration);
+		data[CCAT_ETH_TEST_KBYTES_PER_SEC] =
+		    div64_u64(st->received * ETH_FRAME_LEN * USEC_PER_SEC,
+			      duration);
+		data[CCAT_ETH_TEST_RTT_MIN] = st->rtt_min_ns;
+		data[CCAT_ETH_TEST_RTT_AVG] =
+		    div64_u64(st->rtt_sum_ns, st->received);
+		data[CCAT_ETH_TEST_RTT_MAX] = st->rtt_max_ns;
+	}
+	kfree(st);
+}
+
+static void ccat_eth_self_test(struct net_device *dev,
+			       struct ethtool_test *test, u64 * data)
+{
+	memset(data, 0, sizeof(*data) * ARRAY_SIZE(ccat_eth_test_strings));
+	if (!netif_running(dev) || !netif_carrier_ok(dev)) {
+		data[CCAT_ETH_TEST_LINK] = 1;
+		test->flags |= ETH_TEST_FL_FAILED;
+		return;
+	}
+	if (!(test->flags & ETH_TEST_FL_OFFLINE)) {
+		return;
+	}
+
+	ccat_eth_selftest_run(netdev_priv(dev), data);
+	if (data[CCAT_ETH_TEST_LOST] || data[CCAT_ETH_TEST_CORRUPT]) {
+		test->flags |= ETH_TEST_FL_FAILED;
+	}
+}
+
+/**
+ * struct ccat_eth_stat - u64 counter of struct ccat_eth_priv for ethtool -S
+ */
+struct ccat_eth_stat {
+	char name[ETH_GSTRING_LEN];
+	size_t offset;
+};
 
-	/* TODO reset CCAT MAC register */
+#define CCAT_ETH_STAT(_name, _member) \
+	{ .name = _name, .offset = offsetof(struct ccat_eth_priv, _member) }
+
+static const struct ccat_eth_stat ccat_eth_stats[] = {
+	CCAT_ETH_STAT("polls", poll_stats.polls),
+	CCAT_ETH_STAT("poll_time_ns", poll_stats.time_ns),
+	CCAT_ETH_STAT("poll_max_ns", poll_stats.max_ns),
+	CCAT_ETH_STAT("poll_budget_exhausted", poll_stats.budget_exhausted),
+	CCAT_ETH_STAT("rx_polls", poll_stats.rx_polls),
+	CCAT_ETH_STAT("rx_poll_frames", poll_stats.rx_frames),
+	CCAT_ETH_STAT("rx_poll_frames_max", poll_stats.rx_frames_max),
+	CCAT_ETH_STAT("rx_alloc_failed", xstats.rx_alloc_failed),
+	CCAT_ETH_STAT("rx_steered", steer.steered),
+	CCAT_ETH_STAT("rx_steer_dropped", steer.dropped),
+	CCAT_ETH_STAT("tx_ring_full", xstats.tx_ring_full),
+	CCAT_ETH_STAT("tx_nonlinear", xstats.tx_nonlinear),
+	CCAT_ETH_STAT("tx_gate_held", gate.held),
+	CCAT_ETH_STAT("tx_gate_dropped", gate.dropped),
+	CCAT_ETH_STAT("txtime_released", txtime.released),
+	CCAT_ETH_STAT("txtime_late", txtime.late),
+	CCAT_ETH_STAT("txtime_late_max_ns", txtime.late_max_ns),
+	CCAT_ETH_STAT("txtime_overflow", txtime.overflow),
+};
 
-	ccat_eth_xmit_raw(dev, frameForwardEthernetFrames,
-			  sizeof(frameForwardEthernetFrames));
-	netif_carrier_on(dev);
-	netif_start_queue(dev);
+/* filled by ccat_eth_get_ethtool_stats() in exactly this order */
+static const char ccat_eth_fifo_mac_stats[][ETH_GSTRING_LEN] = {
+	"rx_fifo_bytes",
+	"rx_fifo_dropped",
+	"tx_fifo_bytes",
+	"tx_fifo_dropped",
+	"mac_frame_len_err",
+	"mac_rx_err",
+	"mac_crc_err",
+	"mac_link_lost_err",
+	"mac_rx_mem_full",
+	"mac_tx_frames",
+	"mac_rx_frames",
+	"mac_tx_fifo_level",
+	"mac_tx_mem_full",
+	"mac_mii_connected",
+};
+
+static void ccat_eth_get_ethtool_stats(struct net_device *dev,
+				       struct ethtool_stats *stats, u64 * data)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_mac_register mac;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(ccat_eth_stats); ++i) {
+		*data++ = *(const u64 *)((const u8 *)priv +
+					 ccat_eth_stats[i].offset);
+	}
+
+	*data++ = atomic64_read(&priv->rx_fifo.bytes);
+	*data++ = atomic64_read(&priv->rx_fifo.dropped);
+	*data++ = atomic64_read(&priv->tx_fifo.bytes);
+	*data++ = atomic64_read(&priv->tx_fifo.dropped);
+
+	ccat_memcpy_fromio(&mac, priv->reg.mac, sizeof(mac));
+	*data++ = mac.frame_len_err;
+	*data++ = mac.rx_err;
+	*data++ = mac.crc_err;
+	*data++ = mac.link_lost_err;
+	*data++ = mac.rx_mem_full;
+	*data++ = mac.tx_frames;
+	*data++ = mac.rx_frames;
+	*data++ = mac.tx_fifo_level;
+	*data++ = mac.tx_mem_full;
+	*data++ = mac.mii_connected;
+}
+
+static void ccat_eth_get_drvinfo(struct net_device *dev,
+				 struct ethtool_drvinfo *info)
+{
+	const struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	strscpy(info->driver, KBUILD_MODNAME, sizeof(info->driver));
+	strscpy(info->version, DRV_VERSION, sizeof(info->version));
+	strscpy(info->bus_info, dev_name(priv->func->ccat->dev),
+		sizeof(info->bus_info));
+}
+
+#define CCAT_ETH_REGS_MAC_LEN 0x80
+#define CCAT_ETH_REGS_MII_LEN 0x10
+
+static int ccat_eth_get_regs_len(struct net_device *dev)
+{
+	return CCAT_ETH_REGS_MAC_LEN + CCAT_ETH_REGS_MII_LEN;
 }
 
 /**
- * Read link state from CCAT hardware
- * @return 1 if link is up, 0 if not
+ * ccat_eth_get_regs() - dump the MAC register block followed by the MII
+ * register block (MAC address, link state and MAC filter)
  */
-inline static size_t ccat_eth_priv_read_link_state(const struct ccat_eth_priv
-						   *const priv)
+static void ccat_eth_get_regs(struct net_device *dev,
+			      struct ethtool_regs *regs, void *p)
 {
-	return ! !(ioread32(priv->reg.mii + 0x8 + 4) & (1 << 24));
+	const struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	regs->version = 1;
+	ccat_memcpy_fromio(p, priv->reg.mac, CCAT_ETH_REGS_MAC_LEN);
+	ccat_memcpy_fromio(p + CCAT_ETH_REGS_MAC_LEN, priv->reg.mii,
+		      CCAT_ETH_REGS_MII_LEN);
+}
+
+static int ccat_eth_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_TEST:
+		return ARRAY_SIZE(ccat_eth_test_strings);
+	case ETH_SS_STATS:
+		return ARRAY_SIZE(ccat_eth_stats) +
+		    ARRAY_SIZE(ccat_eth_fifo_mac_stats);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void ccat_eth_get_strings(struct net_device *dev, u32 stringset,
+				 u8 * data)
+{
+	switch (stringset) {
+	case ETH_SS_TEST:
+		memcpy(data, ccat_eth_test_strings,
+		       sizeof(ccat_eth_test_strings));
+		break;
+	case ETH_SS_STATS:{
+			size_t i;
+
+			for (i = 0; i < ARRAY_SIZE(ccat_eth_stats); ++i) {
+				memcpy(data, ccat_eth_stats[i].name,
+				       ETH_GSTRING_LEN);
+				data += ETH_GSTRING_LEN;
+			}
+			memcpy(data, ccat_eth_fifo_mac_stats,
+			       sizeof(ccat_eth_fifo_mac_stats));
+			break;
+		}
+	}
+}
+
+static const struct ethtool_ops ccat_eth_ethtool_ops = {
+	.get_drvinfo = ccat_eth_get_drvinfo,
+	.get_regs_len = ccat_eth_get_regs_len,
+	.get_regs = ccat_eth_get_regs,
+	.get_link = ethtool_op_get_link,
+	.get_ethtool_stats = ccat_eth_get_ethtool_stats,
+	.self_test = ccat_eth_self_test,
+	.get_sset_count = ccat_eth_get_sset_count,
+	.get_strings = ccat_eth_get_strings,
+};
+
+static int ccat_eth_cdev_open(struct inode *const i, struct file *const f)
+{
+	struct ccat_cdev *const ccdev =
+	    container_of(i->i_cdev, struct ccat_cdev, cdev);
+
+	if (!atomic_dec_and_test(&ccdev->in_use)) {
+		atomic_inc(&ccdev->in_use);
+		return -EBUSY;
+	}
+	f->private_data = ccdev;
+	return nonseekable_open(i, f);
 }
 
 /**
- * Poll for link state changes
+ * ccat_eth_capture_start() - allocate the capture ring and start capturing
+ *
+ * Caller holds capture.mutex.
  */
-static void poll_link(struct ccat_eth_priv *const priv)
+static int ccat_eth_capture_start(struct ccat_eth_priv *const priv,
+				  const struct ccat_eth_capture_cfg *const cfg)
 {
-	const size_t link = ccat_eth_priv_read_link_state(priv);
+	struct ccat_eth_capture *const cap = &priv->capture;
+	struct ccat_eth_capture_ctrl *ctrl;
+	struct ccat_pcapng_preamble *pre;
+	size_t i;
 
-	if (link != netif_carrier_ok(priv->netdev)) {
-		if (link)
-			ccat_eth_link_up(priv->netdev);
-		else
-			ccat_eth_link_down(priv->netdev);
+	if (!is_power_of_2(cfg->size) || cfg->size < CAPTURE_SIZE_MIN
+	    || cfg->size > CAPTURE_SIZE_MAX) {
+		return -EINVAL;
+	}
+	if (cfg->snaplen && cfg->snaplen < ETH_HLEN) {
+		return -EINVAL;
+	}
+	if (cap->ctrl) {
+		return -EBUSY;
+	}
+
+	ctrl = vmalloc_user(CCAT_ETH_CAPTURE_HDR_SIZE + cfg->size);
+	if (!ctrl) {
+		return -ENOMEM;
+	}
+	ctrl->preamble_offset = CAPTURE_PREAMBLE_OFFSET;
+	ctrl->preamble_size = sizeof(*pre);
+	ctrl->data_offset = CCAT_ETH_CAPTURE_HDR_SIZE;
+	ctrl->data_size = cfg->size;
+
+	pre = (void *)ctrl + CAPTURE_PREAMBLE_OFFSET;
+	pre->shb_type = 0x0a0d0d0a;
+	pre->shb_len = offsetof(struct ccat_pcapng_preamble, idb_type);
+	pre->byte_order_magic = 0x1a2b3c4d;
+	pre->major = 1;
+	pre->minor = 0;
+	pre->section_len = -1;
+	pre->shb_len_trailer = pre->shb_len;
+	pre->idb_type = 1;
+	pre->idb_len = sizeof(*pre) - pre->shb_len;
+	pre->linktype = 1;	/* LINKTYPE_ETHERNET */
+	pre->snaplen = cfg->snaplen;
+	pre->tsresol_code = 9;
+	pre->tsresol_len = sizeof(pre->tsresol);
+	pre->tsresol = 9;	/* CCAT timestamps are nanoseconds */
+	pre->tsoffset_code = 14;
+	pre->tsoffset_len = sizeof(pre->tsoffset);
+	pre->tsoffset = CAPTURE_TSOFFSET;
+	pre->idb_len_trailer = pre->idb_len;
+
+	spin_lock_irq(&cap->lock);
+	for (i = 0; i < ARRAY_SIZE(cap->ethertypes); ++i) {
+		cap->ethertypes[i] = htons(cfg->ethertypes[i]);
 	}
+	cap->data = (u8 *) ctrl + CCAT_ETH_CAPTURE_HDR_SIZE;
+	cap->size = cfg->size;
+	cap->snaplen = cfg->snaplen ? cfg->snaplen : U32_MAX;
+	cap->tx_clean = READ_ONCE(priv->tx_fifo.mem.next);
+	cap->ctrl = ctrl;
+	spin_unlock_irq(&cap->lock);
+	return 0;
 }
 
 /**
- * Poll for available rx dma descriptors in ethernet operating mode
+ * ccat_eth_capture_stop() - stop capturing and release the capture ring
+ *
+ * Existing mappings keep their pages until munmap(), but see no new blocks.
+ * Caller holds capture.mutex.
  */
-static void poll_rx(struct ccat_eth_priv *const priv)
+static void ccat_eth_capture_stop(struct ccat_eth_priv *const priv)
 {
-	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
-	size_t rx_per_poll = FIFO_LENGTH / 2;
-	size_t len = fifo->ops->ready(fifo);
+	struct ccat_eth_capture *const cap = &priv->capture;
+	struct ccat_eth_capture_ctrl *ctrl;
+
+	spin_lock_irq(&cap->lock);
+	ctrl = cap->ctrl;
+	cap->ctrl = NULL;
+	spin_unlock_irq(&cap->lock);
+	vfree(ctrl);
+}
 
-	while (len && --rx_per_poll) {
-		ccat_eth_receive(priv, len);
-		fifo->ops->add(fifo);
-		ccat_eth_fifo_inc(fifo);
-		len = fifo->ops->ready(fifo);
+static int ccat_eth_cdev_release(struct inode *const i, struct file *const f)
+{
+	struct ccat_cdev *const ccdev = f->private_data;
+	struct ccat_eth_priv *const priv = ccdev->private_data;
+
+	mutex_lock(&priv->capture.mutex);
+	ccat_eth_capture_stop(priv);
+	mutex_unlock(&priv->capture.mutex);
+	atomic_inc(&ccdev->in_use);
+	return 0;
+}
+
+static int ccat_eth_capture_mmap(struct ccat_eth_priv *const priv,
+				 struct vm_area_struct *vma)
+{
+	int status = -EINVAL;
+
+	mutex_lock(&priv->capture.mutex);
+	if (priv->capture.ctrl) {
+		status = remap_vmalloc_range(vma, priv->capture.ctrl, 0);
 	}
+	mutex_unlock(&priv->capture.mutex);
+	return status;
 }
 
 /**
- * Poll for available tx dma descriptors in ethernet operating mode
+ * ccat_eth_cdev_mmap() - map the TX templates or the capture ring into user
+ * space, selected by the offset (0 or CCAT_ETH_MMAP_CAPTURE)
  */
-static void poll_tx(struct ccat_eth_priv *const priv)
+static int ccat_eth_cdev_mmap(struct file *f, struct vm_area_struct *vma)
 {
-	if (priv->tx_fifo.ops->ready(&priv->tx_fifo)) {
-		netif_wake_queue(priv->netdev);
+	const struct ccat_cdev *const ccdev = f->private_data;
+	struct ccat_eth_priv *const priv = ccdev->private_data;
+	const struct ccat_eth_templates *const templates = &priv->templates;
+	const size_t size = templates->count * sizeof(*templates->slots);
+
+	if (vma->vm_pgoff == CCAT_ETH_MMAP_CAPTURE >> PAGE_SHIFT) {
+		return ccat_eth_capture_mmap(priv, vma);
+	}
+	if (vma->vm_pgoff || (vma->vm_end - vma->vm_start) > size) {
+		return -EINVAL;
+	}
+	return dma_mmap_coherent(priv->dma_mem.dev, vma, templates->slots,
+				 templates->phys, size);
+}
+
+static long ccat_eth_cdev_ioctl(struct file *f, unsigned int cmd,
+				unsigned long arg)
+{
+	const struct ccat_cdev *const ccdev = f->private_data;
+	struct ccat_eth_priv *const priv = ccdev->private_data;
+	const struct ccat_eth_templates *const templates = &priv->templates;
+
+	switch (cmd) {
+	case CCAT_ETH_GET_TEMPLATE_INFO:{
+			const struct ccat_eth_template_info info = {
+				.count = templates->count,
+				.slot_size = sizeof(*templates->slots),
+				.data_offset = offsetof(struct ccat_dma_frame,
+							data),
+				.flags_offset =
+				    offsetof(struct ccat_dma_frame_hdr,
+					     tx_flags),
+				.max_length = MAX_PAYLOAD_SIZE,
+				.mmap_size = templates->count *
+				    sizeof(*templates->slots),
+			};
+
+			if (copy_to_user((void __user *)arg, &info,
+					 sizeof(info))) {
+				return -EFAULT;
+			}
+			return 0;
+		}
+	case CCAT_ETH_TEMPLATE_SEND:{
+			struct ccat_eth_template_send req;
+
+			if (copy_from_user(&req, (void __user *)arg,
+					   sizeof(req))) {
+				return -EFAULT;
+			}
+			return ccat_eth_template_xmit(priv, req.slot,
+						      req.length);
+		}
+	case CCAT_ETH_CAPTURE_START:{
+			struct ccat_eth_capture_cfg cfg;
+			int status;
+
+			if (copy_from_user(&cfg, (void __user *)arg,
+					   sizeof(cfg))) {
+				return -EFAULT;
+			}
+			mutex_lock(&priv->capture.mutex);
+			status = ccat_eth_capture_start(priv, &cfg);
+			mutex_unlock(&priv->capture.mutex);
+			return status;
+		}
+	case CCAT_ETH_CAPTURE_STOP:{
+			mutex_lock(&priv->capture.mutex);
+			ccat_eth_capture_stop(priv);
+			mutex_unlock(&priv->capture.mutex);
+			return 0;
+		}
+	default:
+		return -ENOTTY;
+	}
+}
+
+static struct ccat_cdev dev_table[CCAT_ETH_DEVICES_MAX];
+static struct ccat_class cdev_class = {
+	.count = CCAT_ETH_DEVICES_MAX,
+	.devices = dev_table,
+	.name = "ccat_eth",
+	.fops = {
+		 .owner = THIS_MODULE,
+		 .open = ccat_eth_cdev_open,
+		 .release = ccat_eth_cdev_release,
+		 .mmap = ccat_eth_cdev_mmap,
+		 .unlocked_ioctl = ccat_eth_cdev_ioctl,
+		 .compat_ioctl = ccat_eth_cdev_ioctl,
+		 },
+};
+
+static void ccat_eth_hist_show(struct seq_file *s, const char *title,
+			       const u64 * hist)
+{
+	size_t i;
+
+	seq_printf(s, "%s:\n", title);
+	for (i = 0; i < POLL_HIST_BUCKETS; ++i) {
+		if (hist[i]) {
+			seq_printf(s, "  %12llu - %12llu: %llu\n",
+				   i ? 1ULL << (i - 1) : 0,
+				   i ? (1ULL << i) - 1 : 0, hist[i]);
+		}
 	}
 }
 
+static int ccat_eth_poll_hist_show(struct seq_file *s, void *unused)
+{
+	const struct ccat_eth_priv *const priv = s->private;
+	const struct ccat_eth_poll_hist *const hist = &priv->poll_hist;
+
+	seq_printf(s, "budget_exhausted: %llu\n",
+		   priv->poll_stats.budget_exhausted);
+	ccat_eth_hist_show(s, "lateness_ns", hist->lateness_ns);
+	ccat_eth_hist_show(s, "duration_ns", hist->duration_ns);
+	ccat_eth_hist_show(s, "frames", hist->frames);
+	return 0;
+}
+
+static int ccat_eth_poll_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_eth_poll_hist_show, inode->i_private);
+}
+
 /**
- * Since CCAT doesn't support interrupts until now, we have to poll
- * some status bits to recognize things like link change etc.
+ * ccat_eth_poll_hist_write() - any write resets the histograms
+ *
+ * The poll loop isn't stopped, a poll running concurrently may survive
+ * the reset with a single count.
  */
-static enum hrtimer_restart poll_timer_callback(struct hrtimer *timer)
+static ssize_t ccat_eth_poll_hist_write(struct file *file,
+					const char __user * buf, size_t count,
+					loff_t * ppos)
 {
-	struct ccat_eth_priv *const priv =
-	    container_of(timer, struct ccat_eth_priv, poll_timer);
+	struct seq_file *const s = file->private_data;
+	struct ccat_eth_priv *const priv = s->private;
 
-	poll_link(priv);
-	poll_rx(priv);
-	poll_tx(priv);
-	hrtimer_forward_now(timer, POLL_TIME);
-	return HRTIMER_RESTART;
+	memset(&priv->poll_hist, 0, sizeof(priv->poll_hist));
+	priv->poll_stats.budget_exhausted = 0;
+	return count;
 }
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
-static struct rtnl_link_stats64 *ccat_eth_get_stats64(struct net_device *dev, struct rtnl_link_stats64
-						      *storage)
-#else
-static void ccat_eth_get_stats64(struct net_device *dev,
-				 struct rtnl_link_stats64 *storage)
-#endif
+static const struct file_operations ccat_eth_poll_hist_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_eth_poll_hist_open,
+	.read = seq_read,
+	.write = ccat_eth_poll_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * struct ccat_eth_pmu_counter - counter behind a ccat_eth PMU event
+ * @width: width of the counter in bits, hardware counters wrap early
+ * @mac: @offset is relative to the MAC register block, not to the priv
+ * @offset: offset of the counter
+ */
+struct ccat_eth_pmu_counter {
+	u8 width;
+	bool mac;
+	size_t offset;
+};
+
+#define CCAT_ETH_PMU_MAC(_member)					\
+	{ .width = 8 * sizeof(((struct ccat_mac_register *)0)->_member),	\
+	  .mac = true, .offset = offsetof(struct ccat_mac_register, _member) }
+#define CCAT_ETH_PMU_PRIV(_member)					\
+	{ .width = 64, .offset = offsetof(struct ccat_eth_priv, _member) }
+
+/* mmio_reads is the sum of three counters, CCAT_ETH_PMU_MMIO_READS */
+#define CCAT_ETH_PMU_MMIO_READS 13
+
+static const struct ccat_eth_pmu_counter ccat_eth_pmu_counters[] = {
+	CCAT_ETH_PMU_MAC(tx_frames),
+	CCAT_ETH_PMU_MAC(rx_frames),
+	CCAT_ETH_PMU_MAC(frame_len_err),
+	CCAT_ETH_PMU_MAC(rx_err),
+	CCAT_ETH_PMU_MAC(crc_err),
+	CCAT_ETH_PMU_MAC(link_lost_err),
+	CCAT_ETH_PMU_MAC(rx_mem_full),
+	CCAT_ETH_PMU_MAC(tx_mem_full),
+	CCAT_ETH_PMU_PRIV(poll_stats.polls),
+	CCAT_ETH_PMU_PRIV(poll_stats.rx_frames),
+	CCAT_ETH_PMU_PRIV(poll_stats.budget_exhausted),
+	CCAT_ETH_PMU_PRIV(xstats.tx_ring_full),
+	CCAT_ETH_PMU_PRIV(xstats.rx_alloc_failed),
+	[CCAT_ETH_PMU_MMIO_READS] = {.width = 64},
+};
+
+PMU_EVENT_ATTR_STRING(tx_frames, ccat_eth_pmu_tx_frames, "event=0x00");
+PMU_EVENT_ATTR_STRING(rx_frames, ccat_eth_pmu_rx_frames, "event=0x01");
+PMU_EVENT_ATTR_STRING(frame_len_err, ccat_eth_pmu_frame_len_err, "event=0x02");
+PMU_EVENT_ATTR_STRING(rx_err, ccat_eth_pmu_rx_err, "event=0x03");
+PMU_EVENT_ATTR_STRING(crc_err, ccat_eth_pmu_crc_err, "event=0x04");
+PMU_EVENT_ATTR_STRING(link_lost_err, ccat_eth_pmu_link_lost_err, "event=0x05");
+PMU_EVENT_ATTR_STRING(rx_mem_full, ccat_eth_pmu_rx_mem_full, "event=0x06");
+PMU_EVENT_ATTR_STRING(tx_mem_full, ccat_eth_pmu_tx_mem_full, "event=0x07");
+PMU_EVENT_ATTR_STRING(polls, ccat_eth_pmu_polls, "event=0x08");
+PMU_EVENT_ATTR_STRING(rx_poll_frames, ccat_eth_pmu_rx_poll_frames, "event=0x09");
+PMU_EVENT_ATTR_STRING(poll_budget_exhausted, ccat_eth_pmu_budget, "event=0x0a");
+PMU_EVENT_ATTR_STRING(tx_ring_full, ccat_eth_pmu_tx_ring_full, "event=0x0b");
+PMU_EVENT_ATTR_STRING(rx_alloc_failed, ccat_eth_pmu_rx_alloc_failed, "event=0x0c");
+PMU_EVENT_ATTR_STRING(mmio_reads, ccat_eth_pmu_mmio_reads, "event=0x0d");
+
+static struct attribute *ccat_eth_pmu_event_attrs[] = {
+	&ccat_eth_pmu_tx_frames.attr.attr,
+	&ccat_eth_pmu_rx_frames.attr.attr,
+	&ccat_eth_pmu_frame_len_err.attr.attr,
+	&ccat_eth_pmu_rx_err.attr.attr,
+	&ccat_eth_pmu_crc_err.attr.attr,
+	&ccat_eth_pmu_link_lost_err.attr.attr,
+	&ccat_eth_pmu_rx_mem_full.attr.attr,
+	&ccat_eth_pmu_tx_mem_full.attr.attr,
+	&ccat_eth_pmu_polls.attr.attr,
+	&ccat_eth_pmu_rx_poll_frames.attr.attr,
+	&ccat_eth_pmu_budget.attr.attr,
+	&ccat_eth_pmu_tx_ring_full.attr.attr,
+	&ccat_eth_pmu_rx_alloc_failed.attr.attr,
+	&ccat_eth_pmu_mmio_reads.attr.attr,
+	NULL,
+};
+
+static const struct attribute_group ccat_eth_pmu_events_group = {
+	.name = "events",
+	.attrs = ccat_eth_pmu_event_attrs,
+};
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+PMU_FORMAT_ATTR(port, "config:8-15");
+
+static struct attribute *ccat_eth_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	&format_attr_port.attr,
+	NULL,
+};
+
+static const struct attribute_group ccat_eth_pmu_format_group = {
+	.name = "format",
+	.attrs = ccat_eth_pmu_format_attrs,
+};
+
+/* the counters are per port not per CPU, perf opens them on CPU 0 only */
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
-	struct ccat_mac_register mac;
+	return sprintf(buf, "0\n");
+}
 
-	memcpy_fromio(&mac, priv->reg.mac, sizeof(mac));
-	storage->rx_packets = mac.rx_frames;	/* total packets received       */
-	storage->tx_packets = mac.tx_frames;	/* total packets transmitted    */
-	storage->rx_bytes = atomic64_read(&priv->rx_fifo.bytes);	/* total bytes received         */
-	storage->tx_bytes = atomic64_read(&priv->tx_fifo.bytes);	/* total bytes transmitted      */
-	storage->rx_errors = mac.frame_len_err + mac.rx_mem_full + mac.crc_err + mac.rx_err;	/* bad packets received         */
-	storage->tx_errors = mac.tx_mem_full;	/* packet transmit problems     */
-	storage->rx_dropped = atomic64_read(&priv->rx_fifo.dropped);	/* no space in linux buffers    */
-	storage->tx_dropped = atomic64_read(&priv->tx_fifo.dropped);	/* no space available in linux  */
-	//TODO __u64    multicast;              /* multicast packets received   */
-	//TODO __u64    collisions;
+static DEVICE_ATTR_RO(cpumask);
 
-	/* detailed rx_errors: */
-	storage->rx_length_errors = mac.frame_len_err;
-	storage->rx_over_errors = mac.rx_mem_full;	/* receiver ring buff overflow  */
-	storage->rx_crc_errors = mac.crc_err;	/* recved pkt with crc error    */
-	storage->rx_frame_errors = mac.rx_err;	/* recv'd frame alignment error */
-	storage->rx_fifo_errors = mac.rx_mem_full;	/* recv'r fifo overrun          */
-	//TODO __u64    rx_missed_errors;       /* receiver missed packet       */
+static struct attribute *ccat_eth_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
 
-	/* detailed tx_errors */
-	//TODO __u64    tx_aborted_errors;
-	//TODO __u64    tx_carrier_errors;
-	//TODO __u64    tx_fifo_errors;
-	//TODO __u64    tx_heartbeat_errors;
-	//TODO __u64    tx_window_errors;
+static const struct attribute_group ccat_eth_pmu_cpumask_group = {
+	.attrs = ccat_eth_pmu_cpumask_attrs,
+};
 
-	/* for cslip etc */
-	//TODO __u64    rx_compressed;
-	//TODO __u64    tx_compressed;
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
-	return storage;
-#endif
+static const struct attribute_group *ccat_eth_pmu_attr_groups[] = {
+	&ccat_eth_pmu_events_group,
+	&ccat_eth_pmu_format_group,
+	&ccat_eth_pmu_cpumask_group,
+	NULL,
+};
+
+static DEFINE_SPINLOCK(pmu_lock);
+static struct ccat_eth_priv *pmu_ports[CCAT_ETH_DEVICES_MAX];
+
+#define CCAT_ETH_PMU_EVENT(config) ((config) & 0xff)
+#define CCAT_ETH_PMU_PORT(config) (((config) >> 8) & 0xff)
+
+/**
+ * ccat_eth_pmu_read_counter() - current value of the counter of @event
+ *
+ * Return: the counter value or @prev, if the port is gone
+ */
+static u64 ccat_eth_pmu_read_counter(struct perf_event *event, u64 prev)
+{
+	const u64 config = event->attr.config;
+	const struct ccat_eth_pmu_counter *const counter =
+	    &ccat_eth_pmu_counters[CCAT_ETH_PMU_EVENT(config)];
+	const struct ccat_eth_priv *priv;
+	unsigned long flags;
+	u64 value = prev;
+
+	spin_lock_irqsave(&pmu_lock, flags);
+	priv = pmu_ports[CCAT_ETH_PMU_PORT(config)];
+	if (!priv) {
+		goto unlock;
+	}
+
+	if (CCAT_ETH_PMU_EVENT(config) == CCAT_ETH_PMU_MMIO_READS) {
+		value = priv->rx_fifo.mmio_reads + priv->tx_fifo.mmio_reads +
+		    priv->xstats.mmio_reads;
+	} else if (!counter->mac) {
+		value = *(const u64 *)((const u8 *)priv + counter->offset);
+	} else if (counter->width == 8) {
+		value = ccat_ioread8(priv->reg.mac + counter->offset);
+	} else {
+		value = ccat_ioread32(priv->reg.mac + counter->offset);
+	}
+unlock:
+	spin_unlock_irqrestore(&pmu_lock, flags);
+	return value;
 }
 
-static int ccat_eth_open(struct net_device *dev)
+static void ccat_eth_pmu_update(struct perf_event *event)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	const u8 width =
+	    ccat_eth_pmu_counters[CCAT_ETH_PMU_EVENT(event->attr.config)].width;
+	struct hw_perf_event *const hwc = &event->hw;
+	u64 prev, now;
 
-	hrtimer_init(&priv->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	priv->poll_timer.function = poll_timer_callback;
-	hrtimer_start(&priv->poll_timer, POLL_TIME, HRTIMER_MODE_REL);
+	do {
+		prev = local64_read(&hwc->prev_count);
+		now = ccat_eth_pmu_read_counter(event, prev);
+	} while (local64_cmpxchg(&hwc->prev_count, prev, now) != prev);
+
+	local64_add((now - prev) & GENMASK_ULL(width - 1, 0), &event->count);
+}
+
+static int ccat_eth_pmu_event_init(struct perf_event *event)
+{
+	const u64 config = event->attr.config;
+
+	if (event->attr.type != event->pmu->type) {
+		return -ENOENT;
+	}
+	/* counting only, system wide */
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK
+	    || event->cpu < 0) {
+		return -EINVAL;
+	}
+	if (CCAT_ETH_PMU_EVENT(config) >= ARRAY_SIZE(ccat_eth_pmu_counters)
+	    || CCAT_ETH_PMU_PORT(config) >= ARRAY_SIZE(pmu_ports)
+	    || config >> 16) {
+		return -EINVAL;
+	}
 	return 0;
 }
 
-static int ccat_eth_stop(struct net_device *dev)
+static void ccat_eth_pmu_start(struct perf_event *event, int flags)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	local64_set(&event->hw.prev_count,
+		    ccat_eth_pmu_read_counter(event, 0));
+	event->hw.state = 0;
+}
 
-	netif_stop_queue(dev);
-	hrtimer_cancel(&priv->poll_timer);
+static void ccat_eth_pmu_stop(struct perf_event *event, int flags)
+{
+	if (!(event->hw.state & PERF_HES_STOPPED)) {
+		ccat_eth_pmu_update(event);
+		event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	}
+}
+
+static int ccat_eth_pmu_add(struct perf_event *event, int flags)
+{
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+	if (flags & PERF_EF_START) {
+		ccat_eth_pmu_start(event, flags);
+	}
 	return 0;
 }
 
-static const struct net_device_ops ccat_eth_netdev_ops = {
-	.ndo_get_stats64 = ccat_eth_get_stats64,
-	.ndo_open = ccat_eth_open,
-	.ndo_start_xmit = ccat_eth_start_xmit,
-	.ndo_stop = ccat_eth_stop,
+static void ccat_eth_pmu_del(struct perf_event *event, int flags)
+{
+	ccat_eth_pmu_stop(event, PERF_EF_UPDATE);
+}
+
+static struct pmu ccat_eth_pmu = {
+	.module = THIS_MODULE,
+	.task_ctx_nr = perf_invalid_context,
+	.attr_groups = ccat_eth_pmu_attr_groups,
+	.event_init = ccat_eth_pmu_event_init,
+	.add = ccat_eth_pmu_add,
+	.del = ccat_eth_pmu_del,
+	.start = ccat_eth_pmu_start,
+	.stop = ccat_eth_pmu_stop,
+	.read = ccat_eth_pmu_update,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0))
+	.capabilities = PERF_PMU_CAP_NO_EXCLUDE,
+#endif
 };
 
+static void ccat_eth_pmu_port_add(struct ccat_eth_priv *const priv)
+{
+	size_t i;
+
+	priv->pmu_port = -1;
+	spin_lock_irq(&pmu_lock);
+	for (i = 0; i < ARRAY_SIZE(pmu_ports); ++i) {
+		if (!pmu_ports[i]) {
+			pmu_ports[i] = priv;
+			priv->pmu_port = i;
+			break;
+		}
+	}
+	spin_unlock_irq(&pmu_lock);
+	if (priv->pmu_port >= 0) {
+		netdev_info(priv->netdev, "perf events: ccat_eth/<event>,port=%d/\n",
+			    priv->pmu_port);
+	}
+}
+
+static void ccat_eth_pmu_port_del(struct ccat_eth_priv *const priv)
+{
+	if (priv->pmu_port >= 0) {
+		spin_lock_irq(&pmu_lock);
+		pmu_ports[priv->pmu_port] = NULL;
+		spin_unlock_irq(&pmu_lock);
+	}
+}
+
+static void ccat_eth_debugfs_init(struct ccat_eth_priv *const priv,
+				  struct platform_device *pdev)
+{
+	priv->debugfs = debugfs_create_dir(dev_name(&pdev->dev), NULL);
+	debugfs_create_file("poll_hist", 0644, priv->debugfs, priv,
+			    &ccat_eth_poll_hist_fops);
+}
+
+/**
+ * ccat_eth_cdev_create() - provide /dev/ccat_eth* for templates and capture
+ *
+ * The character device is optional, the netdev works without it.
+ */
+static void ccat_eth_cdev_create(struct ccat_eth_priv *const priv)
+{
+	priv->ccdev = ccat_cdev_create(priv->func, &cdev_class, 0);
+	if (priv->ccdev) {
+		priv->ccdev->private_data = priv;
+	} else {
+		pr_warn("%s: /dev/ccat_eth not available to user space.\n",
+			priv->netdev->name);
+	}
+}
+
+static void ccat_eth_cdev_destroy(struct ccat_eth_priv *const priv)
+{
+	if (priv->ccdev) {
+		ccat_cdev_destroy(priv->ccdev);
+	}
+	mutex_lock(&priv->capture.mutex);
+	ccat_eth_capture_stop(priv);
+	mutex_unlock(&priv->capture.mutex);
+}
+
 static struct ccat_eth_priv *ccat_eth_alloc_netdev(struct ccat_function *func)
 {
 	struct ccat_eth_priv *priv = NULL;
@@ -808,6 +3587,17 @@ static struct ccat_eth_priv *ccat_eth_alloc_netdev(struct ccat_function *func)
 		memset(priv, 0, sizeof(*priv));
 		priv->netdev = netdev;
 		priv->func = func;
+		priv->cycle.dense_ns = POLL_DENSE_NS;
+		priv->cycle.sparse_ns = POLL_SPARSE_NS;
+		spin_lock_init(&priv->txtime.lock);
+		skb_queue_head_init(&priv->txtime.queue);
+		hrtimer_init(&priv->txtime.timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_ABS);
+		priv->txtime.timer.function = ccat_eth_txtime_callback;
+		priv->steer.cpu = -1;
+		INIT_WORK(&priv->steer.work, ccat_eth_steer_work);
+		spin_lock_init(&priv->capture.lock);
+		mutex_init(&priv->capture.mutex);
 		ccat_eth_priv_init_reg(priv);
 	}
 	return priv;
@@ -818,9 +3608,11 @@ static int ccat_eth_init_netdev(struct ccat_eth_priv *priv)
 	int status;
 
 	/* init netdev with MAC and stack callbacks */
-	memcpy_fromio(priv->netdev->dev_addr, priv->reg.mii + 8,
+	ccat_memcpy_fromio(priv->netdev->dev_addr, priv->reg.mii + 8,
 		      priv->netdev->addr_len);
 	priv->netdev->netdev_ops = &ccat_eth_netdev_ops;
+	priv->netdev->ethtool_ops = &ccat_eth_ethtool_ops;
+	priv->netdev->sysfs_groups[0] = &ccat_eth_attr_group;
 	netif_carrier_off(priv->netdev);
 
 	status = register_netdev(priv->netdev);
@@ -850,13 +3642,29 @@ static int ccat_eth_dma_probe(struct platform_device *pdev)
 		free_netdev(priv->netdev);
 		return status;
 	}
-	return ccat_eth_init_netdev(priv);
+
+	status = ccat_eth_init_netdev(priv);
+	if (status) {
+		return status;
+	}
+	ccat_eth_cdev_create(priv);
+	ccat_eth_debugfs_init(priv, pdev);
+	ccat_eth_pmu_port_add(priv);
+	return 0;
 }
 
 static int ccat_eth_dma_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_eth_priv *const eth = func->private_data;
+
+	ccat_eth_pmu_port_del(eth);
+	debugfs_remove_recursive(eth->debugfs);
+	ccat_eth_cdev_destroy(eth);
+	rtnl_lock();
+	ccat_eth_redundancy_unpair(eth);
+	ccat_eth_steer_set(eth, -1);
+	rtnl_unlock();
 	unregister_netdev(eth->netdev);
 	ccat_eth_priv_free(eth);
 	free_netdev(eth->netdev);
@@ -884,13 +3692,29 @@ static int ccat_eth_eim_probe(struct platform_device *pdev)
 		free_netdev(priv->netdev);
 		return status;
 	}
-	return ccat_eth_init_netdev(priv);
+
+	status = ccat_eth_init_netdev(priv);
+	if (status) {
+		return status;
+	}
+	ccat_eth_cdev_create(priv);
+	ccat_eth_debugfs_init(priv, pdev);
+	ccat_eth_pmu_port_add(priv);
+	return 0;
 }
 
 static int ccat_eth_eim_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_eth_priv *const eth = func->private_data;
+
+	ccat_eth_pmu_port_del(eth);
+	debugfs_remove_recursive(eth->debugfs);
+	ccat_eth_cdev_destroy(eth);
+	rtnl_lock();
+	ccat_eth_redundancy_unpair(eth);
+	ccat_eth_steer_set(eth, -1);
+	rtnl_unlock();
 	unregister_netdev(eth->netdev);
 	ccat_eth_priv_free(eth);
 	free_netdev(eth->netdev);
@@ -906,17 +3730,41 @@ static struct platform_driver ccat_eth_eim_driver = {
 static int __init ccat_eth_init(void)
 {
 	int result;
+
+	hrtimer_init(&poller.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED);
+	poller.timer.function = ccat_eth_poller_callback;
+
+	/* perf support is optional */
+	if (perf_pmu_register(&ccat_eth_pmu, "ccat_eth", -1)) {
+		pr_warn("%s(): perf PMU not available.\n", __FUNCTION__);
+		ccat_eth_pmu.type = -1;
+	}
+
 	result = platform_driver_register(&ccat_eth_eim_driver);
 	if (result != 0) {
-		return result;
+		goto unregister_pmu;
+	}
+	result = platform_driver_register(&ccat_eth_dma_driver);
+	if (result != 0) {
+		platform_driver_unregister(&ccat_eth_eim_driver);
+		goto unregister_pmu;
 	}
-	return platform_driver_register(&ccat_eth_dma_driver);
+	return 0;
+
+unregister_pmu:
+	if (ccat_eth_pmu.type >= 0) {
+		perf_pmu_unregister(&ccat_eth_pmu);
+	}
+	return result;
 }
 
 static void __exit ccat_eth_exit(void)
 {
 	platform_driver_unregister(&ccat_eth_eim_driver);
 	platform_driver_unregister(&ccat_eth_dma_driver);
+	if (ccat_eth_pmu.type >= 0) {
+		perf_pmu_unregister(&ccat_eth_pmu);
+	}
 }
 
 module_init(ccat_eth_init);
@@ -0,0 +1,395 @@
+// SPDX-License-Identifier: MIT
+/**
+    Update tool for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    Updates the FPGA configuration of all CCAT update devices in parallel.
+    Each device is handled by its own thread running the same sequence as
+    update_ccat.sh: backup -> write -> readback/compare -> restore on error.
+    The steps of one device are not overlapped: the driver erases the
+    flash and programs the image on close(), so the backup has to be
+    complete before and the readback can only start after it.
+
+    Build: make tools
+    Usage: update_ccat [-k] <rbf> [/dev/ccat_updateX ...]
+           update_ccat -F <firmware> [device ...]
+
+    Without a device list all /dev/ccat_update* devices are updated. With
+    -F the firmware is loaded, decompressed and verified by the driver
+    itself (see /sys/bus/platform/drivers/ccat_update/<device>/firmware),
+    the file has to be available in the firmware search path (/lib/firmware).
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CCAT_FLASH_SIZE (size_t)0xE0000
+#define CCAT_IO_CHUNK (size_t)(16 * 1024)
+#define CCAT_DEV_GLOB "/dev/ccat_update*"
+#define CCAT_SYSFS_GLOB "/sys/bus/platform/drivers/ccat_update/*/firmware"
+
+struct update_job {
+	pthread_t thread;
+	int started;
+	const char *path;
+	const uint8_t *image;
+	size_t len;
+	const char *backup_path;
+	int keep_backup;
+	int result;
+	double t_backup;
+	double t_write;
+	double t_verify;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double kib_per_sec(size_t bytes, double seconds)
+{
+	return seconds > 0 ? bytes / 1024.0 / seconds : 0;
+}
+
+/**
+ * read_flash() - read @len bytes from the start of an update device
+ * @cmp: if not NULL, compare each chunk against this buffer and stop on
+ *       the first mismatch instead of storing the data into @buf
+ *
+ * Return: 0 on success, -1 on I/O error, 1 on mismatch
+ */
+static int read_flash(const char *path, uint8_t * buf, const uint8_t * cmp,
+		      size_t len)
+{
+	uint8_t chunk[CCAT_IO_CHUNK];
+	size_t done = 0;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	while (done < len) {
+		const size_t n = (len - done < sizeof(chunk)) ?
+		    len - done : sizeof(chunk);
+		const ssize_t r = read(fd, cmp ? chunk : buf + done, n);
+
+		if (r <= 0) {
+			close(fd);
+			return -1;
+		}
+		if (cmp && memcmp(chunk, cmp + done, r)) {
+			close(fd);
+			return 1;
+		}
+		done += r;
+	}
+	close(fd);
+	return 0;
+}
+
+/**
+ * write_flash() - write an image to an update device
+ *
+ * The driver programs and verifies the flash when the device is closed,
+ * close() fails with EIO if the flash doesn't match the image. Older
+ * drivers program in ->release and can't report errors, so the caller
+ * reads the flash back anyway.
+ */
+static int write_flash(const char *path, const uint8_t * buf, size_t len)
+{
+	size_t done = 0;
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	while (done < len) {
+		const ssize_t w = write(fd, buf + done, len - done);
+
+		if (w <= 0) {
+			close(fd);
+			return -1;
+		}
+		done += w;
+	}
+	return close(fd);
+}
+
+static int save_file(const char *path, const uint8_t * buf, size_t len)
+{
+	FILE *f = fopen(path, "wb");
+	int ok;
+
+	if (!f) {
+		return -1;
+	}
+	ok = (fwrite(buf, 1, len, f) == len);
+	return (fclose(f) || !ok) ? -1 : 0;
+}
+
+static void *update_thread(void *arg)
+{
+	struct update_job *const job = arg;
+	uint8_t *const backup = malloc(CCAT_FLASH_SIZE);
+	double t;
+
+	job->result = -1;
+	if (!backup) {
+		fprintf(stderr, "%s: out of memory\n", job->path);
+		return NULL;
+	}
+
+	t = now();
+	if (read_flash(job->path, backup, NULL, CCAT_FLASH_SIZE)) {
+		fprintf(stderr, "%s: create backup failed: %s\n", job->path,
+			strerror(errno));
+		goto cleanup;
+	}
+	job->t_backup = now() - t;
+	if (save_file(job->backup_path, backup, CCAT_FLASH_SIZE)) {
+		fprintf(stderr, "%s: save backup to %s failed\n", job->path,
+			job->backup_path);
+		goto cleanup;
+	}
+
+	t = now();
+	if (write_flash(job->path, job->image, job->len)) {
+		fprintf(stderr, "%s: write to flash failed: %s\n", job->path,
+			strerror(errno));
+		goto cleanup;
+	}
+	job->t_write = now() - t;
+
+	t = now();
+	job->result = read_flash(job->path, NULL, job->image, job->len);
+	job->t_verify = now() - t;
+	if (!job->result) {
+		if (!job->keep_backup) {
+			unlink(job->backup_path);
+		}
+		goto cleanup;
+	}
+
+	fprintf(stderr, "%s: update failed -> trying to restore backup...\n",
+		job->path);
+	if (write_flash(job->path, backup, CCAT_FLASH_SIZE)
+	    || read_flash(job->path, NULL, backup, CCAT_FLASH_SIZE)) {
+		fprintf(stderr,
+			"%s: WARNING restore failed! Try to fix it manually using %s\n",
+			job->path, job->backup_path);
+	} else {
+		fprintf(stderr, "%s: restore was successful\n", job->path);
+	}
+	job->result = -1;
+cleanup:
+	free(backup);
+	return NULL;
+}
+
+static void *firmware_thread(void *arg)
+{
+	struct update_job *const job = arg;
+	const char *const name = (const char *)job->image;
+	const double t = now();
+	int fd = open(job->path, O_WRONLY);
+
+	job->result = -1;
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", job->path, strerror(errno));
+		return NULL;
+	}
+	if (write(fd, name, strlen(name)) == (ssize_t) strlen(name)) {
+		job->result = 0;
+	} else {
+		fprintf(stderr, "%s: update failed: %s\n", job->path,
+			strerror(errno));
+	}
+	close(fd);
+	job->t_write = now() - t;
+	return NULL;
+}
+
+static uint8_t *load_file(const char *path, size_t *len)
+{
+	struct stat st;
+	uint8_t *buf;
+	FILE *f = fopen(path, "rb");
+
+	if (!f || fstat(fileno(f), &st)) {
+		goto error;
+	}
+	if ((size_t) st.st_size > CCAT_FLASH_SIZE || st.st_size <= 0) {
+		fprintf(stderr, "%s has an invalid size (%lld bytes)\n", path,
+			(long long)st.st_size);
+		goto error;
+	}
+	buf = malloc(st.st_size);
+	if (!buf || fread(buf, 1, st.st_size, f) != (size_t) st.st_size) {
+		free(buf);
+		goto error;
+	}
+	fclose(f);
+	*len = st.st_size;
+	return buf;
+error:
+	if (f) {
+		fclose(f);
+	}
+	fprintf(stderr, "%s seems invalid\n", path);
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-k] <rbf> [/dev/ccat_updateX ...]\n"
+		"       %s -F <firmware> [/sys/bus/platform/drivers/ccat_update/<dev>/firmware ...]\n"
+		"  -k  keep backup files after a successful update\n"
+		"  -F  let the driver load, decompress and verify <firmware>\n"
+		"f.e.: %s ccat_fw_v4.9.rbf\n", argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct update_job *jobs;
+	glob_t devices = { 0 };
+	char **paths;
+	size_t num_paths, num_jobs, len = 0, i;
+	uint8_t *image = NULL;
+	const char *fw_name = NULL;
+	int keep_backup = 0, failed = 0, opt;
+	double t;
+
+	while ((opt = getopt(argc, argv, "kF:h")) != -1) {
+		switch (opt) {
+		case 'k':
+			keep_backup = 1;
+			break;
+		case 'F':
+			fw_name = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!fw_name) {
+		if (optind >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		image = load_file(argv[optind++], &len);
+		if (!image) {
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		paths = argv + optind;
+		num_paths = argc - optind;
+	} else {
+		if (glob(fw_name ? CCAT_SYSFS_GLOB : CCAT_DEV_GLOB, 0, NULL,
+			 &devices)) {
+			fprintf(stderr, "no CCAT update devices found\n");
+			return 1;
+		}
+		paths = devices.gl_pathv;
+		num_paths = devices.gl_pathc;
+	}
+
+	jobs = calloc(num_paths, sizeof(*jobs));
+	if (!jobs) {
+		return 1;
+	}
+
+	t = now();
+	num_jobs = num_paths;
+	for (i = 0; i < num_paths; ++i) {
+		struct update_job *const job = &jobs[i];
+		char *backup_path = NULL;
+
+		job->path = paths[i];
+		job->keep_backup = keep_backup;
+		if (fw_name) {
+			job->image = (const uint8_t *)fw_name;
+		} else {
+			char *dev = strdup(paths[i]);
+
+			if (!dev || asprintf(&backup_path,
+					     "%s.~ccat_update_backup-%s",
+					     argv[optind - 1],
+					     basename(dev)) < 0) {
+				/* don't start more, but let running updates finish */
+				fprintf(stderr, "%s: out of memory\n",
+					job->path);
+				free(dev);
+				job->result = -1;
+				num_jobs = i + 1;
+				break;
+			}
+			free(dev);
+			job->image = image;
+			job->len = len;
+			job->backup_path = backup_path;
+		}
+		if (pthread_create(&job->thread, NULL,
+				   fw_name ? firmware_thread : update_thread,
+				   job)) {
+			fprintf(stderr, "%s: start update failed\n", job->path);
+			job->result = -1;
+		} else {
+			job->started = 1;
+		}
+	}
+
+	for (i = 0; i < num_jobs; ++i) {
+		struct update_job *const job = &jobs[i];
+
+		if (job->started) {
+			pthread_join(job->thread, NULL);
+		}
+		failed += ! !job->result;
+		if (fw_name) {
+			printf("%s: %s in %.1f s\n", job->path,
+			       job->result ? "FAILED" : "updated",
+			       job->t_write);
+			continue;
+		}
+		printf("%s: %s backup %.1f KiB/s, write %.1f KiB/s, verify %.1f KiB/s\n",
+		       job->path, job->result ? "FAILED" : "updated",
+		       kib_per_sec(CCAT_FLASH_SIZE, job->t_backup),
+		       kib_per_sec(job->len, job->t_write),
+		       kib_per_sec(job->len, job->t_verify));
+		free((void *)job->backup_path);
+	}
+	printf("%zu device(s) processed in %.1f s, %d failed\n", num_jobs,
+	       now() - t, failed);
+	if (num_jobs < num_paths) {
+		fprintf(stderr, "%zu device(s) skipped\n", num_paths - num_jobs);
+		failed++;
+	}
+
+	globfree(&devices);
+	free(jobs);
+	free(image);
+	return failed ? 1 : 0;
+}
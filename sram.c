@@ -21,7 +21,7 @@ MODULE_VERSION(DRV_VERSION);
 static ssize_t __sram_read(struct cdev_buffer *buffer, char __user * buf,
 			   size_t len, loff_t * off)
 {
-	memcpy_fromio(buffer->data, buffer->ccdev->ioaddr + *off, len);
+	ccat_memcpy_fromio(buffer->data, buffer->ccdev->ioaddr + *off, len);
 	if (copy_to_user(buf, buffer->data, len))
 		return -EFAULT;
 
@@ -57,7 +57,7 @@ static ssize_t ccat_sram_write(struct file *const f, const char __user * buf,
 		return -EFAULT;
 	}
 
-	memcpy_toio(buffer->ccdev->ioaddr + *off, buffer->data, len);
+	ccat_memcpy_toio(buffer->ccdev->ioaddr + *off, buffer->data, len);
 
 	*off += len;
 	return len;
@@ -5,71 +5,897 @@
     Author: Steffen Dirkwinkel <s.dirkwinkel@beckhoff.com>
 */
 
+#include <linux/capability.h>
 #include <linux/clocksource.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
 #include <linux/io.h>
 #include <linux/io-64-nonatomic-lo-hi.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/ptp_clock_kernel.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include "ccat_systemtime.h"
 #include "module.h"
 
 #define CCAT_SYSTEMTIME_RATING 140
+#define CCAT_SYSTEMTIME_DEVICES_MAX 4
+#define CCAT_SYSTEMTIME_BENCH_ROUNDS 4
+#define CCAT_SYSTEMTIME_BENCH_READS 64
+#define CCAT_XTSTAMP_TRIES 8
+#define CCAT_SERVO_INTERVAL msecs_to_jiffies(100)
+#define CCAT_SERVO_MAX_PPB (1000 * 1000LL)
+#define CCAT_SLEEP_REFINE_NS (10 * NSEC_PER_MSEC)
+#define CCAT_SLEEP_MAX_NS (3600 * NSEC_PER_SEC)
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
+typedef cycle_t ccat_cycles_t;
+#else
+typedef u64 ccat_cycles_t;
+#endif
+
+static unsigned int clocksource_bits = IS_ENABLED(CONFIG_64BIT) ? 64 : 32;
+module_param(clocksource_bits, uint, 0444);
+MODULE_PARM_DESC(clocksource_bits,
+		 "32: read only the low word of the systemtime, 64: full range (default: native word size)");
+
+static bool mmap_shared_page;
+module_param(mmap_shared_page, bool, 0444);
+MODULE_PARM_DESC(mmap_shared_page,
+		 "allow mmap() for everybody even if registers of other CCAT functions are in the same page (default: false, CAP_SYS_RAWIO only)");
+
+/**
+ * struct ccat_xtstamp_stats - quality of the cross timestamps
+ * @samples: number of cross timestamps taken
+ * @window_min: narrowest bracket (ns) of a selected sample
+ * @window_max: widest bracket (ns) of a selected sample
+ * @window_sum: sum of all selected brackets (ns) to calculate the average
+ * @offset: last CCAT systemtime - CLOCK_REALTIME (ns)
+ */
+struct ccat_xtstamp_stats {
+	u64 samples;
+	u64 window_min;
+	u64 window_max;
+	u64 window_sum;
+	s64 offset;
+};
+
+/**
+ * struct ccat_systemtime_servo - CCAT systemtime in terms of CLOCK_MONOTONIC
+ * @lock: protects the reference sample and the rate against the servo work
+ * @ref_ccat: CCAT systemtime of the last reference sample
+ * @ref_mono: CLOCK_MONOTONIC of the last reference sample
+ * @rate_ppb: filtered frequency offset of CCAT systemtime vs. CLOCK_MONOTONIC
+ * @samples: number of reference samples taken
+ * @work: takes a new reference sample every CCAT_SERVO_INTERVAL
+ * @users_lock: serializes start and stop of @work
+ * @users: number of users of the servo, @work only runs while > 0
+ */
+struct ccat_systemtime_servo {
+	seqlock_t lock;
+	u64 ref_ccat;
+	ktime_t ref_mono;
+	s64 rate_ppb;
+	u64 samples;
+	struct delayed_work work;
+	struct mutex users_lock;
+	unsigned int users;
+};
 
 /**
  * struct ccat_systemtime - CCAT Systemtime function
- * @ioaddr: PCI base address of the CCAT Update function
+ * @ioaddr: PCI base address of the CCAT Systemtime function
+ * @phys: bus address of the systemtime register, used for mmap()
+ * @clock: clocksource registered with the kernel
+ * @ccdev: read-only character device used to map the register to user space
+ * @ptp_info: capabilities of the (read-only) PTP clock
+ * @ptp: PTP clock providing PTP_SYS_OFFSET_EXTENDED and _PRECISE
+ * @xtstamp_lock: protects @xtstamp
+ * @xtstamp: cross timestamp statistics, shown in debugfs
+ * @debugfs: debugfs directory of this function
+ * @read32_ns: measured cost of a 32 bit clocksource read
+ * @read64_ns: measured cost of a tear-free 64 bit clocksource read
+ * @servo: drift estimation used to sleep until a given systemtime
  */
 struct ccat_systemtime {
 	void __iomem *ioaddr;
+	phys_addr_t phys;
+	bool page_shared;
 	struct clocksource clock;
+	struct ccat_cdev *ccdev;
+	struct ptp_clock_info ptp_info;
+	struct ptp_clock *ptp;
+	spinlock_t xtstamp_lock;
+	struct ccat_xtstamp_stats xtstamp;
+	struct dentry *debugfs;
+	u64 read32_ns;
+	u64 read64_ns;
+	struct ccat_systemtime_servo servo;
 };
 
-static u64 ccat_systemtime_get(struct clocksource *clk)
+static ccat_cycles_t ccat_systemtime_get(struct clocksource *clk)
 {
 	struct ccat_systemtime *systemtime =
 	    container_of(clk, struct ccat_systemtime, clock);
-	return readq(systemtime->ioaddr);
+	return ccat_systemtime_read64(systemtime->ioaddr);
+}
+
+/**
+ * ccat_systemtime_get32() - clocksource read with CLOCKSOURCE_MASK(32)
+ *
+ * The timekeeping core only uses the masked bits, a single 32 bit
+ * access to the low word is all we need.
+ */
+static ccat_cycles_t ccat_systemtime_get32(struct clocksource *clk)
+{
+	struct ccat_systemtime *systemtime =
+	    container_of(clk, struct ccat_systemtime, clock);
+	return ccat_ioread32(systemtime->ioaddr);
+}
+
+/**
+ * ccat_systemtime_bench() - measure the cost of a clocksource read
+ *
+ * Return: the best average of CCAT_SYSTEMTIME_BENCH_ROUNDS rounds in ns
+ */
+static u64 ccat_systemtime_bench(struct clocksource *clk,
+				 ccat_cycles_t(*read) (struct clocksource *))
+{
+	u64 best = U64_MAX;
+	int round, i;
+
+	for (round = 0; round < CCAT_SYSTEMTIME_BENCH_ROUNDS; ++round) {
+		unsigned long flags;
+		u64 start, duration;
+
+		local_irq_save(flags);
+		start = ktime_get_ns();
+		for (i = 0; i < CCAT_SYSTEMTIME_BENCH_READS; ++i) {
+			read(clk);
+		}
+		duration = ktime_get_ns() - start;
+		local_irq_restore(flags);
+		best = min(best, duration);
+	}
+	return div_u64(best, CCAT_SYSTEMTIME_BENCH_READS);
+}
+
+/**
+ * ccat_systemtime_rating() - derive the clocksource rating from its cost
+ *
+ * Cheap reads keep the default rating, slow ones are rated down so the
+ * kernel prefers other clocksources unless 'ccat' is selected explicitly.
+ */
+static int ccat_systemtime_rating(u64 cost_ns)
+{
+	if (cost_ns <= 250) {
+		return CCAT_SYSTEMTIME_RATING;
+	}
+	if (cost_ns <= 1000) {
+		return CCAT_SYSTEMTIME_RATING - 20;
+	}
+	return CCAT_SYSTEMTIME_RATING - 40;
+}
+
+static int ccat_read_cost_show(struct seq_file *s, void *unused)
+{
+	const struct ccat_systemtime *const systemtime = s->private;
+
+	seq_printf(s, "read32_ns: %llu\n", systemtime->read32_ns);
+	seq_printf(s, "read64_ns: %llu\n", systemtime->read64_ns);
+	seq_printf(s, "bits:      %u\n", (32 == clocksource_bits) ? 32 : 64);
+	seq_printf(s, "rating:    %d\n", systemtime->clock.rating);
+	return 0;
+}
+
+static int ccat_read_cost_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_read_cost_show, inode->i_private);
+}
+
+static const struct file_operations ccat_read_cost_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_read_cost_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ccat_xtstamp_account(struct ccat_systemtime *const systemtime,
+				 u64 window, s64 offset)
+{
+	struct ccat_xtstamp_stats *const stats = &systemtime->xtstamp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&systemtime->xtstamp_lock, flags);
+	if (!stats->samples || window < stats->window_min) {
+		stats->window_min = window;
+	}
+	if (window > stats->window_max) {
+		stats->window_max = window;
+	}
+	stats->window_sum += window;
+	stats->offset = offset;
+	stats->samples++;
+	spin_unlock_irqrestore(&systemtime->xtstamp_lock, flags);
+}
+
+/**
+ * ccat_systemtime_xtstamp() - correlate CCAT systemtime with system clocks
+ * @systemtime: the CCAT Systemtime function
+ * @xtstamp: filled with the CCAT time and the system clocks at the same time
+ *
+ * Every systemtime read is bracketed by two system time snapshots with
+ * interrupts disabled. Of CCAT_XTSTAMP_TRIES samples the one with the
+ * narrowest bracket wins, the system clocks are interpolated to its middle.
+ *
+ * Return: width of the selected bracket in nanoseconds
+ */
+static u64 ccat_systemtime_xtstamp(struct ccat_systemtime *const systemtime,
+				   struct system_device_crosststamp *xtstamp)
+{
+	u64 best_window = U64_MAX;
+	int i;
+
+	for (i = 0; i < CCAT_XTSTAMP_TRIES; ++i) {
+		struct system_time_snapshot pre, post;
+		unsigned long flags;
+		u64 window;
+		u64 now;
+
+		local_irq_save(flags);
+		ktime_get_snapshot(&pre);
+		now = ccat_systemtime_read64(systemtime->ioaddr);
+		ktime_get_snapshot(&post);
+		local_irq_restore(flags);
+
+		window = ktime_to_ns(ktime_sub(post.raw, pre.raw));
+		if (window < best_window) {
+			best_window = window;
+			xtstamp->device = ns_to_ktime(now);
+			xtstamp->sys_realtime =
+			    ktime_add_ns(pre.real,
+					 ktime_to_ns(ktime_sub
+						     (post.real, pre.real)) / 2);
+			xtstamp->sys_monoraw = ktime_add_ns(pre.raw, window / 2);
+		}
+	}
+	ccat_xtstamp_account(systemtime, best_window,
+			     ktime_to_ns(ktime_sub(xtstamp->device,
+						   xtstamp->sys_realtime)));
+	return best_window;
+}
+
+static int ccat_ptp_getcrosststamp(struct ptp_clock_info *ptp,
+				   struct system_device_crosststamp *xtstamp)
+{
+	struct ccat_systemtime *const systemtime =
+	    container_of(ptp, struct ccat_systemtime, ptp_info);
+
+	ccat_systemtime_xtstamp(systemtime, xtstamp);
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+/**
+ * ccat_ptp_gettimex64() - PTP_SYS_OFFSET_EXTENDED callback
+ *
+ * Like ccat_systemtime_xtstamp() but with the pre/post timestamps of the
+ * PTP core, so they are taken from the clock requested by user space.
+ */
+static int ccat_ptp_gettimex64(struct ptp_clock_info *ptp,
+			       struct timespec64 *ts,
+			       struct ptp_system_timestamp *sts)
+{
+	struct ccat_systemtime *const systemtime =
+	    container_of(ptp, struct ccat_systemtime, ptp_info);
+	struct ptp_system_timestamp best_sts;
+	u64 best_window = U64_MAX;
+	u64 best = 0;
+	int i;
+
+	if (!sts) {
+		*ts = ns_to_timespec64(ccat_systemtime_read64(systemtime->ioaddr));
+		return 0;
+	}
+
+	for (i = 0; i < CCAT_XTSTAMP_TRIES; ++i) {
+		struct ptp_system_timestamp try_sts = *sts;
+		unsigned long flags;
+		u64 window;
+		u64 now;
+
+		local_irq_save(flags);
+		ptp_read_system_prets(&try_sts);
+		now = ccat_systemtime_read64(systemtime->ioaddr);
+		ptp_read_system_postts(&try_sts);
+		local_irq_restore(flags);
+
+		window = timespec64_to_ns(&try_sts.post_ts) -
+		    timespec64_to_ns(&try_sts.pre_ts);
+		if (window < best_window) {
+			best_window = window;
+			best_sts = try_sts;
+			best = now;
+		}
+	}
+	*sts = best_sts;
+	*ts = ns_to_timespec64(best);
+	ccat_xtstamp_account(systemtime, best_window,
+			     best - timespec64_to_ns(&sts->pre_ts) -
+			     best_window / 2);
+	return 0;
+}
+#else
+static int ccat_ptp_gettime64(struct ptp_clock_info *ptp,
+			      struct timespec64 *ts)
+{
+	struct ccat_systemtime *const systemtime =
+	    container_of(ptp, struct ccat_systemtime, ptp_info);
+
+	*ts = ns_to_timespec64(ccat_systemtime_read64(systemtime->ioaddr));
+	return 0;
+}
+#endif
+
+/**
+ * The CCAT systemtime is controlled by the FPGA, the PTP clock is read-only.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+static int ccat_ptp_adjfine(struct ptp_clock_info *ptp, long scaled_ppm)
+{
+	return -EOPNOTSUPP;
+}
+#else
+static int ccat_ptp_adjfreq(struct ptp_clock_info *ptp, s32 ppb)
+{
+	return -EOPNOTSUPP;
+}
+#endif
+
+static int ccat_ptp_adjtime(struct ptp_clock_info *ptp, s64 delta)
+{
+	return -EOPNOTSUPP;
+}
+
+static int ccat_ptp_settime64(struct ptp_clock_info *ptp,
+			      const struct timespec64 *ts)
+{
+	return -EOPNOTSUPP;
+}
+
+static int ccat_ptp_enable(struct ptp_clock_info *ptp,
+			   struct ptp_clock_request *rq, int on)
+{
+	return -EOPNOTSUPP;
+}
+
+static const struct ptp_clock_info ccat_ptp_info = {
+	.owner = THIS_MODULE,
+	.name = "ccat_systemtime",
+	.max_adj = 0,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+	.adjfine = ccat_ptp_adjfine,
+#else
+	.adjfreq = ccat_ptp_adjfreq,
+#endif
+	.adjtime = ccat_ptp_adjtime,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	.gettimex64 = ccat_ptp_gettimex64,
+#else
+	.gettime64 = ccat_ptp_gettime64,
+#endif
+	.getcrosststamp = ccat_ptp_getcrosststamp,
+	.settime64 = ccat_ptp_settime64,
+	.enable = ccat_ptp_enable,
+};
+
+/**
+ * ccat_xtstamp_show() - debugfs view of the cross timestamp quality
+ *
+ * Each read takes a fresh cross timestamp, so 'cat' can be used to sample.
+ */
+static int ccat_xtstamp_show(struct seq_file *s, void *unused)
+{
+	struct ccat_systemtime *const systemtime = s->private;
+	struct system_device_crosststamp xtstamp;
+	struct ccat_xtstamp_stats stats;
+	unsigned long flags;
+	u64 window;
+
+	window = ccat_systemtime_xtstamp(systemtime, &xtstamp);
+
+	spin_lock_irqsave(&systemtime->xtstamp_lock, flags);
+	stats = systemtime->xtstamp;
+	spin_unlock_irqrestore(&systemtime->xtstamp_lock, flags);
+
+	seq_printf(s, "systemtime:   %lld\n", ktime_to_ns(xtstamp.device));
+	seq_printf(s, "realtime:     %lld\n", ktime_to_ns(xtstamp.sys_realtime));
+	seq_printf(s, "monoraw:      %lld\n", ktime_to_ns(xtstamp.sys_monoraw));
+	seq_printf(s, "window:       %llu\n", window);
+	seq_printf(s, "tries:        %d\n", CCAT_XTSTAMP_TRIES);
+	seq_printf(s, "samples:      %llu\n", stats.samples);
+	seq_printf(s, "window_min:   %llu\n", stats.window_min);
+	seq_printf(s, "window_avg:   %llu\n",
+		   stats.samples ? div64_u64(stats.window_sum,
+					     stats.samples) : 0);
+	seq_printf(s, "window_max:   %llu\n", stats.window_max);
+	seq_printf(s, "offset:       %lld\n", stats.offset);
+	return 0;
+}
+
+static int ccat_xtstamp_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_xtstamp_show, inode->i_private);
+}
+
+static const struct file_operations ccat_xtstamp_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_xtstamp_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * ccat_systemtime_sample_mono() - cross timestamp against CLOCK_MONOTONIC
+ * @systemtime: the CCAT Systemtime function
+ * @mono: CLOCK_MONOTONIC in the middle of the narrowest bracket
+ *
+ * Return: CCAT systemtime of the narrowest bracket
+ */
+static u64 ccat_systemtime_sample_mono(struct ccat_systemtime *const systemtime,
+				       ktime_t * mono)
+{
+	s64 best_window = S64_MAX;
+	u64 best = 0;
+	int i;
+
+	for (i = 0; i < CCAT_XTSTAMP_TRIES; ++i) {
+		unsigned long flags;
+		ktime_t pre, post;
+		s64 window;
+		u64 now;
+
+		local_irq_save(flags);
+		pre = ktime_get();
+		now = ccat_systemtime_read64(systemtime->ioaddr);
+		post = ktime_get();
+		local_irq_restore(flags);
+
+		window = ktime_to_ns(ktime_sub(post, pre));
+		if (window < best_window) {
+			best_window = window;
+			best = now;
+			*mono = ktime_add_ns(pre, window / 2);
+		}
+	}
+	return best;
+}
+
+/**
+ * ccat_systemtime_servo_update() - take a new reference sample
+ *
+ * The frequency offset between two reference samples is filtered with a
+ * 1/8 EWMA. Offsets beyond CCAT_SERVO_MAX_PPB are caused by somebody
+ * setting the systemtime, in that case only the reference is moved. They
+ * are rejected before scaling to ppb, which could overflow otherwise.
+ */
+static void ccat_systemtime_servo_update(struct ccat_systemtime *const
+					 systemtime)
+{
+	struct ccat_systemtime_servo *const servo = &systemtime->servo;
+	ktime_t mono;
+	const u64 now = ccat_systemtime_sample_mono(systemtime, &mono);
+	const s64 d_mono = ktime_to_ns(ktime_sub(mono, servo->ref_mono));
+	const s64 d_ccat = now - servo->ref_ccat;
+
+	write_seqlock(&servo->lock);
+	if (servo->samples && d_mono > 0) {
+		const s64 diff = d_ccat - d_mono;
+		const s64 limit =
+		    min_t(s64, div_s64(d_mono, NSEC_PER_SEC / CCAT_SERVO_MAX_PPB),
+			  S64_MAX / NSEC_PER_SEC);
+
+		if (diff > -limit && diff < limit) {
+			const s64 ppb = div64_s64(diff * NSEC_PER_SEC, d_mono);
+
+			servo->rate_ppb = (servo->samples > 1) ?
+			    servo->rate_ppb + (ppb - servo->rate_ppb) / 8 : ppb;
+		}
+	}
+	servo->ref_ccat = now;
+	servo->ref_mono = mono;
+	servo->samples++;
+	write_sequnlock(&servo->lock);
+}
+
+static void ccat_systemtime_servo_work(struct work_struct *work)
+{
+	struct ccat_systemtime *const systemtime =
+	    container_of(to_delayed_work(work), struct ccat_systemtime,
+			 servo.work);
+
+	ccat_systemtime_servo_update(systemtime);
+	schedule_delayed_work(&systemtime->servo.work, CCAT_SERVO_INTERVAL);
+}
+
+static void ccat_systemtime_servo_get(struct ccat_systemtime *const systemtime)
+{
+	struct ccat_systemtime_servo *const servo = &systemtime->servo;
+
+	mutex_lock(&servo->users_lock);
+	if (!servo->users++) {
+		ccat_systemtime_servo_update(systemtime);
+		schedule_delayed_work(&servo->work, CCAT_SERVO_INTERVAL);
+	}
+	mutex_unlock(&servo->users_lock);
+}
+
+static void ccat_systemtime_servo_put(struct ccat_systemtime *const systemtime)
+{
+	struct ccat_systemtime_servo *const servo = &systemtime->servo;
+
+	mutex_lock(&servo->users_lock);
+	if (!--servo->users) {
+		cancel_delayed_work_sync(&servo->work);
+	}
+	mutex_unlock(&servo->users_lock);
+}
+
+/**
+ * ccat_systemtime_to_mono() - convert a CCAT systemtime to CLOCK_MONOTONIC
+ * @systemtime: the CCAT Systemtime function, the servo has to be running
+ * @target: CCAT systemtime to convert
+ *
+ * Targets in the past convert to now. Targets further ahead than
+ * CCAT_SLEEP_MAX_NS are converted as if they were CCAT_SLEEP_MAX_NS ahead,
+ * which keeps the scaling within 64 bit; the caller converts again after
+ * waking up.
+ */
+static ktime_t ccat_systemtime_to_mono(struct ccat_systemtime *const
+				       systemtime, u64 target)
+{
+	const struct ccat_systemtime_servo *const servo = &systemtime->servo;
+	const u64 now = ccat_systemtime_read64(systemtime->ioaddr);
+	unsigned int seq;
+	ktime_t mono;
+	u64 ref_ccat;
+	s64 delta;
+	s64 rate;
+
+	if (target <= now) {
+		return ktime_get();
+	}
+
+	do {
+		seq = read_seqbegin(&servo->lock);
+		ref_ccat = servo->ref_ccat;
+		rate = servo->rate_ppb;
+		mono = servo->ref_mono;
+	} while (read_seqretry(&servo->lock, seq));
+
+	/* |rate| < CCAT_SERVO_MAX_PPB, so delta * rate fits for delta < 2^43 */
+	delta = clamp_t(s64, now - ref_ccat, 0, CCAT_SLEEP_MAX_NS);
+	delta += min_t(u64, target - now, CCAT_SLEEP_MAX_NS);
+	delta -= div64_s64(delta * rate, NSEC_PER_SEC + rate);
+	return ktime_add_ns(mono, delta);
+}
+
+/**
+ * ccat_systemtime_sleep_until() - CCAT_SYSTEMTIME_SLEEP_UNTIL
+ *
+ * The target is converted to CLOCK_MONOTONIC with the current drift
+ * estimate and slept for with an absolute hrtimer. Sleeps longer than
+ * CCAT_SLEEP_REFINE_NS wake up early once to pick up a fresher estimate.
+ */
+static long ccat_systemtime_sleep_until(struct ccat_systemtime *const
+					systemtime,
+					struct ccat_systemtime_sleep __user *
+					arg)
+{
+	struct ccat_systemtime_sleep req;
+
+	if (copy_from_user(&req, arg, sizeof(req))) {
+		return -EFAULT;
+	}
+
+	for (;;) {
+		ktime_t expires = ccat_systemtime_to_mono(systemtime, req.target);
+		const s64 remaining = ktime_to_ns(ktime_sub(expires, ktime_get()));
+
+		if (remaining <= 0) {
+			break;
+		}
+		if (remaining > CCAT_SLEEP_REFINE_NS) {
+			expires = ktime_sub_ns(expires, CCAT_SLEEP_REFINE_NS / 2);
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS);
+		if (signal_pending(current)) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	req.woken = ccat_systemtime_read64(systemtime->ioaddr);
+	if (copy_to_user(arg, &req, sizeof(req))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static int ccat_servo_show(struct seq_file *s, void *unused)
+{
+	struct ccat_systemtime *const systemtime = s->private;
+	const struct ccat_systemtime_servo *const servo = &systemtime->servo;
+	unsigned int seq;
+	u64 samples;
+	s64 rate;
+	s64 age;
+
+	do {
+		seq = read_seqbegin(&servo->lock);
+		samples = servo->samples;
+		rate = servo->rate_ppb;
+		age = ktime_to_ns(ktime_sub(ktime_get(), servo->ref_mono));
+	} while (read_seqretry(&servo->lock, seq));
+
+	seq_printf(s, "users:        %u\n", servo->users);
+	seq_printf(s, "samples:      %llu\n", samples);
+	seq_printf(s, "rate_ppb:     %lld\n", rate);
+	seq_printf(s, "ref_age_ns:   %lld\n", samples ? age : 0);
+	return 0;
+}
+
+static int ccat_servo_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_servo_show, inode->i_private);
+}
+
+static const struct file_operations ccat_servo_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_servo_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int ccat_systemtime_open(struct inode *const i, struct file *const f)
+{
+	struct ccat_cdev *const ccdev =
+	    container_of(i->i_cdev, struct ccat_cdev, cdev);
+
+	if (f->f_mode & FMODE_WRITE) {
+		return -EPERM;
+	}
+	if (!ccdev->private_data) {
+		return -ENODEV;
+	}
+	f->private_data = ccdev->private_data;
+	ccat_systemtime_servo_get(f->private_data);
+	return nonseekable_open(i, f);
+}
+
+static int ccat_systemtime_release(struct inode *const i, struct file *const f)
+{
+	ccat_systemtime_servo_put(f->private_data);
+	return 0;
+}
+
+/**
+ * ccat_systemtime_read() - syscall fallback for readers without mmap()
+ *
+ * Return: the current systemtime as 64 bit value in host byte order
+ */
+static ssize_t ccat_systemtime_read(struct file *const f, char __user * buf,
+				    size_t len, loff_t * off)
+{
+	struct ccat_systemtime *const systemtime = f->private_data;
+	const u64 now = ccat_systemtime_read64(systemtime->ioaddr);
+
+	if (len < sizeof(now)) {
+		return -EINVAL;
+	}
+	if (copy_to_user(buf, &now, sizeof(now))) {
+		return -EFAULT;
+	}
+	return sizeof(now);
 }
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
 /**
- * function ccat_systemtime_get_cycles - returns cycles for clocksource
- * return microseconds instead of nanoseconds to make ntp speed
- * adjustment work
+ * ccat_systemtime_page_shared() - check for foreign registers in the page
+ * @func: the CCAT systemtime function
+ *
+ * The CCAT functions are packed into BAR0, so the page mapped by
+ * ccat_systemtime_mmap() usually holds the registers of other functions
+ * or the info block table at the start of BAR0, too.
+ *
+ * Return: true if the info block table or any other function overlaps
+ * the systemtime's page
  */
-static cycle_t ccat_systemtime_get_cycles(struct clocksource *clk)
+static bool ccat_systemtime_page_shared(const struct ccat_function *func)
 {
-	return (cycle_t) ccat_systemtime_get(clk);
+	static const size_t block_size = sizeof(struct ccat_info_block);
+	void __iomem *const base = func->ccat->bar_0;
+	const u8 num_func = ccat_ioread8(base + 4);
+	const u64 page = func->info.addr & PAGE_MASK;
+	struct ccat_info_block info;
+	u8 i;
+
+	if (page < (u64) num_func * block_size) {
+		return true;
+	}
+
+	for (i = 0; i < num_func; ++i) {
+		ccat_memcpy_fromio(&info, base + i * block_size, sizeof(info));
+		if (CCATINFO_NOTUSED == info.type
+		    || info.addr == func->info.addr) {
+			continue;
+		}
+		if (info.addr < page + PAGE_SIZE
+		    && (u64) info.addr + info.size > page) {
+			return true;
+		}
+	}
+	return false;
 }
+
+/**
+ * ccat_systemtime_mmap() - map the page containing the systemtime register
+ *
+ * The mapping is uncached and read-only, the register offset within the
+ * page is provided by CCAT_SYSTEMTIME_GET_MMAP_OFFSET. A page shared with
+ * other CCAT functions exposes their registers, too. It is only mapped for
+ * CAP_SYS_RAWIO or with the mmap_shared_page module parameter, everybody
+ * else falls back to read().
+ */
+static int ccat_systemtime_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct ccat_systemtime *const systemtime = f->private_data;
+
+	if (vma->vm_pgoff || (vma->vm_end - vma->vm_start) != PAGE_SIZE) {
+		return -EINVAL;
+	}
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
+	}
+	if (systemtime->page_shared && !mmap_shared_page
+	    && !capable(CAP_SYS_RAWIO)) {
+		return -EACCES;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
 #endif
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	return io_remap_pfn_range(vma, vma->vm_start,
+				  systemtime->phys >> PAGE_SHIFT, PAGE_SIZE,
+				  vma->vm_page_prot);
+}
+
+static long ccat_systemtime_ioctl(struct file *f, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ccat_systemtime *const systemtime = f->private_data;
+	const __u32 offset = systemtime->phys & (PAGE_SIZE - 1);
+
+	switch (cmd) {
+	case CCAT_SYSTEMTIME_GET_MMAP_OFFSET:
+		return put_user(offset, (__u32 __user *) arg);
+	case CCAT_SYSTEMTIME_SLEEP_UNTIL:
+		return ccat_systemtime_sleep_until(systemtime,
+						   (struct ccat_systemtime_sleep
+						    __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static struct ccat_cdev dev_table[CCAT_SYSTEMTIME_DEVICES_MAX];
+static struct ccat_class cdev_class = {
+	.count = CCAT_SYSTEMTIME_DEVICES_MAX,
+	.devices = dev_table,
+	.name = "ccat_systemtime",
+	.fops = {
+		 .owner = THIS_MODULE,
+		 .open = ccat_systemtime_open,
+		 .release = ccat_systemtime_release,
+		 .read = ccat_systemtime_read,
+		 .mmap = ccat_systemtime_mmap,
+		 .unlocked_ioctl = ccat_systemtime_ioctl,
+		 .compat_ioctl = ccat_systemtime_ioctl,
+		 },
+};
 
 static int ccat_systemtime_probe(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_systemtime *const systemtime =
 	    devm_kzalloc(&pdev->dev, sizeof(*systemtime), GFP_KERNEL);
+	int status;
 
 	if (!systemtime)
 		return -ENOMEM;
 
 	systemtime->ioaddr = func->ccat->bar_0 + func->info.addr;
+	systemtime->phys = func->ccat->bar_0_phys + func->info.addr;
+	systemtime->page_shared = ccat_systemtime_page_shared(func);
+	spin_lock_init(&systemtime->xtstamp_lock);
+	seqlock_init(&systemtime->servo.lock);
+	mutex_init(&systemtime->servo.users_lock);
+	INIT_DELAYED_WORK(&systemtime->servo.work, ccat_systemtime_servo_work);
 	func->private_data = systemtime;
 
+	systemtime->read32_ns =
+	    ccat_systemtime_bench(&systemtime->clock, ccat_systemtime_get32);
+	systemtime->read64_ns =
+	    ccat_systemtime_bench(&systemtime->clock, ccat_systemtime_get);
+
 	systemtime->clock.name = "ccat";
-	systemtime->clock.rating = CCAT_SYSTEMTIME_RATING;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
-	systemtime->clock.read = ccat_systemtime_get;
-#else
-	systemtime->clock.read = ccat_systemtime_get_cycles;
-#endif
-	systemtime->clock.mask = CLOCKSOURCE_MASK(32);
+	if (32 == clocksource_bits) {
+		systemtime->clock.read = ccat_systemtime_get32;
+		systemtime->clock.mask = CLOCKSOURCE_MASK(32);
+		systemtime->clock.rating =
+		    ccat_systemtime_rating(systemtime->read32_ns);
+	} else {
+		systemtime->clock.read = ccat_systemtime_get;
+		systemtime->clock.mask = CLOCKSOURCE_MASK(64);
+		systemtime->clock.rating =
+		    ccat_systemtime_rating(systemtime->read64_ns);
+	}
+	pr_info("clocksource read cost: %llu ns (32 bit), %llu ns (64 bit) -> using %u bit, rating %d\n",
+		systemtime->read32_ns, systemtime->read64_ns,
+		(32 == clocksource_bits) ? 32 : 64, systemtime->clock.rating);
 	systemtime->clock.mult = 1;
 	systemtime->clock.shift = 0;
 	systemtime->clock.owner = THIS_MODULE;
 	systemtime->clock.flags = CLOCK_SOURCE_IS_CONTINUOUS;
-	return clocksource_register_hz(&systemtime->clock, NSEC_PER_SEC);
+	status = clocksource_register_hz(&systemtime->clock, NSEC_PER_SEC);
+	if (status) {
+		return status;
+	}
+
+	/* the character device is optional, the clocksource works without */
+	systemtime->ccdev = ccat_cdev_create(func, &cdev_class, sizeof(u64));
+	if (systemtime->ccdev) {
+		systemtime->ccdev->private_data = systemtime;
+	} else {
+		pr_warn("%s(): no character device available\n", __FUNCTION__);
+	}
+
+	systemtime->ptp_info = ccat_ptp_info;
+	systemtime->ptp = ptp_clock_register(&systemtime->ptp_info, &pdev->dev);
+	if (IS_ERR(systemtime->ptp)) {
+		pr_warn("%s(): register PTP clock failed with %ld\n",
+			__FUNCTION__, PTR_ERR(systemtime->ptp));
+		systemtime->ptp = NULL;
+	} else if (systemtime->ptp) {
+		pr_info("registered %s as ptp%d\n", dev_name(&pdev->dev),
+			ptp_clock_index(systemtime->ptp));
+	}
+
+	systemtime->debugfs = debugfs_create_dir(dev_name(&pdev->dev), NULL);
+	debugfs_create_file("crosststamp", 0444, systemtime->debugfs,
+			    systemtime, &ccat_xtstamp_fops);
+	debugfs_create_file("read_cost", 0444, systemtime->debugfs,
+			    systemtime, &ccat_read_cost_fops);
+	debugfs_create_file("servo", 0444, systemtime->debugfs,
+			    systemtime, &ccat_servo_fops);
+	return 0;
 }
 
 static int ccat_systemtime_remove(struct platform_device *pdev)
@@ -77,6 +903,17 @@ static int ccat_systemtime_remove(struct platform_device *pdev)
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_systemtime *const systemtime = func->private_data;
 
+	debugfs_remove_recursive(systemtime->debugfs);
+	if (systemtime->ptp) {
+		ptp_clock_unregister(systemtime->ptp);
+	}
+	if (systemtime->ccdev) {
+		ccat_cdev_destroy(systemtime->ccdev);
+	}
+	/* files still open across the unbind must not keep the servo running */
+	mutex_lock(&systemtime->servo.users_lock);
+	cancel_delayed_work_sync(&systemtime->servo.work);
+	mutex_unlock(&systemtime->servo.users_lock);
 	clocksource_unregister(&systemtime->clock);
 	return 0;
 };
@@ -0,0 +1,623 @@
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    EtherCAT traffic generator and receiver to validate driver changes.
+    TX threads send 0x88a4 frames with a single NOP datagram through
+    PACKET_MMAP TPACKET_V3 rings, an RX thread receives them back from the
+    EtherCAT segment (or a loopback cable) through a TPACKET_V3 RX ring.
+    Each datagram carries its TX thread (index), a sequence number
+    (address) and the CLOCK_REALTIME TX time, the round trip time is taken
+    against the kernel RX timestamp.
+
+    Build: make tools
+    Usage: ecat_burst -i <if> [-I <rx if>] [-s <size>] [-r <pps>] [-t <threads>]
+                      [-b <batch>] [-p busy|sleep] [-d <seconds>] [-a <cpu>]
+                      [-c <csv file>] [-l <label>]
+
+    f.e. ecat_burst -i eth2 -s 128 -r 100000 -t 2 -c results.csv -l "v0.16"
+    sends 100000 frames/s of 128 bytes from two threads for 10 seconds and
+    appends pps, throughput, loss and latency percentiles to results.csv.
+    Requires CAP_NET_RAW and kernel >= 4.11 (TPACKET_V3 TX ring).
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef ETH_P_ETHERCAT
+#define ETH_P_ETHERCAT 0x88a4
+#endif
+
+#define ECAT_HDR_LEN 2
+#define ECAT_DGRAM_HDR_LEN 10
+#define ECAT_WKC_LEN 2
+#define ECAT_DATA_OFFSET (ETH_HLEN + ECAT_HDR_LEN + ECAT_DGRAM_HDR_LEN)
+#define ECAT_OVERHEAD (ECAT_DATA_OFFSET + ECAT_WKC_LEN)
+#define FRAME_MIN 60
+#define FRAME_MAX 1514
+#define MAGIC 0x54414343u	/* "CCAT" */
+#define THREADS_MAX 16
+#define TX_FRAME_SIZE 2048
+#define TX_FRAMES 256
+#define RX_BLOCK_SIZE (1 << 20)
+#define RX_BLOCKS 16
+#define RX_DRAIN_NS 200000000ull
+#define LAT_BUCKET_NS 100
+#define LAT_BUCKETS 100000	/* up to 10 ms */
+
+/**
+ * struct payload - datagram data behind the EtherCAT datagram header
+ */
+struct payload {
+	uint32_t magic;
+	uint64_t tx_ns;
+} __attribute__ ((packed));
+
+struct config {
+	const char *tx_if;
+	const char *rx_if;
+	size_t size;
+	uint64_t rate;
+	unsigned int threads;
+	unsigned int batch;
+	int busy;
+	unsigned int seconds;
+	int cpu;
+	const char *csv;
+	const char *label;
+	uint8_t mac[ETH_ALEN];
+};
+
+struct rx_thread {
+	pthread_t thread;
+	int fd;
+	uint8_t *ring;
+};
+
+struct tx_thread {
+	pthread_t thread;
+	unsigned int id;
+	int fd;
+	uint8_t *ring;
+	uint64_t sent;
+	uint64_t ring_full;
+	uint64_t send_errors;
+};
+
+/**
+ * struct rx_stats - what came back
+ * @received: valid frames per TX thread
+ * @foreign: 0x88a4 frames not sent by us
+ * @hist: round trip time histogram, LAT_BUCKET_NS per bucket
+ */
+struct rx_stats {
+	uint64_t received[THREADS_MAX];
+	uint64_t foreign;
+	uint64_t bytes;
+	uint64_t lat_min;
+	uint64_t lat_max;
+	uint64_t lat_count;
+	uint64_t hist[LAT_BUCKETS + 1];
+};
+
+static struct config cfg = {
+	.size = FRAME_MIN,
+	.threads = 1,
+	.batch = 16,
+	.busy = 1,
+	.seconds = 10,
+	.cpu = -1,
+	.label = "",
+};
+
+static volatile int tx_stop;
+static volatile int rx_stop;
+static struct rx_stats rx;
+
+static uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin(int offset)
+{
+	cpu_set_t set;
+
+	if (cfg.cpu < 0) {
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cfg.cpu + offset, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static int open_ring(const char *ifname, int protocol, int optname,
+		     struct tpacket_req3 *req, uint8_t ** ring)
+{
+	const int version = TPACKET_V3;
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = protocol,
+		.sll_ifindex = if_nametoindex(ifname),
+	};
+	const size_t len = (size_t)req->tp_block_size * req->tp_block_nr;
+	int fd;
+
+	if (!addr.sll_ifindex) {
+		fprintf(stderr, "%s: no such interface\n", ifname);
+		return -1;
+	}
+	fd = socket(AF_PACKET, SOCK_RAW, protocol);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version))
+	    || setsockopt(fd, SOL_PACKET, optname, req, sizeof(*req))) {
+		perror("setsockopt");
+		goto close_fd;
+	}
+	*ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == *ring) {
+		perror("mmap");
+		goto close_fd;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("bind");
+		munmap(*ring, len);
+		goto close_fd;
+	}
+	return fd;
+close_fd:
+	close(fd);
+	return -1;
+}
+
+/**
+ * build_frame() - Ethernet + EtherCAT header + one NOP datagram
+ */
+static void build_frame(uint8_t * frame, unsigned int id)
+{
+	const size_t data_len = cfg.size - ECAT_OVERHEAD;
+	const uint16_t ecat_hdr = htole16((data_len + ECAT_DGRAM_HDR_LEN +
+					   ECAT_WKC_LEN) | (1 << 12));
+	const uint16_t dgram_len = htole16(data_len);
+	const uint16_t type = htons(ETH_P_ETHERCAT);
+
+	memset(frame, 0, cfg.size);
+	memset(frame, 0xff, ETH_ALEN);
+	memcpy(frame + ETH_ALEN, cfg.mac, ETH_ALEN);
+	memcpy(frame + 2 * ETH_ALEN, &type, sizeof(type));
+	memcpy(frame + ETH_HLEN, &ecat_hdr, sizeof(ecat_hdr));
+	frame[ETH_HLEN + ECAT_HDR_LEN] = 0;	/* NOP */
+	frame[ETH_HLEN + ECAT_HDR_LEN + 1] = id;
+	memcpy(frame + ETH_HLEN + ECAT_HDR_LEN + 6, &dgram_len,
+	       sizeof(dgram_len));
+}
+
+static void stamp_frame(uint8_t * frame, uint32_t seq)
+{
+	const struct payload p = {
+		.magic = htole32(MAGIC),
+		.tx_ns = htole64(now_ns(CLOCK_REALTIME)),
+	};
+
+	seq = htole32(seq);
+	memcpy(frame + ETH_HLEN + ECAT_HDR_LEN + 2, &seq, sizeof(seq));
+	memcpy(frame + ECAT_DATA_OFFSET, &p, sizeof(p));
+}
+
+static void pace(uint64_t next)
+{
+	struct timespec ts;
+
+	if (cfg.busy) {
+		while (now_ns(CLOCK_MONOTONIC) < next) ;
+		return;
+	}
+	ts.tv_sec = next / 1000000000ull;
+	ts.tv_nsec = next % 1000000000ull;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * tx_main() - fill up to @batch due frames, then flush them with send()
+ *
+ * Each thread sends rate/threads frames per second, 0 sends as fast as
+ * the TX ring drains.
+ */
+static void *tx_main(void *arg)
+{
+	struct tx_thread *const t = arg;
+	const size_t hdr_len = TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+	const uint64_t interval = cfg.rate ?
+	    1000000000ull * cfg.threads / cfg.rate : 0;
+	uint64_t next = now_ns(CLOCK_MONOTONIC);
+	unsigned int i, idx = 0;
+
+	pin(1 + t->id);
+	for (i = 0; i < TX_FRAMES; ++i) {
+		build_frame(t->ring + i * TX_FRAME_SIZE + hdr_len, t->id);
+	}
+
+	while (!tx_stop) {
+		unsigned int due = cfg.batch, queued = 0;
+
+		if (interval) {
+			const uint64_t now = now_ns(CLOCK_MONOTONIC);
+
+			if (now < next) {
+				pace(next);
+				continue;
+			}
+			due = (now - next) / interval + 1;
+			due = due < cfg.batch ? due : cfg.batch;
+		}
+
+		for (; queued < due; ++queued) {
+			struct tpacket3_hdr *const hdr =
+			    (void *)(t->ring + idx * TX_FRAME_SIZE);
+
+			if (TP_STATUS_WRONG_FORMAT & hdr->tp_status) {
+				fprintf(stderr, "TX ring: wrong format\n");
+				tx_stop = 1;
+				break;
+			}
+			if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+				t->ring_full++;
+				break;
+			}
+			stamp_frame((uint8_t *) hdr + hdr_len, t->sent++);
+			hdr->tp_len = cfg.size;
+			hdr->tp_next_offset = 0;
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+					 __ATOMIC_RELEASE);
+			idx = (idx + 1) % TX_FRAMES;
+		}
+		if (queued && send(t->fd, NULL, 0, MSG_DONTWAIT) < 0
+		    && errno != EAGAIN && errno != ENOBUFS) {
+			t->send_errors++;
+		}
+		next += queued * interval;
+	}
+	send(t->fd, NULL, 0, 0);
+	return NULL;
+}
+
+static void rx_frame(const struct tpacket3_hdr *hdr)
+{
+	const struct sockaddr_ll *const sll =
+	    (const void *)((const uint8_t *)hdr +
+			   TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	const uint8_t *const frame = (const uint8_t *)hdr + hdr->tp_mac;
+	const uint64_t rx_ns = hdr->tp_sec * 1000000000ull + hdr->tp_nsec;
+	struct payload p;
+	uint64_t lat;
+	unsigned int id;
+
+	if (PACKET_OUTGOING == sll->sll_pkttype) {
+		return;
+	}
+	if (hdr->tp_snaplen < ECAT_DATA_OFFSET + sizeof(p)) {
+		rx.foreign++;
+		return;
+	}
+	memcpy(&p, frame + ECAT_DATA_OFFSET, sizeof(p));
+	id = frame[ETH_HLEN + ECAT_HDR_LEN + 1];
+	if (le32toh(p.magic) != MAGIC || id >= cfg.threads) {
+		rx.foreign++;
+		return;
+	}
+
+	rx.received[id]++;
+	rx.bytes += hdr->tp_len;
+	lat = rx_ns - le64toh(p.tx_ns);
+	if ((int64_t) lat < 0) {
+		lat = 0;
+	}
+	if (!rx.lat_count++ || lat < rx.lat_min) {
+		rx.lat_min = lat;
+	}
+	if (lat > rx.lat_max) {
+		rx.lat_max = lat;
+	}
+	lat /= LAT_BUCKET_NS;
+	rx.hist[lat < LAT_BUCKETS ? lat : LAT_BUCKETS]++;
+}
+
+static void *rx_main(void *arg)
+{
+	const struct rx_thread *const t = arg;
+	struct pollfd pfd = {.fd = t->fd,.events = POLLIN };
+	unsigned int block = 0;
+
+	pin(0);
+	while (!rx_stop) {
+		struct tpacket_block_desc *const desc =
+		    (void *)(t->ring + block * RX_BLOCK_SIZE);
+		const struct tpacket3_hdr *hdr;
+		unsigned int i;
+
+		if (!(__atomic_load_n(&desc->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+			poll(&pfd, 1, 10);
+			continue;
+		}
+		hdr = (void *)((uint8_t *) desc +
+			       desc->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < desc->hdr.bh1.num_pkts; ++i) {
+			rx_frame(hdr);
+			hdr = (void *)((uint8_t *) hdr + hdr->tp_next_offset);
+		}
+		__atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		block = (block + 1) % RX_BLOCKS;
+	}
+	return NULL;
+}
+
+static uint64_t percentile(double p)
+{
+	const uint64_t target = rx.lat_count * p;
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!rx.lat_count) {
+		return 0;
+	}
+	for (i = 0; i <= LAT_BUCKETS; ++i) {
+		sum += rx.hist[i];
+		if (sum > target) {
+			break;
+		}
+	}
+	return i < LAT_BUCKETS ? (i + 1) * LAT_BUCKET_NS : rx.lat_max;
+}
+
+static void report(const struct tx_thread *tx, double seconds)
+{
+	static const char header[] =
+	    "time,label,tx_if,rx_if,size,threads,rate,seconds,sent,received,lost,"
+	    "loss_pct,tx_pps,rx_pps,tx_mbit,rx_mbit,ring_full,send_errors,"
+	    "lat_min_ns,lat_p50_ns,lat_p90_ns,lat_p99_ns,lat_p999_ns,lat_max_ns\n";
+	uint64_t sent = 0, received = 0, ring_full = 0, send_errors = 0, lost;
+	double loss, tx_pps, rx_pps;
+	struct stat st;
+	unsigned int i;
+	FILE *f;
+
+	for (i = 0; i < cfg.threads; ++i) {
+		sent += tx[i].sent;
+		ring_full += tx[i].ring_full;
+		send_errors += tx[i].send_errors;
+		received += rx.received[i];
+	}
+	lost = sent > received ? sent - received : 0;
+	loss = sent ? 100.0 * lost / sent : 0;
+	tx_pps = sent / seconds;
+	rx_pps = received / seconds;
+
+	printf("sent:      %llu frames, %.0f pps, %.1f Mbit/s\n",
+	       (unsigned long long)sent, tx_pps, tx_pps * cfg.size * 8 / 1e6);
+	printf("received:  %llu frames, %.0f pps, %.1f Mbit/s\n",
+	       (unsigned long long)received, rx_pps,
+	       rx.bytes * 8 / seconds / 1e6);
+	printf("lost:      %llu (%.3f %%), foreign: %llu, ring full: %llu, send errors: %llu\n",
+	       (unsigned long long)lost, loss, (unsigned long long)rx.foreign,
+	       (unsigned long long)ring_full, (unsigned long long)send_errors);
+	printf("rtt (ns):  min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+	       (unsigned long long)rx.lat_min,
+	       (unsigned long long)percentile(0.5),
+	       (unsigned long long)percentile(0.9),
+	       (unsigned long long)percentile(0.99),
+	       (unsigned long long)percentile(0.999),
+	       (unsigned long long)rx.lat_max);
+
+	if (!cfg.csv) {
+		return;
+	}
+	f = fopen(cfg.csv, "a");
+	if (!f) {
+		perror(cfg.csv);
+		return;
+	}
+	if (fstat(fileno(f), &st) || !st.st_size) {
+		fputs(header, f);
+	}
+	fprintf(f,
+		"%llu,%s,%s,%s,%zu,%u,%llu,%.3f,%llu,%llu,%llu,%.4f,%.0f,%.0f,%.3f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		(unsigned long long)time(NULL), cfg.label, cfg.tx_if,
+		cfg.rx_if, cfg.size, cfg.threads,
+		(unsigned long long)cfg.rate, seconds,
+		(unsigned long long)sent, (unsigned long long)received,
+		(unsigned long long)lost, loss, tx_pps, rx_pps,
+		tx_pps * cfg.size * 8 / 1e6, rx.bytes * 8 / seconds / 1e6,
+		(unsigned long long)ring_full,
+		(unsigned long long)send_errors,
+		(unsigned long long)rx.lat_min,
+		(unsigned long long)percentile(0.5),
+		(unsigned long long)percentile(0.9),
+		(unsigned long long)percentile(0.99),
+		(unsigned long long)percentile(0.999),
+		(unsigned long long)rx.lat_max);
+	fclose(f);
+}
+
+static int get_mac(const char *ifname, uint8_t * mac)
+{
+	struct ifreq ifr = { 0 };
+	const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int status;
+
+	if (fd < 0) {
+		return -1;
+	}
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	status = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	close(fd);
+	if (!status) {
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	}
+	return status;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s -i <if> [-I <rx if>] [-s <size>] [-r <pps>] [-t <threads>]\n"
+		"          [-b <batch>] [-p busy|sleep] [-d <seconds>] [-a <cpu>]\n"
+		"          [-c <csv file>] [-l <label>]\n"
+		"  -i  interface to send on\n"
+		"  -I  interface to receive on (default: same as -i)\n"
+		"  -s  frame size without FCS, %d..%d (default: %d)\n"
+		"  -r  total frames per second, 0: as fast as possible (default: 0)\n"
+		"  -t  TX threads, 1..%d (default: 1)\n"
+		"  -b  maximum number of frames per send() (default: 16)\n"
+		"  -p  wait for the next frame spinning (busy) or sleeping (default: busy)\n"
+		"  -d  duration in seconds (default: 10)\n"
+		"  -a  pin the RX thread to <cpu>, TX thread n to <cpu> + 1 + n\n"
+		"  -c  append the results to a CSV file\n"
+		"  -l  label of the CSV line, f.e. a driver version\n",
+		argv0, FRAME_MIN, FRAME_MAX, FRAME_MIN, THREADS_MAX);
+}
+
+int main(int argc, char **argv)
+{
+	struct tx_thread tx[THREADS_MAX] = { 0 };
+	struct tpacket_req3 tx_req = {
+		.tp_block_size = TX_FRAME_SIZE * TX_FRAMES,
+		.tp_block_nr = 1,
+		.tp_frame_size = TX_FRAME_SIZE,
+		.tp_frame_nr = TX_FRAMES,
+	};
+	struct tpacket_req3 rx_req = {
+		.tp_block_size = RX_BLOCK_SIZE,
+		.tp_block_nr = RX_BLOCKS,
+		.tp_frame_size = TX_FRAME_SIZE,
+		.tp_frame_nr = RX_BLOCK_SIZE / TX_FRAME_SIZE * RX_BLOCKS,
+		.tp_retire_blk_tov = 1,
+	};
+	struct rx_thread rx_thread;
+	uint64_t start, end;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:I:s:r:t:b:p:d:a:c:l:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg.tx_if = optarg;
+			break;
+		case 'I':
+			cfg.rx_if = optarg;
+			break;
+		case 's':
+			cfg.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg.rate = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg.threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.busy = !strcmp(optarg, "busy");
+			break;
+		case 'd':
+			cfg.seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			cfg.cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.csv = optarg;
+			break;
+		case 'l':
+			cfg.label = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!cfg.rx_if) {
+		cfg.rx_if = cfg.tx_if;
+	}
+	if (!cfg.tx_if || cfg.size < FRAME_MIN || cfg.size > FRAME_MAX
+	    || !cfg.threads || cfg.threads > THREADS_MAX || !cfg.batch
+	    || cfg.batch > TX_FRAMES) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (get_mac(cfg.tx_if, cfg.mac)) {
+		perror(cfg.tx_if);
+		return 1;
+	}
+
+	rx_thread.fd = open_ring(cfg.rx_if, htons(ETH_P_ETHERCAT),
+				 PACKET_RX_RING, &rx_req, &rx_thread.ring);
+	if (rx_thread.fd < 0) {
+		return 1;
+	}
+	for (i = 0; i < cfg.threads; ++i) {
+		tx[i].id = i;
+		tx[i].fd = open_ring(cfg.tx_if, 0, PACKET_TX_RING, &tx_req,
+				     &tx[i].ring);
+		if (tx[i].fd < 0) {
+			return 1;
+		}
+	}
+
+	if (pthread_create(&rx_thread.thread, NULL, rx_main, &rx_thread)) {
+		fprintf(stderr, "start RX thread failed\n");
+		return 1;
+	}
+	start = now_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < cfg.threads; ++i) {
+		if (pthread_create(&tx[i].thread, NULL, tx_main, &tx[i])) {
+			fprintf(stderr, "start TX thread %u failed\n", i);
+			return 1;
+		}
+	}
+
+	sleep(cfg.seconds);
+	tx_stop = 1;
+	for (i = 0; i < cfg.threads; ++i) {
+		pthread_join(tx[i].thread, NULL);
+	}
+	end = now_ns(CLOCK_MONOTONIC);
+
+	/* wait for the last frames to return */
+	usleep(RX_DRAIN_NS / 1000);
+	rx_stop = 1;
+	pthread_join(rx_thread.thread, NULL);
+
+	report(tx, (end - start) / 1e9);
+	return 0;
+}
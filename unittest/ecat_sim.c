@@ -0,0 +1,755 @@
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    EtherCAT segment emulator, a chain of simple slaves in user space.
+    It receives EtherCAT frames on an interface, lets every datagram pass
+    the emulated slaves and sends the frame back after the per slave
+    forwarding delay and the wire time of the frame. Each slave has a
+    RAM register map, position (AP*), configured address (FP*),
+    broadcast (B*) and read-multiple-write (ARMW, FRMW) datagrams access
+    it and increment the working counter like an ESC does. Logical
+    datagrams (LRD, LWR, LRW) access a fixed process data window per
+    slave, which echoes the outputs of a cycle as its inputs.
+    AL control writes are acknowledged in the AL status register, the
+    SII EEPROM, mailboxes and distributed clocks are not emulated.
+
+    Build: make tools
+    Usage: ecat_sim -i <if> [-n <slaves>] [-D <ns>] [-r <mbit/s>]
+                    [-p <bytes>] [-L <logical address>] [-F <address>]
+                    [-d <seconds>] [-P <prio>] [-a <cpu>] [-b]
+
+    f.e. on a veth pair, the benchmarks use the other end:
+    ip link add ecat0 type veth peer name ecat1
+    ip link set ecat0 up && ip link set ecat1 up
+    ecat_sim -i ecat1 -n 256 -P 90 -a 2 -b &
+    ecat_cyclic -i ecat0 -f 10000 -P 90 -a 3
+
+    Connected by cable to a CCAT port, a second NIC running ecat_sim
+    replaces the terminals for driver benchmarks.
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef ETH_P_ETHERCAT
+#define ETH_P_ETHERCAT 0x88a4
+#endif
+
+#define ECAT_HDR_LEN 2
+#define ECAT_HDR_TYPE_CMD 1
+#define ECAT_DGRAM_HDR_LEN 10
+#define ECAT_WKC_LEN 2
+#define ECAT_LEN_MASK 0x07ff
+#define ECAT_MORE 0x8000
+#define ETH_OVERHEAD 24		/* preamble, FCS and interframe gap */
+
+#define SLAVES_MAX 4096
+#define SLAVE_RAM 0x2000
+#define REG_TYPE 0x0000
+#define REG_STATION 0x0010
+#define REG_AL_CONTROL 0x0120
+#define REG_AL_STATUS 0x0130
+#define PD_OUT 0x1000
+#define PD_IN 0x1800
+#define PD_MAX (PD_IN - PD_OUT)
+#define QUEUE_LEN 1024
+#define POLL_MIN_NS 100000	/* spin on shorter waits, poll() is too coarse */
+
+#define ACC_READ 1
+#define ACC_WRITE 2
+#define ACC_RW (ACC_READ | ACC_WRITE)
+
+/* a write adds 1 to the working counter, only that of a RW command adds 2 */
+#define WKC_WRITE(access) (ACC_RW == (access) ? 2 : 1)
+
+enum ecat_cmd {
+	ECAT_NOP,
+	ECAT_APRD,
+	ECAT_APWR,
+	ECAT_APRW,
+	ECAT_FPRD,
+	ECAT_FPWR,
+	ECAT_FPRW,
+	ECAT_BRD,
+	ECAT_BWR,
+	ECAT_BRW,
+	ECAT_LRD,
+	ECAT_LWR,
+	ECAT_LRW,
+	ECAT_ARMW,
+	ECAT_FRMW,
+	ECAT_CMD_MAX,
+};
+
+static const unsigned int cmd_access[ECAT_CMD_MAX] = {
+	[ECAT_APRD] = ACC_READ,[ECAT_APWR] = ACC_WRITE,[ECAT_APRW] = ACC_RW,
+	[ECAT_FPRD] = ACC_READ,[ECAT_FPWR] = ACC_WRITE,[ECAT_FPRW] = ACC_RW,
+	[ECAT_BRD] = ACC_READ,[ECAT_BWR] = ACC_WRITE,[ECAT_BRW] = ACC_RW,
+	[ECAT_LRD] = ACC_READ,[ECAT_LWR] = ACC_WRITE,[ECAT_LRW] = ACC_RW,
+};
+
+/**
+ * struct slave - register and process data memory of an emulated ESC
+ */
+struct slave {
+	uint8_t ram[SLAVE_RAM];
+};
+
+/**
+ * struct pending - processed frame waiting for its return time
+ * @due: CLOCK_MONOTONIC time in ns, when the frame leaves the segment
+ */
+struct pending {
+	uint64_t due;
+	ssize_t len;
+	uint8_t frame[ETH_FRAME_LEN];
+};
+
+/**
+ * struct stats - counters of the run
+ * @dropped: frames lost, because QUEUE_LEN frames were in flight
+ * @invalid: frames with a malformed EtherCAT header or datagram
+ * @lag_sum: sum of the delays between due and send time
+ * @lag_max: worst delay between due and send time
+ */
+struct stats {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t datagrams;
+	uint64_t dropped;
+	uint64_t invalid;
+	uint64_t lag_sum;
+	uint64_t lag_max;
+	uint64_t cmds[ECAT_CMD_MAX];
+};
+
+static const char *const cmd_names[ECAT_CMD_MAX] = {
+	"NOP", "APRD", "APWR", "APRW", "FPRD", "FPWR", "FPRW", "BRD",
+	"BWR", "BRW", "LRD", "LWR", "LRW", "ARMW", "FRMW",
+};
+
+static struct {
+	const char *ifname;
+	unsigned int slaves;
+	unsigned int delay;
+	unsigned int rate;
+	unsigned int pd_len;
+	uint32_t logical;
+	long station;
+	unsigned int seconds;
+	int priority;
+	int cpu;
+	int busy;
+} cfg = {
+	.slaves = 8,
+	.delay = 1000,
+	.rate = 100,
+	.pd_len = 2,
+	.station = -1,
+	.priority = 80,
+	.cpu = -1,
+};
+
+static struct slave *slaves;
+static int32_t station_map[0x10000];
+static struct pending queue[QUEUE_LEN];
+static struct stats stats;
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint16_t get16(const uint8_t * p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16toh(v);
+}
+
+static uint32_t get32(const uint8_t * p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+static void put16(uint8_t * p, uint16_t v)
+{
+	v = htole16(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+/**
+ * slave_init() - power on state of slave number @pos
+ */
+static void slave_init(unsigned int pos)
+{
+	struct slave *const s = &slaves[pos];
+
+	memset(s->ram, 0, sizeof(s->ram));
+	s->ram[REG_TYPE] = 0x11;	/* ET1100 */
+	s->ram[REG_AL_STATUS] = 0x01;	/* INIT */
+	if (cfg.station >= 0) {
+		const uint16_t station = cfg.station + pos;
+
+		put16(s->ram + REG_STATION, station);
+		station_map[station] = pos;
+	}
+}
+
+/**
+ * slave_write() - store @len bytes of @data at @ado of slave @pos
+ *
+ * Writes to the configured station address update the FP* lookup, AL
+ * control requests are accepted immediately.
+ *
+ * Return: 1 if the slave took part, 0 if @ado is out of range
+ */
+static unsigned int slave_write(unsigned int pos, uint16_t ado,
+				const uint8_t * data, size_t len)
+{
+	struct slave *const s = &slaves[pos];
+	const uint16_t old = get16(s->ram + REG_STATION);
+
+	if (ado + len > SLAVE_RAM) {
+		return 0;
+	}
+	memcpy(s->ram + ado, data, len);
+	if (ado < REG_STATION + 2 && ado + len > REG_STATION) {
+		if (station_map[old] == (int32_t) pos) {
+			station_map[old] = -1;
+		}
+		station_map[get16(s->ram + REG_STATION)] = pos;
+	}
+	if (ado <= REG_AL_CONTROL && ado + len > REG_AL_CONTROL) {
+		s->ram[REG_AL_STATUS] = s->ram[REG_AL_CONTROL] & 0x0f;
+	}
+	return 1;
+}
+
+/**
+ * slave_read() - read @len bytes at @ado of slave @pos into @data,
+ * broadcast reads (@or) combine the data of all slaves bitwise
+ *
+ * Return: 1 if the slave took part, 0 if @ado is out of range
+ */
+static unsigned int slave_read(unsigned int pos, uint16_t ado,
+			       uint8_t * data, size_t len, int or)
+{
+	const uint8_t *const src = slaves[pos].ram + ado;
+	size_t i;
+
+	if (ado + len > SLAVE_RAM) {
+		return 0;
+	}
+	if (or) {
+		for (i = 0; i < len; ++i) {
+			data[i] |= src[i];
+		}
+	} else {
+		memcpy(data, src, len);
+	}
+	return 1;
+}
+
+/**
+ * slave_access() - physical access of a datagram to slave @pos
+ *
+ * Read/write datagrams return the memory content from before the write,
+ * as reading and writing happen in the same pass of the frame.
+ */
+static unsigned int slave_access(unsigned int pos, unsigned int access,
+				 uint16_t ado, uint8_t * data, size_t len,
+				 int or)
+{
+	uint8_t in[ECAT_LEN_MASK + 1];
+	unsigned int wkc = 0;
+
+	if (access & ACC_WRITE) {
+		memcpy(in, data, len);
+	}
+	if (access & ACC_READ) {
+		wkc += slave_read(pos, ado, data, len, or);
+	}
+	if ((access & ACC_WRITE) && slave_write(pos, ado, in, len)) {
+		wkc += WKC_WRITE(access);
+	}
+	return wkc;
+}
+
+/**
+ * logical_access() - LRD, LWR and LRW on the process data windows
+ *
+ * Slave n owns the cfg.pd_len bytes at cfg.logical + n * cfg.pd_len,
+ * outputs are stored at PD_OUT and copied to PD_IN, so a slave
+ * returns the outputs of the previous cycle as its inputs.
+ *
+ * Return: the sum of all working counter increments
+ */
+static unsigned int logical_access(unsigned int access, uint32_t lad,
+				   uint8_t * data, size_t len)
+{
+	const uint64_t start = (uint64_t) lad;
+	const uint64_t end = start + len;
+	const uint64_t first = cfg.logical;
+	const uint64_t last = first + (uint64_t) cfg.slaves * cfg.pd_len;
+	unsigned int pos, wkc = 0;
+	uint64_t from, to;
+
+	if (end <= first || start >= last) {
+		return 0;
+	}
+	pos = (start > first) ? (start - first) / cfg.pd_len : 0;
+	for (; pos < cfg.slaves; ++pos) {
+		const uint64_t window = first + (uint64_t) pos * cfg.pd_len;
+		struct slave *const s = &slaves[pos];
+
+		if (window >= end) {
+			break;
+		}
+		from = (start > window) ? start : window;
+		to = (end < window + cfg.pd_len) ? end : window + cfg.pd_len;
+		if (access & ACC_WRITE) {
+			memcpy(s->ram + PD_OUT + (from - window),
+			       data + (from - start), to - from);
+			wkc += WKC_WRITE(access);
+		}
+		if (access & ACC_READ) {
+			memcpy(data + (from - start),
+			       s->ram + PD_IN + (from - window), to - from);
+			wkc += 1;
+		}
+		if (access & ACC_WRITE) {
+			memcpy(s->ram + PD_IN + (from - window),
+			       s->ram + PD_OUT + (from - window), to - from);
+		}
+	}
+	return wkc;
+}
+
+/**
+ * process_datagram() - pass one datagram through the whole segment
+ * @dgram: datagram header, followed by @len bytes data and the wkc
+ */
+static void process_datagram(uint8_t * dgram, size_t len)
+{
+	const uint8_t cmd = dgram[0];
+	const uint16_t adp = get16(dgram + 2);
+	const uint16_t ado = get16(dgram + 4);
+	uint8_t *const data = dgram + ECAT_DGRAM_HDR_LEN;
+	const unsigned int access = cmd < ECAT_CMD_MAX ? cmd_access[cmd] : 0;
+	unsigned int wkc = get16(data + len);
+	unsigned int pos;
+	int32_t target;
+
+	stats.cmds[cmd < ECAT_CMD_MAX ? cmd : ECAT_NOP]++;
+	switch (cmd) {
+	case ECAT_APRD:
+	case ECAT_APWR:
+	case ECAT_APRW:
+		/* each slave increments the address, position 0 handles it */
+		pos = (uint16_t) - adp;
+		if (pos < cfg.slaves) {
+			wkc += slave_access(pos, access, ado, data, len, 0);
+		}
+		put16(dgram + 2, adp + cfg.slaves);
+		break;
+	case ECAT_FPRD:
+	case ECAT_FPWR:
+	case ECAT_FPRW:
+		target = station_map[adp];
+		if (target >= 0) {
+			wkc += slave_access(target, access, ado, data, len, 0);
+		}
+		break;
+	case ECAT_BRD:
+	case ECAT_BWR:
+	case ECAT_BRW:
+		for (pos = 0; pos < cfg.slaves; ++pos) {
+			wkc += slave_access(pos, access, ado, data, len, 1);
+		}
+		put16(dgram + 2, adp + cfg.slaves);
+		break;
+	case ECAT_LRD:
+	case ECAT_LWR:
+	case ECAT_LRW:
+		wkc += logical_access(access, get32(dgram + 2), data, len);
+		break;
+	case ECAT_ARMW:
+	case ECAT_FRMW:
+		/* the addressed slave reads, all following ones write */
+		if (ECAT_ARMW == cmd) {
+			target = (uint16_t) - adp;
+			put16(dgram + 2, adp + cfg.slaves);
+		} else {
+			target = station_map[adp];
+		}
+		if (target < 0 || (unsigned int)target >= cfg.slaves) {
+			break;
+		}
+		wkc += slave_read(target, ado, data, len, 0);
+		for (pos = target + 1; pos < cfg.slaves; ++pos) {
+			wkc += slave_write(pos, ado, data, len);
+		}
+		break;
+	default:
+		break;
+	}
+	put16(data + len, wkc);
+}
+
+/**
+ * process_frame() - pass all datagrams of @frame through the segment
+ *
+ * Return: 0 on success, -1 if the frame is no valid EtherCAT frame
+ */
+static int process_frame(uint8_t * frame, ssize_t n)
+{
+	const uint16_t hdr = get16(frame + ETH_HLEN);
+	const size_t end = ETH_HLEN + ECAT_HDR_LEN + (hdr & ECAT_LEN_MASK);
+	size_t offset = ETH_HLEN + ECAT_HDR_LEN;
+	uint16_t flags;
+	size_t len;
+
+	if (n < ETH_HLEN + ECAT_HDR_LEN || end > (size_t)n
+	    || ECAT_HDR_TYPE_CMD != (hdr >> 12)) {
+		return -1;
+	}
+	do {
+		if (offset + ECAT_DGRAM_HDR_LEN > end) {
+			return -1;
+		}
+		flags = get16(frame + offset + 6);
+		len = flags & ECAT_LEN_MASK;
+		if (offset + ECAT_DGRAM_HDR_LEN + len + ECAT_WKC_LEN > end) {
+			return -1;
+		}
+		process_datagram(frame + offset, len);
+		stats.datagrams++;
+		offset += ECAT_DGRAM_HDR_LEN + len + ECAT_WKC_LEN;
+	} while (flags & ECAT_MORE);
+
+	/* the first slave marks the frame as processed */
+	frame[ETH_ALEN] |= 0x02;
+	return 0;
+}
+
+/**
+ * wire_ns() - time @len bytes occupy the link at cfg.rate Mbit/s
+ */
+static uint64_t wire_ns(ssize_t len)
+{
+	if (!cfg.rate) {
+		return 0;
+	}
+	return (uint64_t) (len + ETH_OVERHEAD) * 8000 / cfg.rate;
+}
+
+static int open_raw(const char *ifname, int *loopback)
+{
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ETHERCAT),
+		.sll_ifindex = if_nametoindex(ifname),
+	};
+	struct ifreq ifr = { 0 };
+	int fd, one = 1;
+
+	if (!addr.sll_ifindex) {
+		fprintf(stderr, "%s: no such interface\n", ifname);
+		return -1;
+	}
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ETHERCAT));
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+#ifdef PACKET_IGNORE_OUTGOING
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr)
+	    || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(ifname);
+		close(fd);
+		return -1;
+	}
+	*loopback = !!(ifr.ifr_flags & IFF_LOOPBACK);
+	return fd;
+}
+
+static void setup_realtime(void)
+{
+	struct sched_param param = {.sched_priority = cfg.priority };
+	cpu_set_t set;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		perror("Warning: mlockall");
+	}
+	if (cfg.priority
+	    && sched_setscheduler(0, SCHED_FIFO, &param)) {
+		perror("Warning: SCHED_FIFO");
+	}
+	if (cfg.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cfg.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			perror("Warning: sched_setaffinity");
+		}
+	}
+}
+
+/**
+ * send_due() - return all frames, which passed the segment until @now
+ */
+static void send_due(int fd, size_t * tail, size_t head, uint64_t now)
+{
+	struct pending *p;
+	uint64_t lag;
+
+	while (*tail != head && (p = &queue[*tail % QUEUE_LEN])->due <= now) {
+		lag = now - p->due;
+		stats.lag_sum += lag;
+		if (lag > stats.lag_max) {
+			stats.lag_max = lag;
+		}
+		if (send(fd, p->frame, p->len, 0) != p->len) {
+			stats.dropped++;
+		}
+		++*tail;
+		now = now_ns();
+	}
+}
+
+/**
+ * run() - receive, process and delay frames until stopped
+ *
+ * Frames are pipelined like on a real segment: a frame returns after
+ * the forwarding delay of all slaves, but not before the previous one
+ * was completely on the wire.
+ */
+static void run(int fd, int loopback)
+{
+	const uint64_t forward = (uint64_t) cfg.slaves * cfg.delay;
+	const uint64_t deadline = cfg.seconds ?
+	    now_ns() + cfg.seconds * 1000000000ull : UINT64_MAX;
+	uint8_t scratch[ETH_FRAME_LEN];
+	struct pollfd pfd = {.fd = fd,.events = POLLIN };
+	struct sockaddr_ll from;
+	socklen_t from_len;
+	size_t head = 0, tail = 0;
+	uint64_t now, last_due = 0, due;
+	struct pending *p;
+	uint8_t *buf;
+	ssize_t n;
+	int ms;
+
+	while (!stop && (now = now_ns()) < deadline) {
+		send_due(fd, &tail, head, now);
+		if (tail == head) {
+			ms = 100;
+		} else {
+			due = queue[tail % QUEUE_LEN].due;
+			now = now_ns();
+			ms = (due > now + POLL_MIN_NS) ?
+			    (due - now) / 1000000 : 0;
+		}
+		if (!cfg.busy && ms && poll(&pfd, 1, ms) <= 0) {
+			continue;
+		}
+
+		p = &queue[head % QUEUE_LEN];
+		buf = (head - tail < QUEUE_LEN) ? p->frame : scratch;
+		from_len = sizeof(from);
+		n = recvfrom(fd, buf, ETH_FRAME_LEN, MSG_DONTWAIT,
+			     (struct sockaddr *)&from, &from_len);
+		if (n <= 0 || PACKET_OUTGOING == from.sll_pkttype) {
+			continue;
+		}
+		if (loopback && (buf[ETH_ALEN] & 0x02)) {
+			/* our own reply, looped back */
+			continue;
+		}
+		now = now_ns();
+		if (buf == scratch) {
+			stats.dropped++;
+			continue;
+		}
+		if (process_frame(buf, n)) {
+			stats.invalid++;
+			continue;
+		}
+		due = now + forward + wire_ns(n);
+		if (due < last_due + wire_ns(n)) {
+			due = last_due + wire_ns(n);
+		}
+		p->due = last_due = due;
+		p->len = n;
+		stats.frames++;
+		stats.bytes += n;
+		++head;
+	}
+	while (tail != head) {
+		send_due(fd, &tail, head, now_ns());
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s -i <if> [-n <slaves>] [-D <ns>] [-r <mbit/s>] [-p <bytes>]\n"
+		"          [-L <logical address>] [-F <address>] [-d <seconds>]\n"
+		"          [-P <prio>] [-a <cpu>] [-b]\n"
+		"  -i  interface the master is connected to\n"
+		"  -n  number of slaves, 1..%d (default: 8)\n"
+		"  -D  forwarding delay per slave in ns (default: 1000)\n"
+		"  -r  link rate in Mbit/s to add the wire time, 0 to disable (default: 100)\n"
+		"  -p  process data bytes per slave, 1..%d (default: 2)\n"
+		"  -L  logical address of the first slaves process data (default: 0)\n"
+		"  -F  configured station address of the first slave, the following\n"
+		"      are numbered consecutively (default: unset, like after power on)\n"
+		"  -d  stop after <seconds> (default: run until SIGINT)\n"
+		"  -P  SCHED_FIFO priority, 0 for SCHED_OTHER (default: 80)\n"
+		"  -a  pin to <cpu>\n"
+		"  -b  busy poll instead of sleeping in poll()\n",
+		argv0, SLAVES_MAX, PD_MAX);
+}
+
+int main(int argc, char **argv)
+{
+	const struct sigaction sa = {.sa_handler = on_signal };
+	double seconds;
+	uint64_t start;
+	unsigned int pos;
+	int opt, fd, loopback;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "i:n:D:r:p:L:F:d:P:a:bh")) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg.ifname = optarg;
+			break;
+		case 'n':
+			cfg.slaves = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			cfg.delay = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.pd_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			cfg.logical = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			cfg.station = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			cfg.priority = strtol(optarg, NULL, 0);
+			break;
+		case 'a':
+			cfg.cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.busy = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!cfg.ifname || !cfg.slaves || cfg.slaves > SLAVES_MAX
+	    || !cfg.pd_len || cfg.pd_len > PD_MAX
+	    || cfg.station + cfg.slaves > 0x10000) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	slaves = calloc(cfg.slaves, sizeof(*slaves));
+	if (!slaves) {
+		perror("calloc");
+		return 1;
+	}
+	memset(station_map, 0xff, sizeof(station_map));
+	for (pos = 0; pos < cfg.slaves; ++pos) {
+		slave_init(pos);
+	}
+
+	fd = open_raw(cfg.ifname, &loopback);
+	if (fd < 0) {
+		return 1;
+	}
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	setup_realtime();
+
+	printf("%s: %u slaves, %u ns per slave, %u Mbit/s, %u bytes process data at 0x%08x\n",
+	       cfg.ifname, cfg.slaves, cfg.delay, cfg.rate, cfg.pd_len,
+	       cfg.logical);
+	start = now_ns();
+	run(fd, loopback);
+	seconds = (now_ns() - start) / 1e9;
+	close(fd);
+	free(slaves);
+
+	printf("frames:   %llu (%.0f/s), %llu bytes, %llu datagrams\n",
+	       (unsigned long long)stats.frames, stats.frames / seconds,
+	       (unsigned long long)stats.bytes,
+	       (unsigned long long)stats.datagrams);
+	printf("errors:   dropped %llu, invalid %llu\n",
+	       (unsigned long long)stats.dropped,
+	       (unsigned long long)stats.invalid);
+	printf("send lag: avg %llu max %llu ns\n",
+	       (unsigned long long)(stats.frames ?
+				    stats.lag_sum / stats.frames : 0),
+	       (unsigned long long)stats.lag_max);
+	printf("commands:");
+	for (i = 0; i < ECAT_CMD_MAX; ++i) {
+		if (stats.cmds[i]) {
+			printf(" %s %llu", cmd_names[i],
+			       (unsigned long long)stats.cmds[i]);
+		}
+	}
+	printf("\n");
+	return (stats.dropped || stats.invalid) ? 2 : 0;
+}
@@ -1,410 +1,608 @@
-/*****************************************************************************
- *
- *  $Id: main.c,v 6a6dec6fc806 2012/09/19 17:46:58 fp $
- *
- *  Copyright (C) 2007-2009  Florian Pose, Ingenieurgemeinschaft IgH
- *
- *  This file is part of the IgH EtherCAT Master.
- *
- *  The IgH EtherCAT Master is free software; you can redistribute it and/or
- *  modify it under the terms of the GNU General Public License version 2, as
- *  published by the Free Software Foundation.
- *
- *  The IgH EtherCAT Master is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
- *  Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License along
- *  with the IgH EtherCAT Master; if not, write to the Free Software
- *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
- *
- *  ---
- *
- *  The license mentioned above concerns the source code only. Using the
- *  EtherCAT technology and brand is only permitted in compliance with the
- *  industrial property and similar rights of Beckhoff Automation GmbH.
- *
- ****************************************************************************/
-
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    Cyclic EtherCAT benchmark, the base of the driver acceptance tests.
+    Every cycle the benchmark wakes up with clock_nanosleep(), sends one
+    frame with a BRD datagram and waits for it to return from the segment
+    until the end of the cycle, like a master exchanging process data.
+    Per cycle it records the wake-up jitter, the send-to-receive latency
+    and the working counter into histograms.
+
+    Build: make tools
+    Usage: ecat_cyclic -i <if>|sim[:<slaves>] [-f <hz>] [-d <seconds>]
+                       [-s <bytes>] [-w <wkc>] [-P <prio>] [-a <cpu>] [-b]
+                       [-c <csv file>] [-j <json file>] [-l <label>]
+
+    f.e. ecat_cyclic -i eth2 -f 20000 -P 90 -a 3 -j result.json
+    With "-i sim:8" the frames are handled by a simulated segment of 8
+    slaves in a second thread, so the benchmark runs without terminals.
+    Without -w the working counter of the first reply is expected in all
+    later cycles.
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
-#include <signal.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/resource.h>
-#include <sys/time.h>
-#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-/****************************************************************************/
-
-#include "ecrt.h"
-
-/****************************************************************************/
-
-// Application parameters
-#define FREQUENCY 100
-#define PRIORITY 0
-
-/****************************************************************************/
-
-// EtherCAT
-static ec_master_t *master = NULL;
-static ec_master_state_t master_state = {};
-
-static ec_domain_t *domain1 = NULL;
-static ec_domain_state_t domain1_state = {};
-
-static ec_slave_config_t *sc_ana_in = NULL;
-static ec_slave_config_state_t sc_ana_in_state = {};
-
-// Timer
-static unsigned int sig_alarms = 0;
-static unsigned int user_alarms = 0;
-
-/****************************************************************************/
-
-// process data
-static uint8_t *domain1_pd = NULL;
-
-#define BusCouplerPos  0, 4
-#define DigOutSlavePos 0, 0
-
-//#define Beckhoff_EK1100 0x00000002, 0x044c2c52
-#define Beckhoff_EK1100 0x00000002, 0x04562c52
-#define Beckhoff_EL1004 0x6000, 0x00000002, 0x03ec3052
-#define Beckhoff_EL1008 0x6000, 0x00000002, 0x03f03052
-#define Beckhoff_EL2004 0x7000, 0x00000002, 0x07d43052
-#define Beckhoff_EL2008 0x7000, 0x00000002, 0x07d83052
-#define Beckhoff_EL2032 0x00000002, 0x07f03052
-#define Beckhoff_EL3152 0x00000002, 0x0c503052
-#define Beckhoff_EL3102 0x00000002, 0x0c1e3052
-#define Beckhoff_EL4102 0x00000002, 0x10063052
-
-// offsets for PDO entries
-static unsigned int off_dig_in[2];
-static unsigned int off_dig_out[2];
-
-
-/*****************************************************************************/
-// Digital in ------------------------
-static ec_pdo_entry_info_t el1004_channels[] = {
-    {0x6000, 1, 1},
-    {0x6010, 1, 1},
-    {0x6020, 1, 1},
-    {0x6030, 1, 1},
-};
-
-static ec_pdo_info_t el1004_pdos[] = {
-    {0x1a00, 1, &el1004_channels[0]},
-    {0x1a01, 1, &el1004_channels[1]},
-    {0x1a02, 1, &el1004_channels[2]},
-    {0x1a03, 1, &el1004_channels[3]},
-};
-
-static ec_sync_info_t el1004_syncs[] = {
-    {2, EC_DIR_OUTPUT},
-    {3, EC_DIR_INPUT, 4, el1004_pdos},
-    {0xff}
-};
-
-static ec_pdo_entry_info_t el1008_channels[] = {
-    {0x6000, 1, 1},
-    {0x6010, 1, 1},
-    {0x6020, 1, 1},
-    {0x6030, 1, 1},
-    {0x6040, 1, 1},
-    {0x6050, 1, 1},
-    {0x6060, 1, 1},
-    {0x6070, 1, 1},
-};
-
-static ec_pdo_info_t el1008_pdos[] = {
-    {0x1a00, 1, &el1008_channels[0]},
-    {0x1a01, 1, &el1008_channels[1]},
-    {0x1a02, 1, &el1008_channels[2]},
-    {0x1a03, 1, &el1008_channels[3]},
-    {0x1a04, 1, &el1008_channels[4]},
-    {0x1a05, 1, &el1008_channels[5]},
-    {0x1a06, 1, &el1008_channels[6]},
-    {0x1a07, 1, &el1008_channels[7]},
-};
-
-static ec_sync_info_t el1008_syncs[] = {
-    {2, EC_DIR_OUTPUT},
-    {3, EC_DIR_INPUT, 8, el1008_pdos},
-    {0xff}
-};
-
-// Digital out ------------------------
-static ec_pdo_entry_info_t el2004_channels[] = {
-    {0x7000, 1, 1},
-    {0x7010, 1, 1},
-    {0x7020, 1, 1},
-    {0x7030, 1, 1},
-};
+#ifndef ETH_P_ETHERCAT
+#define ETH_P_ETHERCAT 0x88a4
+#endif
 
-static ec_pdo_info_t el2004_pdos[] = {
-    {0x1600, 1, &el2004_channels[0]},
-    {0x1601, 1, &el2004_channels[1]},
-    {0x1602, 1, &el2004_channels[2]},
-    {0x1603, 1, &el2004_channels[3]},
+#define ECAT_HDR_LEN 2
+#define ECAT_DGRAM_HDR_LEN 10
+#define ECAT_WKC_LEN 2
+#define ECAT_CMD_BRD 7
+#define ECAT_CMD_OFFSET (ETH_HLEN + ECAT_HDR_LEN)
+#define ECAT_DATA_OFFSET (ECAT_CMD_OFFSET + ECAT_DGRAM_HDR_LEN)
+#define FRAME_MIN 60
+#define DATA_MAX 1486
+#define FREQUENCY_MAX 50000
+#define SIM_SLAVES 8
+#define SIM_SLAVE_NS 1000
+#define HIST_BUCKET_NS 250
+#define HIST_BUCKETS 8000	/* up to 2 ms */
+#define WKC_MAX 0xffff
+
+/**
+ * struct hist - histogram of HIST_BUCKET_NS buckets, last one overflows
+ */
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS + 1];
 };
 
-static ec_sync_info_t el2004_syncs[] = {
-    {0, EC_DIR_OUTPUT, 4, el2004_pdos},
-    {1, EC_DIR_INPUT},
-    {0xff}
+/**
+ * struct result - everything recorded during the run
+ * @cycles: number of cycles
+ * @overruns: cycles skipped, because the previous one took too long
+ * @lost: cycles without reply
+ * @wkc_errors: replies with an unexpected working counter
+ * @late: replies which arrived in a later cycle
+ * @wkc: number of replies per working counter value
+ */
+struct result {
+	uint64_t cycles;
+	uint64_t overruns;
+	uint64_t lost;
+	uint64_t wkc_errors;
+	uint64_t late;
+	struct hist jitter;
+	struct hist latency;
+	uint64_t wkc[WKC_MAX + 1];
 };
 
-static ec_pdo_entry_info_t el2008_channels[] = {
-    {0x7000, 1, 1},
-    {0x7010, 1, 1},
-    {0x7020, 1, 1},
-    {0x7030, 1, 1},
-    {0x7040, 1, 1},
-    {0x7050, 1, 1},
-    {0x7060, 1, 1},
-    {0x7070, 1, 1},
+static struct {
+	const char *ifname;
+	unsigned int slaves;
+	unsigned int frequency;
+	unsigned int seconds;
+	size_t data_len;
+	int expected_wkc;
+	int priority;
+	int cpu;
+	int busy;
+	const char *csv;
+	const char *json;
+	const char *label;
+} cfg = {
+	.frequency = 1000,
+	.seconds = 10,
+	.data_len = 2,
+	.expected_wkc = -1,
+	.priority = 80,
+	.cpu = -1,
+	.label = "",
 };
 
-static ec_pdo_info_t el2008_pdos[] = {
-    {0x1600, 1, &el2008_channels[0]},
-    {0x1601, 1, &el2008_channels[1]},
-    {0x1602, 1, &el2008_channels[2]},
-    {0x1603, 1, &el2008_channels[3]},
-    {0x1604, 1, &el2008_channels[4]},
-    {0x1605, 1, &el2008_channels[5]},
-    {0x1606, 1, &el2008_channels[6]},
-    {0x1607, 1, &el2008_channels[7]}
-};
+static struct result res;
 
-static ec_sync_info_t el2008_syncs[] = {
-    {0, EC_DIR_OUTPUT, 8, el2008_pdos},
-    {1, EC_DIR_INPUT},
-    {0xff}
-};
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
 
-/*****************************************************************************/
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-void check_domain1_state(void)
+static void hist_add(struct hist *h, uint64_t value)
 {
-    ec_domain_state_t ds;
+	const uint64_t bucket = value / HIST_BUCKET_NS;
 
-    ecrt_domain_state(domain1, &ds);
+	if (!h->count++ || value < h->min) {
+		h->min = value;
+	}
+	if (value > h->max) {
+		h->max = value;
+	}
+	h->sum += value;
+	h->buckets[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS]++;
+}
 
-    if (ds.working_counter != domain1_state.working_counter)
-        printf("Domain1: WC %u.\n", ds.working_counter);
-    if (ds.wc_state != domain1_state.wc_state)
-        printf("Domain1: State %u.\n", ds.wc_state);
+/**
+ * hist_percentile() - upper bound of the bucket holding the percentile @p
+ */
+static uint64_t hist_percentile(const struct hist *h, double p)
+{
+	const uint64_t target = h->count * p;
+	uint64_t sum = 0;
+	size_t i;
 
-    domain1_state = ds;
+	if (!h->count) {
+		return 0;
+	}
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		sum += h->buckets[i];
+		if (sum > target) {
+			return (i + 1) * HIST_BUCKET_NS;
+		}
+	}
+	return h->max;
 }
 
-/*****************************************************************************/
+/**
+ * sim_main() - simulated segment of @cfg.slaves slaves
+ *
+ * Each slave adds SIM_SLAVE_NS of forwarding delay and increments the
+ * working counter of the datagram, the first one marks the source MAC
+ * as processed, like real terminals do.
+ */
+static void *sim_main(void *arg)
+{
+	const int fd = *(int *)arg;
+	uint8_t frame[ETH_FRAME_LEN];
+	uint16_t wkc, len;
+	ssize_t n;
+	uint64_t until;
+
+	while ((n = recv(fd, frame, sizeof(frame), 0)) > 0) {
+		until = now_ns() + (uint64_t) cfg.slaves * SIM_SLAVE_NS;
+		if (n >= ECAT_DATA_OFFSET + ECAT_WKC_LEN) {
+			memcpy(&len, frame + ECAT_CMD_OFFSET + 6, sizeof(len));
+			len = le16toh(len) & 0x7ff;
+			if ((size_t)ECAT_DATA_OFFSET + len + ECAT_WKC_LEN <=
+			    (size_t)n) {
+				memcpy(&wkc, frame + ECAT_DATA_OFFSET + len,
+				       sizeof(wkc));
+				wkc = htole16(le16toh(wkc) + cfg.slaves);
+				memcpy(frame + ECAT_DATA_OFFSET + len, &wkc,
+				       sizeof(wkc));
+			}
+			frame[ETH_ALEN] |= 0x02;
+		}
+		while (now_ns() < until) ;
+		if (send(fd, frame, n, 0) != n) {
+			break;
+		}
+	}
+	return NULL;
+}
 
-void check_master_state(void)
+static int open_sim(pthread_t * thread)
 {
-    ec_master_state_t ms;
+	static int sim_fd;
+	int fds[2];
 
-    ecrt_master_state(master, &ms);
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds)) {
+		perror("socketpair");
+		return -1;
+	}
+	sim_fd = fds[1];
+	if (pthread_create(thread, NULL, sim_main, &sim_fd)) {
+		fprintf(stderr, "start simulation failed\n");
+		return -1;
+	}
+	return fds[0];
+}
 
-    if (ms.slaves_responding != master_state.slaves_responding)
-        printf("%u slave(s).\n", ms.slaves_responding);
-    if (ms.al_states != master_state.al_states)
-        printf("AL states: 0x%02X.\n", ms.al_states);
-    if (ms.link_up != master_state.link_up)
-        printf("Link is %s.\n", ms.link_up ? "up" : "down");
+static int open_raw(const char *ifname, uint8_t * mac)
+{
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ETHERCAT),
+		.sll_ifindex = if_nametoindex(ifname),
+	};
+	struct ifreq ifr = { 0 };
+	int fd, one = 1;
+
+	if (!addr.sll_ifindex) {
+		fprintf(stderr, "%s: no such interface\n", ifname);
+		return -1;
+	}
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ETHERCAT));
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+#ifdef PACKET_IGNORE_OUTGOING
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr)
+	    || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror(ifname);
+		close(fd);
+		return -1;
+	}
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	return fd;
+}
 
-    master_state = ms;
+/**
+ * build_frame() - Ethernet + EtherCAT header + one BRD datagram
+ *
+ * Return: length of the frame
+ */
+static size_t build_frame(uint8_t * frame, const uint8_t * mac)
+{
+	const uint16_t type = htons(ETH_P_ETHERCAT);
+	const uint16_t ecat_hdr = htole16((cfg.data_len + ECAT_DGRAM_HDR_LEN +
+					   ECAT_WKC_LEN) | (1 << 12));
+	const uint16_t dgram_len = htole16(cfg.data_len);
+	const size_t len = ECAT_DATA_OFFSET + cfg.data_len + ECAT_WKC_LEN;
+
+	memset(frame, 0, ETH_FRAME_LEN);
+	memset(frame, 0xff, ETH_ALEN);
+	memcpy(frame + ETH_ALEN, mac, ETH_ALEN);
+	memcpy(frame + 2 * ETH_ALEN, &type, sizeof(type));
+	memcpy(frame + ETH_HLEN, &ecat_hdr, sizeof(ecat_hdr));
+	frame[ECAT_CMD_OFFSET] = ECAT_CMD_BRD;
+	memcpy(frame + ECAT_CMD_OFFSET + 6, &dgram_len, sizeof(dgram_len));
+	return len < FRAME_MIN ? FRAME_MIN : len;
 }
 
-/*****************************************************************************/
+/**
+ * receive() - wait for the reply of @seq until @deadline
+ *
+ * Replies of earlier cycles are counted as late and skipped.
+ *
+ * Return: the working counter, -1 if no reply arrived in time
+ */
+static int receive(int fd, uint8_t seq, uint64_t deadline)
+{
+	uint8_t frame[ETH_FRAME_LEN];
+	struct pollfd pfd = {.fd = fd,.events = POLLIN };
+	uint16_t wkc;
+	uint64_t now;
+	ssize_t n;
+
+	while ((now = now_ns()) < deadline) {
+		if (!cfg.busy) {
+			const int ms = (deadline - now + 999999) / 1000000;
+
+			if (poll(&pfd, 1, ms) <= 0) {
+				continue;
+			}
+		}
+		n = recv(fd, frame, sizeof(frame), MSG_DONTWAIT);
+		if (n < ECAT_DATA_OFFSET + (ssize_t) cfg.data_len + ECAT_WKC_LEN
+		    || frame[ECAT_CMD_OFFSET] != ECAT_CMD_BRD
+		    || !(frame[ETH_ALEN] & 0x02)) {
+			/* nothing received, not ours or not processed */
+			continue;
+		}
+		if (frame[ECAT_CMD_OFFSET + 1] != seq) {
+			res.late++;
+			continue;
+		}
+		memcpy(&wkc, frame + ECAT_DATA_OFFSET + cfg.data_len,
+		       sizeof(wkc));
+		return le16toh(wkc);
+	}
+	return -1;
+}
 
-void check_slave_config_states(void)
+static void setup_realtime(void)
 {
-    ec_slave_config_state_t s;
+	struct sched_param param = {.sched_priority = cfg.priority };
+	cpu_set_t set;
 
-    ecrt_slave_config_state(sc_ana_in, &s);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		perror("Warning: mlockall");
+	}
+	if (cfg.priority
+	    && sched_setscheduler(0, SCHED_FIFO, &param)) {
+		perror("Warning: SCHED_FIFO");
+	}
+	if (cfg.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cfg.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			perror("Warning: sched_setaffinity");
+		}
+	}
+}
 
-    if (s.al_state != sc_ana_in_state.al_state)
-        printf("AnaIn: State 0x%02X.\n", s.al_state);
-    if (s.online != sc_ana_in_state.online)
-        printf("AnaIn: %s.\n", s.online ? "online" : "offline");
-    if (s.operational != sc_ana_in_state.operational)
-        printf("AnaIn: %soperational.\n",
-                s.operational ? "" : "Not ");
+/**
+ * run() - the cyclic task
+ *
+ * Cycles which are already over when the previous one finished are
+ * skipped and counted as overruns.
+ */
+static void run(int fd, uint8_t * frame, size_t len)
+{
+	const uint64_t period = 1000000000ull / cfg.frequency;
+	const uint64_t cycles = (uint64_t) cfg.seconds * cfg.frequency;
+	uint64_t next = now_ns() + period;
+	struct timespec ts;
+	uint64_t wake, sent;
+	int wkc;
+
+	for (res.cycles = 0; res.cycles < cycles; ++res.cycles) {
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR) ;
+		wake = now_ns();
+		hist_add(&res.jitter, wake - next);
+
+		frame[ECAT_CMD_OFFSET + 1] = (uint8_t) res.cycles;
+		sent = now_ns();
+		if (send(fd, frame, len, 0) != (ssize_t) len) {
+			res.lost++;
+		} else if ((wkc = receive(fd, res.cycles, next + period)) < 0) {
+			res.lost++;
+		} else {
+			hist_add(&res.latency, now_ns() - sent);
+			res.wkc[wkc]++;
+			if (cfg.expected_wkc < 0) {
+				cfg.expected_wkc = wkc;
+			}
+			res.wkc_errors += (wkc != cfg.expected_wkc);
+		}
 
-    sc_ana_in_state = s;
+		next += period;
+		while (now_ns() > next + period) {
+			next += period;
+			res.overruns++;
+		}
+	}
 }
 
-/****************************************************************************/
+static void print_hist(const char *name, const struct hist *h)
+{
+	printf("%-9s min %llu avg %llu p50 %llu p99 %llu p99.9 %llu max %llu ns\n",
+	       name, (unsigned long long)h->min,
+	       (unsigned long long)(h->count ? h->sum / h->count : 0),
+	       (unsigned long long)hist_percentile(h, 0.5),
+	       (unsigned long long)hist_percentile(h, 0.99),
+	       (unsigned long long)hist_percentile(h, 0.999),
+	       (unsigned long long)h->max);
+}
 
-void cyclic_task()
+static void write_csv(void)
 {
-    static unsigned int counter = 10;
-    static uint8_t outputValue = 0;
-    static int numAsyncCycles = 0;
-    uint8_t inputValue = 0;
-    static uint8_t error = 0;
-
-    // receive process data
-    ecrt_master_receive(master);
-    ecrt_domain_process(domain1);
-
-    // check process data state (optional)
-    check_domain1_state();
-    
-
-	inputValue = EC_READ_U8(domain1_pd + off_dig_in[1]) & 0x0F;
-	
-	if(inputValue != outputValue) {
-		numAsyncCycles++;
-	} else {
-		numAsyncCycles = 0;
+	static const char header[] =
+	    "time,label,if,frequency,seconds,data_len,expected_wkc,cycles,"
+	    "overruns,lost,wkc_errors,late,"
+	    "jitter_min_ns,jitter_avg_ns,jitter_p50_ns,jitter_p99_ns,jitter_p999_ns,jitter_max_ns,"
+	    "latency_min_ns,latency_avg_ns,latency_p50_ns,latency_p99_ns,latency_p999_ns,latency_max_ns\n";
+	const struct hist *const hists[] = { &res.jitter, &res.latency };
+	FILE *const f = fopen(cfg.csv, "a");
+	struct stat st;
+	size_t i;
+
+	if (!f) {
+		perror(cfg.csv);
+		return;
+	}
+	if (fstat(fileno(f), &st) || !st.st_size) {
+		fputs(header, f);
 	}
-	
-	if(numAsyncCycles > 2) {
-		if(error != 0xff) {
-			error++;
+	fprintf(f, "%llu,%s,%s,%u,%u,%zu,%d,%llu,%llu,%llu,%llu,%llu",
+		(unsigned long long)time(NULL), cfg.label, cfg.ifname,
+		cfg.frequency, cfg.seconds, cfg.data_len, cfg.expected_wkc,
+		(unsigned long long)res.cycles,
+		(unsigned long long)res.overruns,
+		(unsigned long long)res.lost,
+		(unsigned long long)res.wkc_errors,
+		(unsigned long long)res.late);
+	for (i = 0; i < sizeof(hists) / sizeof(hists[0]); ++i) {
+		const struct hist *const h = hists[i];
+
+		fprintf(f, ",%llu,%llu,%llu,%llu,%llu,%llu",
+			(unsigned long long)h->min,
+			(unsigned long long)(h->count ? h->sum / h->count : 0),
+			(unsigned long long)hist_percentile(h, 0.5),
+			(unsigned long long)hist_percentile(h, 0.99),
+			(unsigned long long)hist_percentile(h, 0.999),
+			(unsigned long long)h->max);
+	}
+	fputc('\n', f);
+	fclose(f);
+}
+
+static void json_hist(FILE * f, const char *name, const struct hist *h)
+{
+	const char *sep = "";
+	size_t i;
+
+	fprintf(f,
+		"  \"%s\": {\"count\": %llu, \"min\": %llu, \"avg\": %llu, "
+		"\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu,\n"
+		"    \"bucket_ns\": %d, \"buckets\": {", name,
+		(unsigned long long)h->count, (unsigned long long)h->min,
+		(unsigned long long)(h->count ? h->sum / h->count : 0),
+		(unsigned long long)hist_percentile(h, 0.5),
+		(unsigned long long)hist_percentile(h, 0.99),
+		(unsigned long long)hist_percentile(h, 0.999),
+		(unsigned long long)h->max, HIST_BUCKET_NS);
+	for (i = 0; i <= HIST_BUCKETS; ++i) {
+		if (h->buckets[i]) {
+			fprintf(f, "%s\"%zu\": %llu", sep,
+				i * HIST_BUCKET_NS,
+				(unsigned long long)h->buckets[i]);
+			sep = ", ";
 		}
 	}
-	
-	
-    if (counter) {
-        counter--;
-    } else {
-        counter = 5; //update delay
-        
-        
-
-        // calculate new process data
-        outputValue = (outputValue + 1) & 0x0F;
-
-        // check for master state (optional)
-        check_master_state();
-
-        // check for islave configuration state(s) (optional)
-//        check_slave_config_states();
-    }
-
-    // write process data
-    EC_WRITE_U8(domain1_pd + off_dig_out[0], outputValue);
-    EC_WRITE_U8(domain1_pd + off_dig_out[1], error);
-
-    // send process data
-    ecrt_domain_queue(domain1);
-    ecrt_master_send(master);
+	fprintf(f, "}},\n");
 }
 
-/****************************************************************************/
+/**
+ * write_json() - summary and the non-empty histogram buckets, keyed by
+ * their lower bound in ns, respectively by the working counter
+ */
+static void write_json(void)
+{
+	FILE *const f = fopen(cfg.json, "w");
+	const char *sep = "";
+	size_t i;
 
-void signal_handler(int signum) {
-    switch (signum) {
-        case SIGALRM:
-            sig_alarms++;
-            break;
-    }
+	if (!f) {
+		perror(cfg.json);
+		return;
+	}
+	fprintf(f,
+		"{\n  \"label\": \"%s\", \"if\": \"%s\", \"frequency\": %u, "
+		"\"seconds\": %u, \"data_len\": %zu, \"expected_wkc\": %d,\n"
+		"  \"cycles\": %llu, \"overruns\": %llu, \"lost\": %llu, "
+		"\"wkc_errors\": %llu, \"late\": %llu,\n", cfg.label,
+		cfg.ifname, cfg.frequency, cfg.seconds, cfg.data_len,
+		cfg.expected_wkc, (unsigned long long)res.cycles,
+		(unsigned long long)res.overruns, (unsigned long long)res.lost,
+		(unsigned long long)res.wkc_errors,
+		(unsigned long long)res.late);
+	json_hist(f, "jitter", &res.jitter);
+	json_hist(f, "latency", &res.latency);
+	fprintf(f, "  \"wkc\": {");
+	for (i = 0; i <= WKC_MAX; ++i) {
+		if (res.wkc[i]) {
+			fprintf(f, "%s\"%zu\": %llu", sep, i,
+				(unsigned long long)res.wkc[i]);
+			sep = ", ";
+		}
+	}
+	fprintf(f, "}\n}\n");
+	fclose(f);
 }
 
-/****************************************************************************/
-
-static int Init_EL100x(int* off, const uint16_t position, const uint16_t index, const uint32_t vendor_id, const uint32_t product_code, const ec_sync_info_t syncs[])
+static void usage(const char *argv0)
 {
-	ec_slave_config_t *sc;
-    if (!(sc = ecrt_master_slave_config(master, 0, position, vendor_id, product_code))) {
-        fprintf(stderr, "Failed to get slave configuration.\n");
-        return -1;
-    }
-    if (ecrt_slave_config_pdos(sc, EC_END, syncs)) {
-        fprintf(stderr, "Failed to configure PDOs.\n");
-        return -1;
-    }
-    if (0 > (*off = ecrt_slave_config_reg_pdo_entry(sc, index, 1, domain1, NULL))) {
-		fprintf(stderr, "Failed to configure reg PDOs.\n");
-		return -1;
-	}
-    printf("Slave configured @ pos %d.\n", position);
-    return 0;
+	fprintf(stderr,
+		"Usage: %s -i <if>|sim[:<slaves>] [-f <hz>] [-d <seconds>] [-s <bytes>]\n"
+		"          [-w <wkc>] [-P <prio>] [-a <cpu>] [-b] [-c <csv>] [-j <json>] [-l <label>]\n"
+		"  -i  EtherCAT interface or a simulated segment (default: %d slaves)\n"
+		"  -f  cycle frequency in Hz, 1..%d (default: 1000)\n"
+		"  -d  duration in seconds (default: 10)\n"
+		"  -s  data bytes of the BRD datagram, 1..%d (default: 2)\n"
+		"  -w  expected working counter (default: that of the first reply)\n"
+		"  -P  SCHED_FIFO priority, 0 for SCHED_OTHER (default: 80)\n"
+		"  -a  pin to <cpu>\n"
+		"  -b  busy poll for the reply instead of sleeping in poll()\n"
+		"  -c  append the summary to a CSV file\n"
+		"  -j  write summary and histograms to a JSON file\n"
+		"  -l  label for CSV and JSON, f.e. a driver version\n",
+		argv0, SIM_SLAVES, FREQUENCY_MAX, DATA_MAX);
 }
 
 int main(int argc, char **argv)
 {
-    ec_slave_config_t *sc;
-    struct sigaction sa;
-    struct itimerval tv;
-    uint16_t i;
-
-    master = ecrt_request_master(0);
-    if (!master)
-        return -1;
-
-    domain1 = ecrt_master_create_domain(master);
-    if (!domain1)
-        return -1;
-
-    printf("Configuring PDOs...\n");
-    Init_EL100x(&off_dig_in[0], 0, Beckhoff_EL1004, el1004_syncs);
-    Init_EL100x(&off_dig_in[1], 1, Beckhoff_EL1004, el1004_syncs);
-    Init_EL100x(&off_dig_out[0], 2, Beckhoff_EL2004, el2004_syncs);
-    Init_EL100x(&off_dig_out[1], 3, Beckhoff_EL2004, el2004_syncs);
-
-    // Create configuration for bus coupler
-    sc = ecrt_master_slave_config(master, BusCouplerPos, Beckhoff_EK1100);
-    if (!sc)
-        return -1;
-    fprintf(stderr, "EK1100 configured.\n");
-
-    printf("Activating master...\n");
-    if (ecrt_master_activate(master))
-        return -1;
-
-    if (!(domain1_pd = ecrt_domain_data(domain1))) {
-        return -1;
-    }
-
-#if PRIORITY
-    pid_t pid = getpid();
-    if (setpriority(PRIO_PROCESS, pid, -19))
-        fprintf(stderr, "Warning: Failed to set priority: %s\n",
-                strerror(errno));
-#endif
-
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    if (sigaction(SIGALRM, &sa, 0)) {
-        fprintf(stderr, "Failed to install signal handler!\n");
-        return -1;
-    }
-
-    printf("Starting timer...\n");
-    tv.it_interval.tv_sec = 0;
-    tv.it_interval.tv_usec = 1000000 / FREQUENCY;
-    tv.it_value.tv_sec = 0;
-    tv.it_value.tv_usec = 1000;
-    if (setitimer(ITIMER_REAL, &tv, NULL)) {
-        fprintf(stderr, "Failed to start timer: %s\n", strerror(errno));
-        return 1;
-    }
-
-    printf("Started.\n");
-    while (1) {
-        pause();
-
-#if 0
-        struct timeval t;
-        gettimeofday(&t, NULL);
-        printf("%u.%06u\n", t.tv_sec, t.tv_usec);
-#endif
+	uint8_t frame[ETH_FRAME_LEN];
+	uint8_t mac[ETH_ALEN] = { 0 };
+	pthread_t sim_thread;
+	size_t len;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "i:f:d:s:w:P:a:bc:j:l:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg.ifname = optarg;
+			break;
+		case 'f':
+			cfg.frequency = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg.seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			cfg.data_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			cfg.expected_wkc = strtol(optarg, NULL, 0);
+			break;
+		case 'P':
+			cfg.priority = strtol(optarg, NULL, 0);
+			break;
+		case 'a':
+			cfg.cpu = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.busy = 1;
+			break;
+		case 'c':
+			cfg.csv = optarg;
+			break;
+		case 'j':
+			cfg.json = optarg;
+			break;
+		case 'l':
+			cfg.label = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!cfg.ifname || !cfg.frequency || cfg.frequency > FREQUENCY_MAX
+	    || !cfg.data_len || cfg.data_len > DATA_MAX
+	    || cfg.expected_wkc > WKC_MAX) {
+		usage(argv[0]);
+		return 1;
+	}
 
-        while (sig_alarms != user_alarms) {
-            cyclic_task();
-            user_alarms++;
-        }
-    }
+	if (!strncmp(cfg.ifname, "sim", 3)) {
+		cfg.slaves = (':' == cfg.ifname[3]) ?
+		    strtoul(cfg.ifname + 4, NULL, 0) : SIM_SLAVES;
+		fd = open_sim(&sim_thread);
+	} else {
+		fd = open_raw(cfg.ifname, mac);
+	}
+	if (fd < 0) {
+		return 1;
+	}
 
-    return 0;
+	len = build_frame(frame, mac);
+	setup_realtime();
+	run(fd, frame, len);
+	close(fd);
+
+	printf("cycles:   %llu at %u Hz, overruns %llu, lost %llu, late %llu\n",
+	       (unsigned long long)res.cycles, cfg.frequency,
+	       (unsigned long long)res.overruns, (unsigned long long)res.lost,
+	       (unsigned long long)res.late);
+	printf("wkc:      expected %d, errors %llu\n", cfg.expected_wkc,
+	       (unsigned long long)res.wkc_errors);
+	print_hist("jitter:", &res.jitter);
+	print_hist("latency:", &res.latency);
+	if (cfg.csv) {
+		write_csv();
+	}
+	if (cfg.json) {
+		write_json();
+	}
+	return (res.lost || res.wkc_errors) ? 2 : 0;
 }
-
-/****************************************************************************/
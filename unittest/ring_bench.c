@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    Test and benchmark of the DMA RX/TX rings in ../fifo.h without CCAT.
+    The ring code is compiled unmodified against ring_shim.h, a simulated
+    CCAT consumes the descriptors written to the fifo registers, fills RX
+    frames and completes TX frames. Every frame carries a sequence number
+    and a payload pattern, which are verified on the other side.
+
+    Build: make tools
+    Usage: ring_bench [-n <frames>] [pattern ...]
+
+    Patterns: single, burst, mixed, overrun (default: all). For each of
+    them and each direction the time, cycles, instructions, cache misses
+    and branches spent in the driver side of the rings are reported per
+    frame. Hardware counters need perf_event_paranoid <= 2, otherwise
+    only the time is shown. Exit status is 1 if any frame was corrupted.
+*/
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring_shim.h"
+#include "../fifo.h"
+
+#define RING_FRAMES 64
+#define RING_SIZE (RING_FRAMES * sizeof(struct ccat_eth_frame))
+#define FRAME_MIN (size_t)60
+#define FRAME_MAX (size_t)1514
+#define NUM_COUNTERS 5
+
+static const char *const counter_names[NUM_COUNTERS] = {
+	"cycles", "instr", "cache-miss", "branches", "br-miss",
+};
+
+static const u64 counter_configs[NUM_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/**
+ * struct sim_queue - descriptors written to a simulated fifo register
+ */
+struct sim_queue {
+	u32 desc[RING_FRAMES];
+	unsigned int head;
+	unsigned int tail;
+};
+
+/**
+ * struct sim - simulated CCAT Ethernet function
+ * @rx_reg: RX fifo register block, fifo->reg points here
+ * @tx_reg: TX fifo register block
+ * @rx_posted: free RX frames posted by the driver
+ * @tx_queued: TX frames queued by the driver
+ * @rx_seq: sequence number of the next received frame
+ * @tx_seq: sequence number expected in the next transmitted frame
+ * @rx_dropped: frames lost, because no RX frame was posted
+ * @errors: corrupted frames or descriptors
+ */
+struct sim {
+	u32 rx_reg[4];
+	u32 tx_reg[4];
+	struct sim_queue rx_posted;
+	struct sim_queue tx_queued;
+	u32 rx_seq;
+	u32 tx_seq;
+	u64 rx_dropped;
+	u64 errors;
+};
+
+/**
+ * struct stats - driver side cost of one direction
+ */
+struct stats {
+	u64 frames;
+	u64 samples;
+	u64 ns;
+	u64 counters[NUM_COUNTERS];
+};
+
+static struct sim sim;
+static u64 overhead_ns;
+static int perf_fd = -1;
+static int perf_num;
+
+static int sim_push(struct sim_queue *q, u32 desc)
+{
+	if (q->head - q->tail >= RING_FRAMES) {
+		return -1;
+	}
+	q->desc[q->head++ % RING_FRAMES] = desc;
+	return 0;
+}
+
+static int sim_pop(struct sim_queue *q, u32 * desc)
+{
+	if (q->head == q->tail) {
+		return -1;
+	}
+	*desc = q->desc[q->tail++ % RING_FRAMES];
+	return 0;
+}
+
+void ring_shim_iowrite32(u32 val, void *addr)
+{
+	if (addr == &sim.rx_reg[0]) {
+		if (!(val & (1u << 31)) || sim_push(&sim.rx_posted, val)) {
+			sim.errors++;
+		}
+	} else if (addr == &sim.rx_reg[2]) {
+		sim.rx_posted.head = sim.rx_posted.tail = 0;
+	} else if (addr == &sim.tx_reg[0]) {
+		if (sim_push(&sim.tx_queued, val)) {
+			sim.errors++;
+		}
+	} else if (addr == &sim.tx_reg[2]) {
+		sim.tx_queued.head = sim.tx_queued.tail = 0;
+	} else {
+		sim.errors++;
+	}
+}
+
+static void fill_frame(u8 * data, size_t len, u32 seq)
+{
+	size_t i;
+
+	memcpy(data, &seq, sizeof(seq));
+	for (i = sizeof(seq); i < len; ++i) {
+		data[i] = (u8) (seq + i);
+	}
+}
+
+static int check_frame(const u8 * data, size_t len, u32 seq)
+{
+	u32 got;
+	size_t i;
+
+	memcpy(&got, data, sizeof(got));
+	if (got != seq) {
+		return -1;
+	}
+	for (i = sizeof(seq); i < len; ++i) {
+		if (data[i] != (u8) (seq + i)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * sim_rx() - CCAT receives a frame into the next posted RX frame
+ */
+static void sim_rx(struct ccat_eth_fifo *fifo, size_t len)
+{
+	static const size_t OVERHEAD =
+	    offsetof(struct ccat_dma_frame_hdr, rx_flags);
+	struct ccat_dma_frame *frame;
+	u32 desc;
+
+	if (sim_pop(&sim.rx_posted, &desc)) {
+		sim.rx_dropped++;
+		return;
+	}
+	frame = fifo->dma.start + (desc & ~(1u << 31));
+	fill_frame(frame->data, len, sim.rx_seq++);
+	frame->hdr.length = cpu_to_le16(len + OVERHEAD);
+	frame->hdr.timestamp = htole64(sim.rx_seq);
+	wmb();
+	frame->hdr.rx_flags = cpu_to_le32(CCAT_FRAME_RECEIVED);
+}
+
+/**
+ * sim_tx() - CCAT sends all queued TX frames
+ */
+static void sim_tx(struct ccat_eth_fifo *fifo)
+{
+	static const size_t OFFSET = offsetof(struct ccat_dma_frame_hdr, length);
+	struct ccat_dma_frame *frame;
+	size_t len;
+	u32 desc;
+
+	while (!sim_pop(&sim.tx_queued, &desc)) {
+		frame = fifo->dma.start + (desc & 0xffffff) - OFFSET;
+		len = le16_to_cpu(frame->hdr.length);
+		if ((desc >> 24) != (len + sizeof(frame->hdr)) / 8
+		    || check_frame(frame->data, len, sim.tx_seq++)) {
+			sim.errors++;
+		}
+		frame->hdr.timestamp = htole64(sim.tx_seq);
+		wmb();
+		frame->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+	}
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void perf_open(void)
+{
+	struct perf_event_attr attr;
+	int i, fd;
+
+	for (i = 0; i < NUM_COUNTERS; ++i) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = counter_configs[i];
+		attr.disabled = (i == 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, perf_fd, 0);
+		if (fd < 0) {
+			break;
+		}
+		if (perf_fd < 0) {
+			perf_fd = fd;
+		}
+		perf_num++;
+	}
+	if (perf_fd >= 0) {
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+static void perf_read(u64 * values)
+{
+	u64 buf[1 + NUM_COUNTERS] = { 0 };
+
+	if (perf_fd >= 0 && read(perf_fd, buf, sizeof(buf)) > 0) {
+		memcpy(values, buf + 1, sizeof(u64) * NUM_COUNTERS);
+	}
+}
+
+/**
+ * struct sample - start of a measured driver section
+ */
+struct sample {
+	u64 ns;
+	u64 counters[NUM_COUNTERS];
+};
+
+static void sample_begin(struct sample *s)
+{
+	perf_read(s->counters);
+	s->ns = now_ns();
+}
+
+static void sample_end(const struct sample *s, struct stats *st, u64 frames)
+{
+	u64 counters[NUM_COUNTERS] = { 0 };
+	int i;
+
+	st->ns += now_ns() - s->ns;
+	perf_read(counters);
+	for (i = 0; i < NUM_COUNTERS; ++i) {
+		st->counters[i] += counters[i] - s->counters[i];
+	}
+	st->frames += frames;
+	st->samples++;
+}
+
+/**
+ * calibrate() - cost of an empty sample, subtracted from the results
+ */
+static void calibrate(void)
+{
+	struct stats st = { 0 };
+	struct sample s;
+	u64 min = ~0ull, prev = 0;
+	int i;
+
+	for (i = 0; i < 1000; ++i) {
+		sample_begin(&s);
+		sample_end(&s, &st, 0);
+		if (st.ns - prev < min) {
+			min = st.ns - prev;
+		}
+		prev = st.ns;
+	}
+	overhead_ns = min;
+}
+
+/**
+ * driver_rx() - the RX loop of poll_rx() in netdev.c, each frame is
+ * copied into its own buffer like into a freshly allocated skb
+ */
+static size_t driver_rx(struct ccat_eth_fifo *fifo, u8 * bufs, size_t * lens,
+			size_t budget)
+{
+	size_t len = fifo->ops->ready(fifo);
+	size_t received = 0;
+
+	while (len && received < budget) {
+		fifo->ops->queue.copy_to_buf(fifo, bufs + received * FRAME_MAX,
+					     len);
+		lens[received] = len;
+		fifo->ops->add(fifo);
+		ccat_eth_fifo_inc(fifo);
+		++received;
+		len = fifo->ops->ready(fifo);
+	}
+	return received;
+}
+
+/**
+ * driver_tx() - the ready check and queueing of ccat_eth_start_xmit()
+ */
+static int driver_tx(struct ccat_eth_fifo *fifo, struct sk_buff *skb)
+{
+	if (!fifo->ops->ready(fifo)) {
+		return -1;
+	}
+	fifo->ops->queue.skb(fifo, skb);
+	ccat_eth_fifo_inc(fifo);
+	return 0;
+}
+
+/**
+ * struct pattern - synthetic traffic
+ * @burst: frames per poll, a random number up to @burst if @random
+ * @len: frame length, chosen at random if 0
+ */
+struct pattern {
+	const char *name;
+	unsigned int burst;
+	int random;
+	size_t len;
+};
+
+static const struct pattern patterns[] = {
+	{"single", 1, 0, 64},
+	{"burst", RING_FRAMES / 2, 0, 64},
+	{"mixed", 16, 1, 0},
+	{"overrun", RING_FRAMES * 2, 0, FRAME_MAX},
+};
+
+#define BURST_MAX (RING_FRAMES * 2)
+
+static size_t frame_len(const struct pattern *p)
+{
+	return p->len ? p->len : FRAME_MIN + rand() % (FRAME_MAX - FRAME_MIN);
+}
+
+/**
+ * run() - push @frames frames through both rings
+ *
+ * Each iteration the stack hands a burst of skbs to the TX ring and CCAT
+ * sends them, then CCAT receives a burst and one poll picks it up. Only
+ * the driver side is measured.
+ */
+static int run(const struct pattern *p, u64 frames, struct stats *rx,
+	       struct stats *tx)
+{
+	static u8 bufs[BURST_MAX * FRAME_MAX];
+	static u8 skbs[BURST_MAX * FRAME_MAX];
+	static size_t lens[BURST_MAX];
+	struct ccat_eth_fifo rx_fifo = {.ops = &dma_rx_fifo_ops };
+	struct ccat_eth_fifo tx_fifo = {.ops = &dma_tx_fifo_ops };
+	void *const rx_mem = aligned_alloc(4096, RING_SIZE);
+	void *const tx_mem = aligned_alloc(4096, RING_SIZE);
+	struct sk_buff skb[BURST_MAX];
+	struct sample s;
+	u32 rx_seq = 0, tx_seq = 0;
+	unsigned int i, n;
+
+	if (!rx_mem || !tx_mem) {
+		free(rx_mem);
+		free(tx_mem);
+		return -1;
+	}
+	memset(&sim, 0, sizeof(sim));
+	memset(rx_mem, 0, RING_SIZE);
+	memset(tx_mem, 0, RING_SIZE);
+	rx_fifo.reg = sim.rx_reg;
+	rx_fifo.dma.start = rx_mem;
+	fifo_set_end(&rx_fifo, RING_SIZE);
+	tx_fifo.reg = sim.tx_reg;
+	tx_fifo.dma.start = tx_mem;
+	fifo_set_end(&tx_fifo, RING_SIZE);
+
+	while (rx->frames < frames) {
+		n = p->random ? 1 + rand() % p->burst : p->burst;
+
+		/* skbs the ring can't take are dropped, as by the stack */
+		for (i = 0; i < n; ++i) {
+			skb[i].data = skbs + i * FRAME_MAX;
+			skb[i].len = frame_len(p);
+			fill_frame(skb[i].data, skb[i].len, tx_seq + i);
+		}
+		sample_begin(&s);
+		for (i = 0; i < n && !driver_tx(&tx_fifo, &skb[i]); ++i) ;
+		sample_end(&s, tx, i);
+		tx_seq += i;
+		sim_tx(&tx_fifo);
+
+		for (i = 0; i < n; ++i) {
+			sim_rx(&rx_fifo, frame_len(p));
+		}
+		sample_begin(&s);
+		n = driver_rx(&rx_fifo, bufs, lens, BURST_MAX);
+		sample_end(&s, rx, n);
+		for (i = 0; i < n; ++i) {
+			if (check_frame(bufs + i * FRAME_MAX, lens[i], rx_seq++)) {
+				sim.errors++;
+			}
+		}
+	}
+
+	if (rx_seq != sim.rx_seq || tx_seq != sim.tx_seq) {
+		sim.errors++;
+	}
+	free(rx_mem);
+	free(tx_mem);
+	return sim.errors ? -1 : 0;
+}
+
+static void print_stats(const char *name, const char *dir,
+			const struct stats *st)
+{
+	const double frames = st->frames ? st->frames : 1;
+	int i;
+
+	const u64 ns = st->ns - min(st->ns, overhead_ns * st->samples);
+
+	printf("%-8s %-2s %9llu %9.1f", name, dir,
+	       (unsigned long long)st->frames, ns / frames);
+	for (i = 0; i < NUM_COUNTERS; ++i) {
+		if (i < perf_num) {
+			printf(" %10.1f", st->counters[i] / frames);
+		} else {
+			printf(" %10s", "-");
+		}
+	}
+	printf("\n");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-n <frames>] [single|burst|mixed|overrun ...]\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	const size_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+	u64 frames = 1000000;
+	size_t i;
+	int opt, failed = 0, j;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	perf_open();
+	calibrate();
+	printf("%-8s %-2s %9s %9s", "pattern", "", "frames", "ns/frame");
+	for (j = 0; j < NUM_COUNTERS; ++j) {
+		printf(" %10s", counter_names[j]);
+	}
+	printf("\n");
+
+	for (i = 0; i < num_patterns; ++i) {
+		const struct pattern *const p = &patterns[i];
+		struct stats rx = { 0 }, tx = { 0 };
+
+		if (optind < argc) {
+			for (j = optind; j < argc && strcmp(argv[j], p->name);
+			     ++j) ;
+			if (j == argc) {
+				continue;
+			}
+		}
+		srand(1);
+		if (run(p, frames, &rx, &tx)) {
+			fprintf(stderr, "%s: %llu corrupted frames\n", p->name,
+				(unsigned long long)sim.errors);
+			failed = 1;
+		}
+		print_stats(p->name, "rx", &rx);
+		print_stats(p->name, "tx", &tx);
+	}
+	return failed;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    User space stand-ins for the kernel primitives used by ../fifo.h.
+    Register writes are forwarded to ring_shim_iowrite32(), which the
+    includer implements to emulate CCAT.
+*/
+
+#ifndef _CCAT_RING_SHIM_H_
+#define _CCAT_RING_SHIM_H_
+
+#include <endian.h>
+#include <linux/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+
+typedef struct {
+	int64_t counter;
+} atomic64_t;
+
+struct sk_buff {
+	unsigned char *data;
+	unsigned int len;
+};
+
+#define __iomem
+#define __force
+
+#define cpu_to_le16(x) htole16(x)
+#define cpu_to_le32(x) htole32(x)
+#define le16_to_cpu(x) le16toh(x)
+#define le32_to_cpu(x) le32toh(x)
+#define le64_to_cpu(x) le64toh(x)
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+extern void ring_shim_iowrite32(u32 val, void *addr);
+#define ccat_iowrite32(val, addr) ring_shim_iowrite32(val, addr)
+
+#endif /* #ifndef _CCAT_RING_SHIM_H_ */
@@ -17,4 +17,11 @@ trap cleanup INT TERM EXIT
 # switch kernel clocksource to ccat_systemtime
 printf "ccat" >${current_clocksource}
 test "ccat" = $(cat ${current_clocksource})
+
+# systemtime has to advance between two reads of the character device
+for dev_file in /dev/ccat_systemtime*; do
+	t0=$(od -An -tu8 -N8 ${dev_file})
+	t1=$(od -An -tu8 -N8 ${dev_file})
+	test ${t1} -gt ${t0}
+done
 echo "$0 done."
@@ -5,11 +5,32 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
+#include <linux/delay.h>
+#include <linux/firmware.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/platform_device.h>
 #include <linux/sched.h>
+#include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#if IS_ENABLED(CONFIG_XZ_DEC)
+#include <linux/xz.h>
+#endif
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS)
+#include <linux/zstd.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,16,0)
+typedef ZSTD_DCtx zstd_dctx;
+#define zstd_dctx_workspace_bound ZSTD_DCtxWorkspaceBound
+#define zstd_init_dctx ZSTD_initDCtx
+#define zstd_decompress_dctx ZSTD_decompressDCtx
+#define zstd_is_error ZSTD_isError
+#endif
+#endif
 #include "module.h"
+#include "update.h"
 
 MODULE_DESCRIPTION(DRV_DESCRIPTION);
 MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
@@ -17,239 +38,330 @@ MODULE_LICENSE("GPL and additional rights");
 MODULE_VERSION(DRV_VERSION);
 
 #define CCAT_DEVICES_MAX 5
-#define CCAT_DATA_IN_4 0x038
-#define CCAT_DATA_IN_N 0x7F0
-#define CCAT_DATA_OUT_4 0x030
-#define CCAT_DATA_BLOCK_SIZE (size_t)((CCAT_DATA_IN_N - CCAT_DATA_IN_4)/8)
 #define CCAT_WRITE_BLOCK_SIZE 128
 #define CCAT_FLASH_SIZE (size_t)0xE0000
 
-/**     FUNCTION_NAME            CMD,  CLOCKS          */
-#define CCAT_BULK_ERASE          0xE3, 8
-#define CCAT_GET_PROM_ID         0xD5, 40
-#define CCAT_READ_FLASH          0xC0, 32
-#define CCAT_READ_STATUS         0xA0, 16
-#define CCAT_WRITE_ENABLE        0x60, 8
-#define CCAT_WRITE_FLASH         0x40, 32
-
-/* from http://graphics.stanford.edu/~seander/bithacks.html#ReverseByteWith32Bits */
-#define SWAP_BITS(B) \
-	((((B) * 0x0802LU & 0x22110LU) | ((B) * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16)
-
 /**
- * wait_until_busy_reset() - wait until the busy flag was reset
+ * ccat_read_flash() - Read a chunk of CCAT configuration data from flash
  * @ioaddr: address of the CCAT Update function in PCI config space
+ * @buf: output buffer in user space
+ * @len: number of bytes to read
+ * @off: offset in the configuration data
+ *
+ * Copies multiple blocks of configuration data from the CCAT FPGA's
+ * flash to the user space buffer.
+ *
+ * Return: the number of bytes copied or -EFAULT
  */
-static inline void wait_until_busy_reset(void __iomem * const ioaddr)
+static int ccat_read_flash(void __iomem * const ioaddr, char __user * buf,
+			   u32 len, loff_t * off)
 {
-	wmb();
-	while (ioread8(ioaddr + 1)) {
-		schedule();
+	u8 block[CCAT_DATA_BLOCK_SIZE];
+	const loff_t start = *off;
+
+	while (len > 0) {
+		const u16 n = min(len, (u32) CCAT_DATA_BLOCK_SIZE);
+
+		ccat_read_flash_block(ioaddr, *off, n, block);
+		if (copy_to_user(buf, block, n)) {
+			return -EFAULT;
+		}
+		*off += n;
+		buf += n;
+		len -= n;
 	}
+	return *off - start;
 }
 
 /**
- * __ccat_update_cmd() - Helper to issue a FPGA flash command
+ * ccat_verify_flash() - Compare the FPGA's flash content with an image
  * @ioaddr: address of the CCAT Update function in PCI config space
- * @cmd: the command identifier
- * @clocks: the number of clocks associated with the specified command
+ * @buf: the expected configuration data
+ * @len: number of bytes to compare
  *
- * no write memory barrier is called and the busy flag is not evaluated
+ * Return: 0 if the flash content matches the image, -EIO otherwise
  */
-static inline void __ccat_update_cmd(void __iomem * const ioaddr, u8 cmd,
-				     u16 clocks)
+static int ccat_verify_flash(void __iomem * const ioaddr, const u8 * buf,
+			     size_t len)
 {
-	iowrite8((0xff00 & clocks) >> 8, ioaddr);
-	iowrite8(0x00ff & clocks, ioaddr + 0x8);
-	iowrite8(cmd, ioaddr + 0x10);
+	u8 block[CCAT_DATA_BLOCK_SIZE];
+	u32 off = 0;
+
+	while (len > 0) {
+		const u16 n = min(len, CCAT_DATA_BLOCK_SIZE);
+
+		ccat_read_flash_block(ioaddr, off, n, block);
+		if (memcmp(block, buf, n)) {
+			pr_warn("verify failed in block @0x%06x\n", off);
+			return -EIO;
+		}
+		off += n;
+		buf += n;
+		len -= n;
+	}
+	return 0;
 }
 
+/* typical values of EPCS/M25P class flashes, on the low side */
+#define CCAT_ERASE_NS_DEFAULT (2ULL * NSEC_PER_SEC)
+#define CCAT_PROGRAM_NS_DEFAULT (500ULL * NSEC_PER_USEC)
+
 /**
- * ccat_update_cmd() - Helper to issue a FPGA flash command
- * @ioaddr: address of the CCAT Update function in PCI config space
- * @cmd: the command identifier
- * @clocks: the number of clocks associated with the specified command
+ * struct ccat_update_timing - flash timing of one CCAT, kept across updates
+ * @erase_ns: measured duration of the last bulk erase
+ * @program_ns: moving average of the page program duration
+ * @no_pipeline: a pipelined run failed verification on this CCAT
  *
- * Triggers a full flash command cycle with write memory barrier and
- * command activate. This call blocks until the busy flag is reset.
+ * The flash keeps busy for a fairly constant time after each erase or
+ * program command. We measure this time and sleep for most of it before
+ * the first status poll, instead of hammering the update function with
+ * READ_STATUS commands. Until the first measurement the datasheet values
+ * are used.
  */
-static inline void ccat_update_cmd(void __iomem * const ioaddr, u8 cmd,
-				   u16 clocks)
-{
-	__ccat_update_cmd(ioaddr, cmd, clocks);
-	wmb();
-	iowrite8(0xff, ioaddr + 0x7f8);
-	wait_until_busy_reset(ioaddr);
-}
+struct ccat_update_timing {
+	u64 erase_ns;
+	u64 program_ns;
+	bool no_pipeline;
+};
 
 /**
- * ccat_update_cmd_addr() - Helper to issue a FPGA flash command with address parameter
+ * struct ccat_update_engine - state of one flash erase/program run
  * @ioaddr: address of the CCAT Update function in PCI config space
- * @cmd: the command identifier
- * @clocks: the number of clocks associated with the specified command
- * @addr: 24 bit address associated with the specified command
- *
- * Triggers a full flash command cycle with write memory barrier and
- * command activate. This call blocks until the busy flag is reset.
+ * @timing: flash timing of this CCAT
+ * @pipeline: load the next block while the flash is programming
+ * @polls: number of status commands issued during this run
  */
-static inline void ccat_update_cmd_addr(void __iomem * const ioaddr,
-					u8 cmd, u16 clocks, u32 addr)
-{
-	const u8 addr_0 = SWAP_BITS(addr & 0xff);
-	const u8 addr_1 = SWAP_BITS((addr & 0xff00) >> 8);
-	const u8 addr_2 = SWAP_BITS((addr & 0xff0000) >> 16);
-
-	__ccat_update_cmd(ioaddr, cmd, clocks);
-	iowrite8(addr_2, ioaddr + 0x18);
-	iowrite8(addr_1, ioaddr + 0x20);
-	iowrite8(addr_0, ioaddr + 0x28);
-	wmb();
-	iowrite8(0xff, ioaddr + 0x7f8);
-	wait_until_busy_reset(ioaddr);
-}
+struct ccat_update_engine {
+	void __iomem *ioaddr;
+	struct ccat_update_timing *timing;
+	bool pipeline;
+	unsigned long polls;
+};
+
+/*
+ * Pipelining relies on READ_STATUS and WRITE_ENABLE leaving the data
+ * registers alone. Every update is verified, if a pipelined image doesn't
+ * match, it is programmed again without and pipelining stays off for that
+ * CCAT (see ccat_update_flash_verified()).
+ */
+static bool flash_pipeline = true;
+module_param(flash_pipeline, bool, 0644);
+MODULE_PARM_DESC(flash_pipeline,
+		 "load the next data block while the flash is busy programming (default: true)");
 
 /**
- * ccat_get_status() - Read CCAT Update status
- * @ioaddr: address of the CCAT Update function in PCI config space
+ * ccat_wait_status_cleared() - wait until CCAT status is cleared
+ * @engine: the flash engine of the current run
+ * @estimate_ns: expected busy time
  *
- * Return: the current status of the CCAT Update function
+ * Blocks until bit 7 of the CCAT Update status is reset. The first poll is
+ * delayed by 3/4 of the estimate, subsequent polls are spaced by 1/16 of it.
+ *
+ * Return: the measured busy time in ns
  */
-static u8 ccat_get_status(void __iomem * const ioaddr)
+static u64 ccat_wait_status_cleared(struct ccat_update_engine *const engine,
+				    const u64 estimate_ns)
 {
-	ccat_update_cmd(ioaddr, CCAT_READ_STATUS);
-	return ioread8(ioaddr + 0x20);
+	const ktime_t start = ktime_get();
+	const unsigned long delay_us = div_u64(estimate_ns * 3 / 4,
+					       NSEC_PER_USEC);
+	const unsigned long interval_us =
+	    clamp_t(unsigned long, div_u64(estimate_ns / 16, NSEC_PER_USEC), 5,
+		    10 * USEC_PER_MSEC);
+
+	if (delay_us > interval_us) {
+		usleep_range(delay_us, delay_us + interval_us);
+	}
+
+	for (;;) {
+		engine->polls++;
+		if (!(ccat_get_status(engine->ioaddr) & (1 << 7))) {
+			break;
+		}
+		usleep_range(interval_us, 2 * interval_us);
+	}
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
 }
 
 /**
- * ccat_read_flash_block() - Read a block of CCAT configuration data from flash
+ * ccat_load_flash_block() - Load a block of data into the data registers
  * @ioaddr: address of the CCAT Update function in PCI config space
- * @addr: 24 bit address of the block to read
- * @len: number of bytes to read from this block, len <= CCAT_DATA_BLOCK_SIZE
- * @buf: output buffer in user space
- *
- * Copies one block of configuration data from the CCAT FPGA's flash to
- * the user space buffer.
- * Note that the size of the FPGA's firmware is not known exactly so it
- * is very possible that the overall buffer ends with a lot of 0xff.
+ * @len: number of bytes to load, len <= CCAT_WRITE_BLOCK_SIZE
+ * @buf: input buffer
  *
- * Return: the number of bytes copied
+ * The data registers are only shifted out by CCAT_WRITE_FLASH. Commands
+ * issued in between (WRITE_ENABLE, READ_STATUS) are expected to use the
+ * first two byte lanes only, so with flash_pipeline the next block is loaded
+ * while the flash is still busy with the previous one.
  */
-static int ccat_read_flash_block(void __iomem * const ioaddr,
-				 const u32 addr, const u16 len,
-				 char __user * const buf)
+static void ccat_load_flash_block(void __iomem * const ioaddr, const u16 len,
+				  const char *const buf)
 {
 	u16 i;
-	const u16 clocks = 8 * len;
 
-	ccat_update_cmd_addr(ioaddr, CCAT_READ_FLASH + clocks, addr);
 	for (i = 0; i < len; i++) {
-		put_user(ioread8(ioaddr + CCAT_DATA_IN_4 + 8 * i), buf + i);
+		ccat_iowrite8(buf[i], ioaddr + CCAT_DATA_OUT_4 + 8 * i);
 	}
-	return len;
 }
 
 /**
- * ccat_read_flash() - Read a chunk of CCAT configuration data from flash
- * @ioaddr: address of the CCAT Update function in PCI config space
- * @buf: output buffer in user space
- * @len: number of bytes to read
- * @off: offset in the configuration data
- *
- * Copies multiple blocks of configuration data from the CCAT FPGA's
- * flash to the user space buffer.
+ * ccat_program_flash_block() - Program the preloaded data registers to flash
+ * @engine: the flash engine of the current run
+ * @addr: 24 bit start address in the CCAT FPGA's flash
+ * @len: number of bytes to write in this block, len <= CCAT_WRITE_BLOCK_SIZE
  *
- * Return: the number of bytes copied
+ * Issues CCAT_WRITE_ENABLE and CCAT_WRITE_FLASH back to back. The call
+ * returns as soon as the command was shifted out, the caller has to wait
+ * for the flash with ccat_wait_status_cleared().
  */
-static int ccat_read_flash(void __iomem * const ioaddr, char __user * buf,
-			   u32 len, loff_t * off)
+static void ccat_program_flash_block(struct ccat_update_engine *const engine,
+				     const u32 addr, const u16 len)
 {
-	const loff_t start = *off;
+	const u16 clocks = 8 * len;
 
-	while (len > CCAT_DATA_BLOCK_SIZE) {
-		*off +=
-		    ccat_read_flash_block(ioaddr, *off, CCAT_DATA_BLOCK_SIZE,
-					  buf);
-		buf += CCAT_DATA_BLOCK_SIZE;
-		len -= CCAT_DATA_BLOCK_SIZE;
-	}
-	*off += ccat_read_flash_block(ioaddr, *off, len, buf);
-	return *off - start;
+	ccat_update_cmd(engine->ioaddr, CCAT_WRITE_ENABLE);
+	ccat_update_cmd_addr(engine->ioaddr, CCAT_WRITE_FLASH + clocks, addr);
 }
 
 /**
- * ccat_wait_status_cleared() - wait until CCAT status is cleared
- * @ioaddr: address of the CCAT Update function in PCI config space
+ * ccat_write_flash() - Write a new CCAT configuration to FPGA's flash
+ * @engine: the flash engine of the current run
+ * @buf: the new FPGA configuration
+ * @len: number of bytes in @buf
  *
- * Blocks until bit 7 of the CCAT Update status is reset
+ * With @engine->pipeline, block n + 1 is already transferred into the
+ * data registers while block n is programmed by the flash.
  */
-static void ccat_wait_status_cleared(void __iomem * const ioaddr)
+static void ccat_write_flash(struct ccat_update_engine *const engine,
+			     const char *buf, size_t len)
 {
-	u8 status;
+	struct ccat_update_timing *const timing = engine->timing;
+	u32 off = 0;
+	u64 elapsed;
+
+	if (!len) {
+		return;
+	}
 
-	do {
-		status = ccat_get_status(ioaddr);
-	} while (status & (1 << 7));
+	ccat_load_flash_block(engine->ioaddr,
+			      min(len, (size_t) CCAT_WRITE_BLOCK_SIZE), buf);
+	for (;;) {
+		const u16 n = min(len, (size_t) CCAT_WRITE_BLOCK_SIZE);
+
+		ccat_program_flash_block(engine, off, n);
+		off += n;
+		buf += n;
+		len -= n;
+
+		if (len && engine->pipeline) {
+			ccat_load_flash_block(engine->ioaddr,
+					      min(len,
+						  (size_t) CCAT_WRITE_BLOCK_SIZE),
+					      buf);
+		}
+		elapsed = ccat_wait_status_cleared(engine, timing->program_ns);
+		timing->program_ns = (7 * timing->program_ns + elapsed) / 8;
+		if (!len) {
+			return;
+		}
+		if (!engine->pipeline) {
+			ccat_load_flash_block(engine->ioaddr,
+					      min(len,
+						  (size_t) CCAT_WRITE_BLOCK_SIZE),
+					      buf);
+		}
+	}
 }
 
 /**
- * ccat_write_flash_block() - Write a block of CCAT configuration data to flash
- * @ioaddr: address of the CCAT Update function in PCI config space
- * @addr: 24 bit start address in the CCAT FPGA's flash
- * @len: number of bytes to write in this block, len <= CCAT_WRITE_BLOCK_SIZE
- * @buf: input buffer
- *
- * Copies one block of configuration data to the CCAT FPGA's flash
- *
- * Return: the number of bytes copied
+ * ccat_update_flash() - Erase the FPGA's flash and program a new configuration
+ * @ccdev: character device of the CCAT Update function
+ * @buf: the new FPGA configuration
+ * @len: number of bytes in @buf
+ * @pipeline: load the next block while the flash is programming
  */
-static int ccat_write_flash_block(void __iomem * const ioaddr,
-				  const u32 addr, const u16 len,
-				  const char *const buf)
+static void ccat_update_flash(struct ccat_cdev *const ccdev, const char *buf,
+			      size_t len, const bool pipeline)
 {
-	const u16 clocks = 8 * len;
-	u16 i;
-
-	ccat_update_cmd(ioaddr, CCAT_WRITE_ENABLE);
-	for (i = 0; i < len; i++) {
-		iowrite8(buf[i], ioaddr + CCAT_DATA_OUT_4 + 8 * i);
-	}
-	ccat_update_cmd_addr(ioaddr, CCAT_WRITE_FLASH + clocks, addr);
-	ccat_wait_status_cleared(ioaddr);
-	return len;
+	struct ccat_update_engine engine = {
+		.ioaddr = ccdev->ioaddr,
+		.timing = ccdev->private_data,
+		.pipeline = pipeline,
+	};
+	const ktime_t start = ktime_get();
+	u64 elapsed_us;
+
+	ccat_update_cmd(engine.ioaddr, CCAT_WRITE_ENABLE);
+	ccat_update_cmd(engine.ioaddr, CCAT_BULK_ERASE);
+	engine.timing->erase_ns =
+	    ccat_wait_status_cleared(&engine, engine.timing->erase_ns);
+	ccat_write_flash(&engine, buf, len);
+
+	elapsed_us = ktime_to_us(ktime_sub(ktime_get(), start));
+	pr_info("%zu bytes flashed in %llu ms (erase: %llu ms, page: %llu us, %lu polls)\n",
+		len, div_u64(elapsed_us, USEC_PER_MSEC),
+		div_u64(engine.timing->erase_ns, NSEC_PER_MSEC),
+		div_u64(engine.timing->program_ns, NSEC_PER_USEC),
+		engine.polls);
 }
 
 /**
- * ccat_write_flash() - Write a new CCAT configuration to FPGA's flash
- * @update: a CCAT Update buffer containing the new FPGA configuration
+ * ccat_update_flash_verified() - Program a new configuration and verify it
+ * @ccdev: character device of the CCAT Update function
+ * @buf: the new FPGA configuration
+ * @len: number of bytes in @buf
+ *
+ * If a pipelined run doesn't match, the update function doesn't keep its
+ * data registers during READ_STATUS or WRITE_ENABLE. Pipelining is then
+ * turned off for this CCAT and the image is programmed once more.
+ *
+ * Return: 0 on success, -EIO if the flash doesn't match the image
  */
-static void ccat_write_flash(const struct cdev_buffer *const buffer)
+static int ccat_update_flash_verified(struct ccat_cdev *const ccdev,
+				      const u8 * buf, size_t len)
 {
-	const char *buf = buffer->data;
-	u32 off = 0;
-	size_t len = buffer->size;
-
-	while (len > CCAT_WRITE_BLOCK_SIZE) {
-		ccat_write_flash_block(buffer->ccdev->ioaddr, off,
-				       (u16) CCAT_WRITE_BLOCK_SIZE, buf);
-		off += CCAT_WRITE_BLOCK_SIZE;
-		buf += CCAT_WRITE_BLOCK_SIZE;
-		len -= CCAT_WRITE_BLOCK_SIZE;
+	struct ccat_update_timing *const timing = ccdev->private_data;
+	const bool pipeline = flash_pipeline && !timing->no_pipeline;
+	int status;
+
+	ccat_update_flash(ccdev, (const char *)buf, len, pipeline);
+	status = ccat_verify_flash(ccdev->ioaddr, buf, len);
+	if (status && pipeline) {
+		pr_warn("verify failed with flash_pipeline, programming again without\n");
+		timing->no_pipeline = true;
+		ccat_update_flash(ccdev, (const char *)buf, len, false);
+		status = ccat_verify_flash(ccdev->ioaddr, buf, len);
 	}
-	ccat_write_flash_block(buffer->ccdev->ioaddr, off, (u16) len, buf);
+	return status;
 }
 
-static int ccat_update_release(struct inode *const i, struct file *const f)
+/**
+ * ccat_update_flush() - Program the configuration written to the device
+ * @f: file handle previously initialized with ccat_update_open()
+ * @id: unused
+ *
+ * Called on close(). Unlike the result of ->release, the result of
+ * ->flush is returned by close(), so user space learns whether
+ * programming and verification succeeded.
+ *
+ * Return: 0 on success, -EIO if the flash doesn't match the image
+ */
+static int ccat_update_flush(struct file *const f, fl_owner_t id)
 {
-	const struct cdev_buffer *const buf = f->private_data;
-	void __iomem *ioaddr = buf->ccdev->ioaddr;
-
-	if (buf->size > 0) {
-		ccat_update_cmd(ioaddr, CCAT_WRITE_ENABLE);
-		ccat_update_cmd(ioaddr, CCAT_BULK_ERASE);
-		ccat_wait_status_cleared(ioaddr);
-		ccat_write_flash(buf);
+	struct cdev_buffer *const buf = f->private_data;
+	int status;
+
+	if (!buf->size) {
+		return 0;
 	}
-	return ccat_cdev_release(i, f);
+	status = ccat_update_flash_verified(buf->ccdev, (const u8 *)buf->data,
+					    buf->size);
+	buf->size = 0;
+	if (status) {
+		pr_err("programming the FPGA configuration failed\n");
+	}
+	return status;
 }
 
 /**
@@ -318,28 +430,215 @@ static struct ccat_class cdev_class = {
 	.fops = {
 		 .owner = THIS_MODULE,
 		 .open = ccat_cdev_open,
-		 .release = ccat_update_release,
+		 .flush = ccat_update_flush,
+		 .release = ccat_cdev_release,
 		 .read = ccat_update_read,
 		 .write = ccat_update_write,
 		 },
 };
 
+#if IS_ENABLED(CONFIG_XZ_DEC)
+static ssize_t ccat_fw_unxz(const u8 * src, size_t src_len, u8 * dst,
+			    size_t dst_len)
+{
+	struct xz_buf b = {
+		.in = src,
+		.in_size = src_len,
+		.out = dst,
+		.out_size = dst_len,
+	};
+	struct xz_dec *const xz = xz_dec_init(XZ_SINGLE, 0);
+	enum xz_ret ret;
+
+	if (!xz) {
+		return -ENOMEM;
+	}
+	ret = xz_dec_run(xz, &b);
+	xz_dec_end(xz);
+	if (XZ_OPTIONS_ERROR == ret || XZ_UNSUPPORTED_CHECK == ret) {
+		/* the kernel decoder only supports CRC32 or no integrity check */
+		pr_warn("xz image uses unsupported options, compress it with 'xz --check=crc32'\n");
+		return -EINVAL;
+	}
+	if (XZ_STREAM_END != ret) {
+		pr_warn("xz decompression failed with %d\n", ret);
+		return -EINVAL;
+	}
+	return b.out_pos;
+}
+#else
+#define ccat_fw_unxz(SRC, SRC_LEN, DST, DST_LEN) ((ssize_t)(-EOPNOTSUPP))
+#endif
+
+#if IS_ENABLED(CONFIG_ZSTD_DECOMPRESS)
+static ssize_t ccat_fw_unzstd(const u8 * src, size_t src_len, u8 * dst,
+			      size_t dst_len)
+{
+	const size_t wksp_size = zstd_dctx_workspace_bound();
+	void *const wksp = vmalloc(wksp_size);
+	zstd_dctx *dctx;
+	size_t ret;
+
+	if (!wksp) {
+		return -ENOMEM;
+	}
+	dctx = zstd_init_dctx(wksp, wksp_size);
+	if (!dctx) {
+		vfree(wksp);
+		return -EINVAL;
+	}
+	ret = zstd_decompress_dctx(dctx, dst, dst_len, src, src_len);
+	vfree(wksp);
+	if (zstd_is_error(ret)) {
+		pr_warn("zstd decompression failed\n");
+		return -EINVAL;
+	}
+	return ret;
+}
+#else
+#define ccat_fw_unzstd(SRC, SRC_LEN, DST, DST_LEN) ((ssize_t)(-EOPNOTSUPP))
+#endif
+
+/**
+ * ccat_update_firmware() - Program the FPGA's flash with a firmware file
+ * @dev: device used to request the firmware
+ * @ccdev: character device of the CCAT Update function
+ * @name: firmware file name relative to the firmware search path
+ *
+ * The file is loaded with request_firmware(). xz and zstd compressed
+ * bitstreams are recognized by their magic and decompressed into a
+ * flash sized buffer before anything is erased, so a corrupted file
+ * never touches the flash. Afterwards the flash is read back and
+ * compared with the image.
+ *
+ * Return: 0 on success, negative error code otherwise
+ */
+static int ccat_update_firmware(struct device *dev, struct ccat_cdev *ccdev,
+				const char *name)
+{
+	static const u8 XZ_MAGIC[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+	static const u8 ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+	const struct firmware *fw;
+	const u8 *image;
+	u8 *buf = NULL;
+	ssize_t len;
+	int status;
+
+	status = request_firmware(&fw, name, dev);
+	if (status) {
+		return status;
+	}
+
+	if (fw->size >= sizeof(XZ_MAGIC)
+	    && !memcmp(fw->data, XZ_MAGIC, sizeof(XZ_MAGIC))) {
+		buf = vmalloc(CCAT_FLASH_SIZE);
+		len = buf ? ccat_fw_unxz(fw->data, fw->size, buf,
+					 CCAT_FLASH_SIZE) : -ENOMEM;
+	} else if (fw->size >= sizeof(ZSTD_MAGIC)
+		   && !memcmp(fw->data, ZSTD_MAGIC, sizeof(ZSTD_MAGIC))) {
+		buf = vmalloc(CCAT_FLASH_SIZE);
+		len = buf ? ccat_fw_unzstd(fw->data, fw->size, buf,
+					   CCAT_FLASH_SIZE) : -ENOMEM;
+	} else {
+		len = (fw->size > CCAT_FLASH_SIZE) ? -EFBIG : fw->size;
+	}
+	image = buf ? buf : fw->data;
+
+	if (len <= 0) {
+		status = len ? len : -EINVAL;
+		pr_warn("firmware '%s' invalid: %d\n", name, status);
+		goto cleanup;
+	}
+
+	pr_info("programming '%s' (%zd bytes)...\n", name, len);
+	status = ccat_update_flash_verified(ccdev, image, len);
+	if (!status) {
+		pr_info("programming '%s' complete\n", name);
+	}
+cleanup:
+	vfree(buf);
+	release_firmware(fw);
+	return status;
+}
+
+/**
+ * firmware_store() - sysfs trigger for a firmware based update
+ *
+ * Usage: echo ccat_fw.rbf.xz > /sys/bus/platform/devices/<ccat_update>/firmware
+ * The character device is blocked for the duration of the update.
+ */
+static ssize_t firmware_store(struct device *dev,
+			      struct device_attribute *attr, const char *buf,
+			      size_t count)
+{
+	struct ccat_function *const func = dev_get_platdata(dev);
+	struct ccat_cdev *const ccdev = func->private_data;
+	char *const name = kstrndup(buf, count, GFP_KERNEL);
+	int status;
+
+	if (!name) {
+		return -ENOMEM;
+	}
+
+	if (!atomic_dec_and_test(&ccdev->in_use)) {
+		atomic_inc(&ccdev->in_use);
+		kfree(name);
+		return -EBUSY;
+	}
+
+	status = ccat_update_firmware(dev, ccdev, strim(name));
+	atomic_inc(&ccdev->in_use);
+	kfree(name);
+	return status ? status : count;
+}
+
+static DEVICE_ATTR_WO(firmware);
+
 static int ccat_update_probe(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	static const u16 SUPPORTED_REVISION = 0x00;
+	struct ccat_update_timing *timing;
+	struct ccat_cdev *ccdev;
+	int status;
 
 	if (SUPPORTED_REVISION != func->info.rev) {
 		pr_warn("CCAT Update rev. %d not supported\n", func->info.rev);
 		return -ENODEV;
 	}
-	return ccat_cdev_probe(func, &cdev_class, CCAT_FLASH_SIZE);
+
+	timing = devm_kzalloc(&pdev->dev, sizeof(*timing), GFP_KERNEL);
+	if (!timing) {
+		return -ENOMEM;
+	}
+	timing->erase_ns = CCAT_ERASE_NS_DEFAULT;
+	timing->program_ns = CCAT_PROGRAM_NS_DEFAULT;
+
+	status = ccat_cdev_probe(func, &cdev_class, CCAT_FLASH_SIZE);
+	if (status) {
+		return status;
+	}
+	ccdev = func->private_data;
+	ccdev->private_data = timing;
+
+	status = device_create_file(&pdev->dev, &dev_attr_firmware);
+	if (status) {
+		pr_warn("create firmware attribute failed\n");
+		ccat_cdev_remove(pdev);
+	}
+	return status;
+}
+
+static int ccat_update_remove(struct platform_device *pdev)
+{
+	device_remove_file(&pdev->dev, &dev_attr_firmware);
+	return ccat_cdev_remove(pdev);
 }
 
 static struct platform_driver update_driver = {
 	.driver = {.name = "ccat_update"},
 	.probe = ccat_update_probe,
-	.remove = ccat_cdev_remove,
+	.remove = ccat_update_remove,
 };
 
 module_platform_driver(update_driver);
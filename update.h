@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Update Driver for Beckhoff CCAT communication controller
+    Copyright (C) 2014 - 2018 Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+
+    FPGA flash command helpers of the CCAT Update function, shared by
+    ccat_update and ccat_bench.
+*/
+
+#ifndef _CCAT_UPDATE_H_
+#define _CCAT_UPDATE_H_
+
+#include <linux/sched.h>
+#include "module.h"
+
+#define CCAT_DATA_IN_4 0x038
+#define CCAT_DATA_IN_N 0x7F0
+#define CCAT_DATA_OUT_4 0x030
+#define CCAT_DATA_BLOCK_SIZE (size_t)((CCAT_DATA_IN_N - CCAT_DATA_IN_4)/8)
+
+/**     FUNCTION_NAME            CMD,  CLOCKS          */
+#define CCAT_BULK_ERASE          0xE3, 8
+#define CCAT_GET_PROM_ID         0xD5, 40
+#define CCAT_READ_FLASH          0xC0, 32
+#define CCAT_READ_STATUS         0xA0, 16
+#define CCAT_WRITE_ENABLE        0x60, 8
+#define CCAT_WRITE_FLASH         0x40, 32
+
+/* from http://graphics.stanford.edu/~seander/bithacks.html#ReverseByteWith32Bits */
+#define SWAP_BITS(B) \
+	((((B) * 0x0802LU & 0x22110LU) | ((B) * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16)
+
+/**
+ * wait_until_busy_reset() - wait until the busy flag was reset
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ */
+static inline void wait_until_busy_reset(void __iomem * const ioaddr)
+{
+	wmb();
+	while (ccat_ioread8(ioaddr + 1)) {
+		schedule();
+	}
+}
+
+/**
+ * __ccat_update_cmd() - Helper to issue a FPGA flash command
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ * @cmd: the command identifier
+ * @clocks: the number of clocks associated with the specified command
+ *
+ * no write memory barrier is called and the busy flag is not evaluated
+ */
+static inline void __ccat_update_cmd(void __iomem * const ioaddr, u8 cmd,
+				     u16 clocks)
+{
+	ccat_iowrite8((0xff00 & clocks) >> 8, ioaddr);
+	ccat_iowrite8(0x00ff & clocks, ioaddr + 0x8);
+	ccat_iowrite8(cmd, ioaddr + 0x10);
+}
+
+/**
+ * ccat_update_cmd() - Helper to issue a FPGA flash command
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ * @cmd: the command identifier
+ * @clocks: the number of clocks associated with the specified command
+ *
+ * Triggers a full flash command cycle with write memory barrier and
+ * command activate. This call blocks until the busy flag is reset.
+ */
+static inline void ccat_update_cmd(void __iomem * const ioaddr, u8 cmd,
+				   u16 clocks)
+{
+	__ccat_update_cmd(ioaddr, cmd, clocks);
+	wmb();
+	ccat_iowrite8(0xff, ioaddr + 0x7f8);
+	wait_until_busy_reset(ioaddr);
+}
+
+/**
+ * ccat_update_cmd_addr() - Helper to issue a FPGA flash command with address parameter
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ * @cmd: the command identifier
+ * @clocks: the number of clocks associated with the specified command
+ * @addr: 24 bit address associated with the specified command
+ *
+ * Triggers a full flash command cycle with write memory barrier and
+ * command activate. This call blocks until the busy flag is reset.
+ */
+static inline void ccat_update_cmd_addr(void __iomem * const ioaddr,
+					u8 cmd, u16 clocks, u32 addr)
+{
+	const u8 addr_0 = SWAP_BITS(addr & 0xff);
+	const u8 addr_1 = SWAP_BITS((addr & 0xff00) >> 8);
+	const u8 addr_2 = SWAP_BITS((addr & 0xff0000) >> 16);
+
+	__ccat_update_cmd(ioaddr, cmd, clocks);
+	ccat_iowrite8(addr_2, ioaddr + 0x18);
+	ccat_iowrite8(addr_1, ioaddr + 0x20);
+	ccat_iowrite8(addr_0, ioaddr + 0x28);
+	wmb();
+	ccat_iowrite8(0xff, ioaddr + 0x7f8);
+	wait_until_busy_reset(ioaddr);
+}
+
+/**
+ * ccat_get_status() - Read CCAT Update status
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ *
+ * Return: the current status of the CCAT Update function
+ */
+static inline u8 ccat_get_status(void __iomem * const ioaddr)
+{
+	ccat_update_cmd(ioaddr, CCAT_READ_STATUS);
+	return ccat_ioread8(ioaddr + 0x20);
+}
+
+/**
+ * ccat_read_flash_block() - Read a block of CCAT configuration data from flash
+ * @ioaddr: address of the CCAT Update function in PCI config space
+ * @addr: 24 bit address of the block to read
+ * @len: number of bytes to read from this block, len <= CCAT_DATA_BLOCK_SIZE
+ * @buf: output buffer
+ *
+ * Copies one block of configuration data from the CCAT FPGA's flash to
+ * a kernel buffer.
+ * Note that the size of the FPGA's firmware is not known exactly so it
+ * is very possible that the overall buffer ends with a lot of 0xff.
+ *
+ * Return: the number of bytes copied
+ */
+static inline int ccat_read_flash_block(void __iomem * const ioaddr,
+					const u32 addr, const u16 len, u8 * const buf)
+{
+	u16 i;
+	const u16 clocks = 8 * len;
+
+	ccat_update_cmd_addr(ioaddr, CCAT_READ_FLASH + clocks, addr);
+	for (i = 0; i < len; i++) {
+		buf[i] = ccat_ioread8(ioaddr + CCAT_DATA_IN_4 + 8 * i);
+	}
+	return len;
+}
+
+#endif /* #ifndef _CCAT_UPDATE_H_ */